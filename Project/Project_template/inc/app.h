@@ -0,0 +1,29 @@
+#ifndef APP_H_
+#define APP_H_
+
+#include "stm8l15x.h"
+
+#include "battery.h"
+#include "button.h"
+#include "keypad.h"
+
+typedef enum cmd_to_8670_e
+{
+	HEADSET1_PAIRING = 0,
+	HEADSET1_POWEROFF,
+	HEADSET2_PAIRING,
+	HEADSET2_POWEROFF,
+	HEADSET_COMBINATION
+} cmd_to_8670_t;
+
+/* Pulses the command to the headsets and keeps it in the settings */
+void send_8670_cmd(cmd_to_8670_t cmd);
+
+/* What the application does on each event, passed to the modules' init */
+void app_button_event_handler(const button_event_info_t *p_event);
+void app_battery_event_handler(battery_event_t battery_event);
+#ifdef KEYPAD_MATRIX
+void app_keypad_event_handler(const keypad_event_info_t *p_event);
+#endif
+
+#endif // APP_H_
@@ -1,6 +1,55 @@
 #ifndef BATTERY_H_
 #define BATTERY_H_
 
-float read_battery_voltage_mv(void);
+#include "stm8l15x.h"
+
+#include <stddef.h>
+
+/* Default thresholds, on a PVD level so they are reported without delay */
+#define BATTERY_LOW_MV         2450
+#define BATTERY_CRITICAL_MV    2050
+
+/* Number of VREFINT samples averaged per measurement, as a power of two */
+typedef enum
+{
+	BATTERY_OVERSAMPLE_16  = 4,
+	BATTERY_OVERSAMPLE_64  = 6,
+	BATTERY_OVERSAMPLE_256 = 8,
+} battery_oversample_t;
+
+typedef enum
+{
+	BATTERY_EVENT_NORMAL = 0,
+	BATTERY_EVENT_LOW,
+	BATTERY_EVENT_CRITICAL
+} battery_event_t;
+
+typedef void (*battery_event_handler_t)(battery_event_t battery_event);
+
+/* More samples give a steadier reading, fewer keep the ADC on for less time */
+void battery_set_oversample(battery_oversample_t oversample);
+
+/* Supply voltage in mV, measured against the internal reference */
+u16 read_battery_voltage_mv(void);
+
+#ifdef EVENT_ISR_PROFILE
+/* Longest time the mV division took, in SYSCLK cycles. It is the u32 by
+   u16 division of the compiler's runtime, the ADC and DMA are not counted */
+u32 battery_mv_max_cycles(void);
+#endif
+
+/*
+	Watch the supply with the PVD and report through the handler, from main(),
+	whenever it moves between normal, low and critical. The PVD trips on the
+	highest level at or below each threshold. While low, the supply is also
+	measured every 10 s to see it come back up. Call after timer_init().
+*/
+void battery_monitor_init(u16 low_mv, u16 critical_mv, battery_event_handler_t handler);
+
+/* PVD crossing, called from the interrupt */
+void battery_pvd_handler(void);
+
+/* DMA1 channel 0 transfer complete, called from the interrupt */
+void battery_dma_handler(void);
 
 #endif // BATTERY_H_
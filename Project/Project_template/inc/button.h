@@ -1,7 +1,65 @@
 #ifndef BUTTON_H_
 #define BUTTON_H_
 
-void button_event_handler(void);
-void button_init(void);
+#include "stm8l15x.h"
+#include "stm8l15x_exti.h"
+#include <stddef.h>
+
+/* Uncomment the line below to debounce by sampling the whole button port
+   every tick instead of masking each pin's EXTI line after an edge. All
+   buttons must then be on BUTTON_PORT */
+/* #define BUTTON_SAMPLED_DEBOUNCE */
+
+/* Uncomment the line below to count EXTI interrupts and debounced level
+   changes per button */
+/* #define BUTTON_STATS */
+
+typedef enum button_event_e
+{
+	BUTTON_INVALID = 0,
+	BUTTON1_SHORT_PRESS,
+	BUTTON1_DOUBLE_PRESS,
+	BUTTON1_LONG_HOLD,
+	BUTTON1_LONG_PRESS,
+	BUTTON1_VERY_LONG_HOLD,
+	BUTTON1_VERY_LONG_PRESS,
+	BUTTON1_MULTI_PRESS,
+	BUTTON2_SHORT_PRESS,
+	BUTTON2_DOUBLE_PRESS,
+	BUTTON2_LONG_HOLD,
+	BUTTON2_LONG_PRESS,
+	BUTTON2_VERY_LONG_HOLD,
+	BUTTON2_VERY_LONG_PRESS,
+	BUTTON2_MULTI_PRESS,
+	DOUBLE_BTN_TRACK
+} button_event_t;
+
+/* What the application gets with every button event. */
+typedef struct button_event_info_s
+{
+	button_event_t event;
+	u8   click_count;   // Clicks in the sequence, 2 for a double press.
+	u16  hold_ms;       // Time held so far for a hold, time held for a press.
+	u32  press_ms;      // sys_time_now_ms() at the push edge, after its bounce when sampled.
+} button_event_info_t;
+
+typedef void (*button_event_handler_t)(const button_event_info_t *p_event);
+
+#ifdef BUTTON_STATS
+/* Counters wrap at 65536 */
+typedef struct button_stats_s
+{
+	u16 irq_count;      // EXTI interrupts taken, 0 when sampled.
+	u16 change_count;   // Level changes after debouncing.
+} button_stats_t;
+
+/* Buttons are numbered in the order of m_button_config in button.c */
+void button_get_stats(u8 index, button_stats_t *p_stats);
+#endif
+
+void button_event_handler(EXTI_IT_TypeDef exti_it);
+
+/* Report the gestures of every button through the handler, from main() */
+void button_init(button_event_handler_t handler);
 
 #endif // BUTTON_H_
@@ -0,0 +1,25 @@
+#ifndef CLOCK_H_
+#define CLOCK_H_
+
+#include "stm8l15x.h"
+#include "stm8l15x_clk.h"
+
+/* SYSCLK divider of the 16 MHz HSI while no user needs full speed */
+#define CLOCK_IDLE_DIV    CLK_SYSCLKDiv_16
+
+/* Modules that need SYSCLK at full speed, one bit each */
+typedef enum clock_user_e
+{
+	CLOCK_USER_INIT  = 0x01,   // Held from clock_init() until main() releases it.
+	CLOCK_USER_PULSE = 0x02,   // Pulse timers count SYSCLK/128.
+	CLOCK_USER_ADC   = 0x04    // Conversion time and DMA window.
+} clock_user_t;
+
+void clock_init(void);
+
+/* Main() context only. SYSCLK runs at 16 MHz while any user holds it and
+   falls back to CLOCK_IDLE_DIV when the last one is released */
+void clock_request(clock_user_t user);
+void clock_release(clock_user_t user);
+
+#endif // CLOCK_H_
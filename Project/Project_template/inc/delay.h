@@ -1,9 +1,24 @@
 #ifndef DELAY_H_
 #define DELAY_H_
 
+#include "stm8l15x.h"
 
+/* Sleep in wait mode during delays longer than 1 ms instead of polling TIM1.
+   The delay then needs interrupts, so it must not be used from an interrupt. */
+/* #define DELAY_SLEEP */
 
 void delay_ms(u16 time_ms);
 void delay_10us(u16 time_10us);
+void delay_us(u32 time_us);
+
+/* Tick math, exposed so it can be checked for every SYSCLK divider */
+u16 delay_prescaler(u32 sysclk_hz);
+u32 delay_us_to_counts(u32 time_us, u32 rate_hz);
+
+#ifndef EVENT_ISR_PROFILE
+/* TIM1 update, called from the interrupt. Under EVENT_ISR_PROFILE the
+   update counts the cycle counter wraps instead */
+void delay_timer_handler(void);
+#endif
 
 #endif // DELAY_H_
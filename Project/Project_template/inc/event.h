@@ -0,0 +1,43 @@
+#ifndef EVENT_H_
+#define EVENT_H_
+
+#include "stm8l15x.h"
+
+/* Uncomment the line below to record the longest time spent in the
+   interrupt routines that post events, measured with TIM1 in SYSCLK cycles.
+   TIM1 then free runs, and its update interrupt counts the wraps */
+/* #define EVENT_ISR_PROFILE */
+
+typedef void (*event_handler_t)(void);
+
+void event_init(void);
+
+bool event_put(event_handler_t handler);
+
+void event_dispatch(void);
+
+bool event_is_empty(void);
+
+/* Events lost to a full queue since event_init(), stops at 255 */
+u8   event_dropped_count(void);
+
+#ifdef EVENT_ISR_PROFILE
+/* SYSCLK cycles since event_init(), wraps after 268 s at 16 MHz. Safe
+   from main() and from interrupts */
+u32  event_cycles(void);
+
+/* TIM1 update, called from the interrupt */
+void event_cycle_wrap_handler(void);
+
+void event_isr_enter(void);
+void event_isr_exit(void);
+u32  event_isr_max_cycles(void);
+
+#define EVENT_ISR_ENTER()    event_isr_enter()
+#define EVENT_ISR_EXIT()     event_isr_exit()
+#else
+#define EVENT_ISR_ENTER()
+#define EVENT_ISR_EXIT()
+#endif
+
+#endif // EVENT_H_
@@ -0,0 +1,27 @@
+#ifndef GPIO_FAST_H_
+#define GPIO_FAST_H_
+
+#include "stm8l15x.h"
+
+/*
+	Register level pin access for hot paths, without the call, assert_param
+	and branch of GPIO_WriteBit. With a constant port and a single pin, set,
+	reset and toggle compile to one BSET, BRES or BCPL on the register.
+	Several pins take a read-modify-write of the register, so interrupts
+	must be disabled if an interrupt writes the same port.
+*/
+#define GPIO_FAST_SET(port, pins)       ((port)->ODR |= (u8)(pins))
+#define GPIO_FAST_RESET(port, pins)     ((port)->ODR &= (u8)(~(pins)))
+#define GPIO_FAST_TOGGLE(port, pins)    ((port)->ODR ^= (u8)(pins))
+#define GPIO_FAST_READ(port, pins)      ((u8)((port)->IDR & (u8)(pins)))
+
+/* Pins of mask take their level from value in a single store, so they all
+   change on the same cycle */
+#define GPIO_FAST_WRITE(port, mask, value) \
+	((port)->ODR = (u8)(((port)->ODR & (u8)(~(mask))) | ((u8)(value) & (u8)(mask))))
+
+/* External interrupt enable of input pins, CR2 */
+#define GPIO_FAST_IT_ENABLE(port, pins)     ((port)->CR2 |= (u8)(pins))
+#define GPIO_FAST_IT_DISABLE(port, pins)    ((port)->CR2 &= (u8)(~(pins)))
+
+#endif // GPIO_FAST_H_
@@ -0,0 +1,25 @@
+#ifndef IDLE_H_
+#define IDLE_H_
+
+#include "stm8l15x.h"
+
+/* Time spent in each power mode, in ms measured with the RTC */
+typedef struct idle_stats_s
+{
+	u32 run_ms;
+	u32 wait_ms;
+	u32 halt_ms;
+	u32 lsi_hz;    // RTC clock as idle_init() measured it.
+} idle_stats_t;
+
+void idle_init(void);
+
+/* Sleeps until the next interrupt, called from the main loop once all
+   events are dispatched */
+void idle_enter(void);
+
+void idle_get_stats(idle_stats_t *p_stats);
+
+void idle_wakeup_handler(void);
+
+#endif // IDLE_H_
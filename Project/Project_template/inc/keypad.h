@@ -0,0 +1,60 @@
+#ifndef KEYPAD_H_
+#define KEYPAD_H_
+
+#include "stm8l15x.h"
+#include "stm8l15x_exti.h"
+#include <stddef.h>
+
+/* Uncomment the line below to scan a key matrix with rows on KEYPAD_ROW_PORT
+   and columns on KEYPAD_COL_PORT */
+/* #define KEYPAD_MATRIX */
+
+/* Uncomment the line below to stop scanning while no key is down and wake up
+   on the column port interrupt instead, so the MCU can halt */
+/* #define KEYPAD_WAKEUP */
+
+/* Open drain rows from pin 0 up, pulled up columns from pin 0 up, 8 at most */
+#define KEYPAD_ROW_PORT         (GPIOE)
+#define KEYPAD_ROWS             4
+#define KEYPAD_COL_PORT         (GPIOD)
+#define KEYPAD_COLS             4
+#define KEYPAD_COL_EXTI_PORT    (EXTI_Port_D)
+#define KEYPAD_COL_EXTI_IT      (EXTI_IT_PortD)
+#define KEYPAD_COL_HALF_LSB     (EXTI_HalfPort_D_LSB)
+#define KEYPAD_COL_HALF_MSB     (EXTI_HalfPort_D_MSB)
+
+#define KEYPAD_SCAN_PERIOD      1      // The unit is 10 ms, a level holds for 4 scans.
+#define KEYPAD_HOLD_DURATION    200    // The unit is 10 ms, so LONG_HOLD comes after 2 s.
+#define KEYPAD_SETTLE_US        5      // Column settling after a row is driven.
+
+#define KEYPAD_KEY(row, col)    ((u8)((row) * KEYPAD_COLS + (col)))
+#define KEYPAD_KEY_NUMBER       (KEYPAD_ROWS * KEYPAD_COLS)
+
+typedef enum
+{
+	KEYPAD_EVENT_PRESS = 0,
+	KEYPAD_EVENT_LONG_HOLD,
+	KEYPAD_EVENT_RELEASE
+} keypad_event_t;
+
+typedef struct keypad_event_info_s
+{
+	keypad_event_t event;
+	u8   key;       // KEYPAD_KEY(row, col).
+	u16  hold_ms;   // Time held, for LONG_HOLD and RELEASE.
+} keypad_event_info_t;
+
+typedef void (*keypad_event_handler_t)(const keypad_event_info_t *p_event);
+
+/*
+	Scan the matrix every KEYPAD_SCAN_PERIOD and report every key through the
+	handler, from main(). A scan that shows three corners of a rectangle is
+	ignored, the fourth key cannot be told from a ghost. Call after
+	button_init(), which resets the EXTI configuration.
+*/
+void keypad_init(keypad_event_handler_t handler);
+
+/* Column port edge while idle, called from the interrupt */
+void keypad_wakeup_handler(void);
+
+#endif // KEYPAD_H_
@@ -0,0 +1,44 @@
+#ifndef PULSE_H_
+#define PULSE_H_
+
+#include <stddef.h>
+
+#include "stm8l15x.h"
+
+typedef enum pulse_channel_e
+{
+	PULSE_CHANNEL_1 = 0,   // TIM2 channel 1 on PB0.
+	PULSE_CHANNEL_2,       // TIM3 channel 1 on PB1.
+	PULSE_CHANNEL_NUMBER
+} pulse_channel_t;
+
+typedef void (*pulse_done_handler_t)(void);
+
+/*
+	Every pulse is off_ms low followed by on_ms high, the line is low again
+	after the last one. off_ms + on_ms must not exceed 524 ms.
+*/
+typedef struct pulse_cmd_s
+{
+	pulse_channel_t channel;
+	u8   pulse_num;
+	u16  on_ms;
+	u16  off_ms;
+	pulse_done_handler_t done_handler;   // Runs from main(), may be NULL.
+} pulse_cmd_t;
+
+/* Queues the train and returns at once, FALSE if the channel queue is full.
+   Main() context only. */
+bool pulse_send(const pulse_cmd_t *p_cmd);
+
+/* The same for a train on each channel, either may be NULL. FALSE and
+   neither queued if one does not fit. Trains that start at once have both
+   timers set up before either counter is enabled, so they run in step.
+   The two must be for different channels. */
+bool pulse_send_pair(const pulse_cmd_t *p_cmd1, const pulse_cmd_t *p_cmd2);
+
+bool pulse_is_busy(void);
+
+void pulse_update_handler(pulse_channel_t channel);
+
+#endif // PULSE_H_
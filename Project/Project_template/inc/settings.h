@@ -0,0 +1,34 @@
+#ifndef SETTINGS_H_
+#define SETTINGS_H_
+
+#include "stm8l15x.h"
+
+/*
+	Values kept in the data EEPROM across resets. Keys only ever get added at
+	the end, a key that is not stored yet reads as the caller's default.
+*/
+typedef enum settings_key_e
+{
+	SETTINGS_KEY_NONE = 0,           // Marks an empty record, never stored.
+	SETTINGS_KEY_BUTTON_HOLD,        // Ticks until LONG_HOLD.
+	SETTINGS_KEY_BUTTON_VERY_LONG,   // Ticks after LONG_HOLD until VERY_LONG_HOLD.
+	SETTINGS_KEY_BUTTON_CLICK,       // Ticks to wait for the next click.
+	SETTINGS_KEY_CMD_PULSE,          // Period in ms of the pulses to the headsets.
+	SETTINGS_KEY_HEADSET1_CMD,       // Last cmd_to_8670_t sent to each headset.
+	SETTINGS_KEY_HEADSET2_CMD,
+	SETTINGS_KEY_NUMBER
+} settings_key_t;
+
+/* Finds the newest EEPROM block and builds the RAM index from its log */
+void settings_init(void);
+
+/* From the RAM index, no EEPROM access */
+u16 settings_get(settings_key_t key, u16 default_value);
+
+/* Appends a record unless the value is already stored, and moves the live
+   values to the next block once the current one is full. Waits for the
+   EEPROM, a few ms per word, so main() context only. FALSE if the EEPROM
+   reported an error. */
+bool settings_set(settings_key_t key, u16 value);
+
+#endif // SETTINGS_H_
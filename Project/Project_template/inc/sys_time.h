@@ -0,0 +1,43 @@
+#ifndef SYS_TIME_H_
+#define SYS_TIME_H_
+
+#include "stm8l15x.h"
+
+/*
+	Monotonic time since boot. The compiler has no 64 bit integer, so the
+	full value is split in seconds and microseconds.
+*/
+typedef struct sys_time_s
+{
+	u32 sec;
+	u32 us;    // 0 to 999999.
+} sys_time_t;
+
+/* Safe from main() and from interrupts, the readers never block the writer */
+void sys_time_now(sys_time_t *p_time);
+
+/* Low 32 bits of the time in us, wraps after 71 minutes, use for deltas */
+u32 sys_time_now_us(void);
+
+/* Time in ms, wraps after 49 days */
+u32 sys_time_now_ms(void);
+
+/* TIM4 update in the 10 ms tick build, called from the interrupt */
+void sys_time_update_handler(void);
+
+/* TIM4 counts accounted by the tickless timer module, counter_base is the
+   counter value they end at. Interrupts disabled */
+void sys_time_account(u16 counts, u8 counter_base);
+
+/* Halt stops TIM4, the time stands still from here to the next
+   sys_time_advance_ms(). Interrupts disabled */
+void sys_time_freeze(void);
+
+/* TRUE while frozen, an interrupt that wakes the core from halt reads the
+   time the halt started at */
+bool sys_time_is_frozen(void);
+
+/* Time spent in halt with TIM4 stopped, measured with the RTC */
+void sys_time_advance_ms(u32 ms);
+
+#endif // SYS_TIME_H_
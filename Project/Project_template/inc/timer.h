@@ -2,18 +2,94 @@
 #define TIMER_H_
 
 #include "stm8l15x.h"
+#include "stm8l15x_clk.h"
 #include "stm8l15x_tim4.h"
 
-typedef void (*app_timer_timeout_handler_t)(void);
+/* Uncomment the line below to program TIM4 for the next timer deadline
+   instead of interrupting on every 10 ms tick */
+/* #define TIMER_TICKLESS */
 
-void timer_init(void);
+/* Uncomment the line below to count starts, expiries and dispatch lateness
+   per timer and the cycles spent in the tick interrupt. Needs the TIM1 cycle
+   counter of EVENT_ISR_PROFILE */
+/* #define TIMER_STATS */
+
+#include "timer_config.h"
+
+/* The handler gets the index of the expired timer, so one handler can
+   serve several timers */
+typedef void (*app_timer_timeout_handler_t)(u8 timer_index);
 
-void timer_create(u8* timer_index, app_timer_timeout_handler_t timerout_hander);
+/* One id per line of TIMER_LIST, TIMER_NUMBER is the size of the pool. At
+   most 254 timers, the queue of timer.c links them with u8 indexes */
+#define TIMER_ENUM(id, handler)         id,
+typedef enum timer_id_e
+{
+	TIMER_LIST(TIMER_ENUM)
+	TIMER_NUMBER
+} timer_id_t;
 
+#define TIMER_PROTOTYPE(id, handler)    void handler(u8 timer_index);
+TIMER_LIST(TIMER_PROTOTYPE)
+
+void timer_init(void);
+
+/* Timeout handlers are posted to the event queue and run from main(), so
+   timers may only be started and stopped from main() context */
 void timer_start(u8 timer_index, u32 duration);
 
+/* Expires first after phase ticks, then every interval ticks. Each deadline
+   is counted from the previous one, not from when its handler ran, so the
+   timer does not drift. A late handler still runs once per dispatch. */
+void timer_start_periodic(u8 timer_index, u32 phase, u32 interval);
+
 void timer_stop(u8 timer_index);
 
+/* Runs the handler from main() as if the timer expired, its schedule is
+   left alone. From an interrupt, or main() with interrupts disabled. A full
+   event queue is retried like an expiry */
+void timer_fire(u8 timer_index);
+
+/* Ticks from now until the first started timer expires, TIMER_NO_EXPIRY if none */
+#define TIMER_NO_EXPIRY    0xFFFFFFFF
+u32 timer_next_expiry(void);
+
+/* Accounts the ticks that passed while TIM4 was stopped in halt mode */
+void timer_resume(u32 elapsed_ticks);
+
+/* Rescales TIM4 after CLK_SYSCLKDivConfig, with interrupts disabled, so
+   timer durations stay the same at any SYSCLK divider */
+void timer_set_sysclk_div(CLK_SYSCLKDiv_TypeDef div);
+
 void tick_timeout_handler(void);
 
+#ifdef TIMER_STATS
+/* Lateness buckets of 0, 1, 2-3, 4-7 and 8 or more ticks */
+#define TIMER_STATS_LATE_BUCKETS    5
+
+/* Counters wrap at 65536 */
+typedef struct timer_stats_s
+{
+	u16 start_count;
+	u16 fire_count;
+	u16 late_histogram[TIMER_STATS_LATE_BUCKETS];   // Ticks from deadline to handler.
+	u32 handler_max_cycles;
+} timer_stats_t;
+
+void timer_get_stats(u8 timer_index, timer_stats_t *p_stats);
+
+/* TIM4 interrupts taken and the SYSCLK cycles spent in them */
+void timer_get_isr_stats(u32 *p_isr_count, u32 *p_isr_cycles);
+
+/* Around the whole TIM4 routine, so every update it takes is counted */
+void timer_isr_enter(void);
+void timer_isr_exit(void);
+
+#define TIMER_ISR_ENTER()    timer_isr_enter()
+#define TIMER_ISR_EXIT()     timer_isr_exit()
+#else
+#define TIMER_ISR_ENTER()
+#define TIMER_ISR_EXIT()
+#endif
+
 #endif // TIMER_H_
@@ -0,0 +1,37 @@
+#ifndef TIMER_CONFIG_H_
+#define TIMER_CONFIG_H_
+
+#include "button.h"
+#include "keypad.h"
+
+/*
+	Every software timer of the firmware, one line each as
+	TIMER_DEF(id, timeout handler). The ids, the pool in timer.c and the
+	handler table are all generated from this list, so a module adds a timer
+	here instead of creating it at run time.
+*/
+#define TIMER_LIST(TIMER_DEF) \
+	TIMER_DEF(TIMER_ID_BUTTON1_DETECT,   button_duration_timeout_handler) \
+	TIMER_DEF(TIMER_ID_BUTTON2_DETECT,   button_duration_timeout_handler) \
+	BUTTON_DEBOUNCE_TIMER_LIST(TIMER_DEF)                                \
+	KEYPAD_TIMER_LIST(TIMER_DEF)                                         \
+	TIMER_DEF(TIMER_ID_BATTERY_CHECK,    battery_check_timeout_handler)
+
+/* The debounce method of button.h decides the button's debounce timers */
+#ifdef BUTTON_SAMPLED_DEBOUNCE
+#define BUTTON_DEBOUNCE_TIMER_LIST(TIMER_DEF) \
+	TIMER_DEF(TIMER_ID_BUTTON_SAMPLE,    btn_sample_timeout_handler)
+#else
+#define BUTTON_DEBOUNCE_TIMER_LIST(TIMER_DEF) \
+	TIMER_DEF(TIMER_ID_BUTTON1_DEBOUNCE, btn_debonce_timeout_handler)     \
+	TIMER_DEF(TIMER_ID_BUTTON2_DEBOUNCE, btn_debonce_timeout_handler)
+#endif
+
+#ifdef KEYPAD_MATRIX
+#define KEYPAD_TIMER_LIST(TIMER_DEF) \
+	TIMER_DEF(TIMER_ID_KEYPAD_SCAN,      keypad_scan_timeout_handler)
+#else
+#define KEYPAD_TIMER_LIST(TIMER_DEF)
+#endif
+
+#endif // TIMER_CONFIG_H_
@@ -0,0 +1,299 @@
+#include "stm8l15x.h"
+
+#include "pulse.h"
+#include "settings.h"
+#include "app.h"
+
+#define CMD_TO_8670_PAIRING        1
+#define CMD_TO_8670_POWER_OFF      2
+#define CMD_TO_8670_INQUIRY        3
+#define CMD_TO_8670_DISCOVERY      4
+
+#define CMD_PULSE_DURATION               120  // Default of SETTINGS_KEY_CMD_PULSE, half on and half off.
+
+
+void send_8670_cmd(cmd_to_8670_t cmd)
+{
+	u16 half_ms = settings_get(SETTINGS_KEY_CMD_PULSE, CMD_PULSE_DURATION) / 2;
+	pulse_cmd_t headset1_cmd = {PULSE_CHANNEL_1, 0, 0, 0, NULL};
+	pulse_cmd_t headset2_cmd = {PULSE_CHANNEL_2, 0, 0, 0, NULL};
+
+	headset1_cmd.on_ms = half_ms;
+	headset1_cmd.off_ms = half_ms;
+	headset2_cmd.on_ms = half_ms;
+	headset2_cmd.off_ms = half_ms;
+	switch (cmd)
+	{
+		case HEADSET1_PAIRING:
+		{
+			headset1_cmd.pulse_num = CMD_TO_8670_PAIRING;
+			break;
+		}
+		case HEADSET1_POWEROFF:
+		{
+			headset1_cmd.pulse_num = CMD_TO_8670_POWER_OFF;
+			break;
+		}
+		case HEADSET2_PAIRING:
+		{
+			headset2_cmd.pulse_num = CMD_TO_8670_PAIRING;
+			break;
+		}
+		case HEADSET2_POWEROFF:
+		{
+			headset2_cmd.pulse_num = CMD_TO_8670_POWER_OFF;
+			break;
+		}
+		case HEADSET_COMBINATION:
+		{
+			headset1_cmd.pulse_num = CMD_TO_8670_INQUIRY;
+			headset2_cmd.pulse_num = CMD_TO_8670_DISCOVERY;
+			break;
+		}
+		default:
+		{
+			break;
+		}
+	}
+
+	// Both headsets pulse in step, each on its own timer.
+	pulse_send_pair(&headset1_cmd, &headset2_cmd);
+
+	// The EEPROM write waits, so only once the pulses are under way.
+	if (headset1_cmd.pulse_num != 0)
+	{
+		settings_set(SETTINGS_KEY_HEADSET1_CMD, (u16)cmd);
+	}
+	if (headset2_cmd.pulse_num != 0)
+	{
+		settings_set(SETTINGS_KEY_HEADSET2_CMD, (u16)cmd);
+	}
+}
+
+void btn_short_button1_press(void)
+{
+}
+
+void btn_double_button1_press(void)
+{
+}
+
+void btn_long_hold_button1_press(void)
+{
+}
+
+void btn_long_button1_press(void)
+{
+	send_8670_cmd(HEADSET1_PAIRING);
+}
+
+void btn_very_long_hold_button1_press(void)
+{
+	send_8670_cmd(HEADSET1_POWEROFF);
+}
+
+void btn_very_long_button1_press(void)
+{
+}
+
+void btn_multi_button1_press(u8 click_count)
+{
+}
+
+void btn_short_button2_press(void)
+{
+}
+
+void btn_double_button2_press(void)
+{
+}
+
+void btn_long_hold_button2_press(void)
+{
+}
+
+void btn_long_button2_press(void)
+{
+	send_8670_cmd(HEADSET2_PAIRING);
+}
+
+void btn_very_long_hold_button2_press(void)
+{
+	send_8670_cmd(HEADSET2_POWEROFF);
+}
+
+void btn_very_long_button2_press(void)
+{
+}
+
+void btn_multi_button2_press(u8 click_count)
+{
+}
+
+void btn_double_long_hold_press(void)
+{
+	send_8670_cmd(HEADSET_COMBINATION);
+}
+
+void btn_battery_low(void)
+{
+}
+
+void btn_battery_critical(void)
+{
+}
+
+void btn_keypad_press(u8 key)
+{
+}
+
+void btn_keypad_long_hold(u8 key)
+{
+}
+
+void btn_keypad_release(u8 key, u16 hold_ms)
+{
+}
+
+void app_button_event_handler(const button_event_info_t *p_event)
+{
+	switch (p_event->event)
+	{
+		case BUTTON_INVALID:
+		{
+			break;
+		}
+		case BUTTON1_SHORT_PRESS:
+		{
+			btn_short_button1_press();
+			break;
+		}
+		case BUTTON1_DOUBLE_PRESS:
+		{
+			btn_double_button1_press();
+			break;
+		}
+		case BUTTON1_LONG_HOLD:
+		{
+			btn_long_hold_button1_press();
+			break;
+		}
+		case BUTTON1_LONG_PRESS:
+		{
+			btn_long_button1_press();
+			break;
+		}
+		case BUTTON1_VERY_LONG_HOLD:
+		{
+			btn_very_long_hold_button1_press();
+			break;
+		}
+		case BUTTON1_VERY_LONG_PRESS:
+		{
+			btn_very_long_button1_press();
+			break;
+		}
+		case BUTTON1_MULTI_PRESS:
+		{
+			btn_multi_button1_press(p_event->click_count);
+			break;
+		}
+		case BUTTON2_SHORT_PRESS:
+		{
+			btn_short_button2_press();
+			break;
+		}
+		case BUTTON2_DOUBLE_PRESS:
+		{
+			btn_double_button2_press();
+			break;
+		}
+		case BUTTON2_LONG_HOLD:
+		{
+			btn_long_hold_button2_press();
+			break;
+		}
+		case BUTTON2_LONG_PRESS:
+		{
+			btn_long_button2_press();
+			break;
+		}
+		case BUTTON2_VERY_LONG_HOLD:
+		{
+			btn_very_long_hold_button2_press();
+			break;
+		}
+		case BUTTON2_VERY_LONG_PRESS:
+		{
+			btn_very_long_button2_press();
+			break;
+		}
+		case BUTTON2_MULTI_PRESS:
+		{
+			btn_multi_button2_press(p_event->click_count);
+			break;
+		}
+		case DOUBLE_BTN_TRACK:
+		{
+			btn_double_long_hold_press();
+			break;
+		}
+		default:
+		{
+			break;
+		}
+	}
+}
+
+void app_battery_event_handler(battery_event_t battery_event)
+{
+	switch (battery_event)
+	{
+		case BATTERY_EVENT_NORMAL:
+		{
+			break;
+		}
+		case BATTERY_EVENT_LOW:
+		{
+			btn_battery_low();
+			break;
+		}
+		case BATTERY_EVENT_CRITICAL:
+		{
+			btn_battery_critical();
+			break;
+		}
+		default:
+		{
+			break;
+		}
+	}
+}
+
+#ifdef KEYPAD_MATRIX
+void app_keypad_event_handler(const keypad_event_info_t *p_event)
+{
+	switch (p_event->event)
+	{
+		case KEYPAD_EVENT_PRESS:
+		{
+			btn_keypad_press(p_event->key);
+			break;
+		}
+		case KEYPAD_EVENT_LONG_HOLD:
+		{
+			btn_keypad_long_hold(p_event->key);
+			break;
+		}
+		case KEYPAD_EVENT_RELEASE:
+		{
+			btn_keypad_release(p_event->key, p_event->hold_ms);
+			break;
+		}
+		default:
+		{
+			break;
+		}
+	}
+}
+#endif
@@ -1,12 +1,17 @@
 #include "stm8l15x.h"
 #include "stm8l15x_adc.h"
 #include "stm8l15x_clk.h"
+#include "stm8l15x_dma.h"
+#include "stm8l15x_pwr.h"
 
+#include "clock.h"
 #include "delay.h"
+#include "event.h"
+#include "timer.h"
 #include "battery.h"
 
 /* Theorically BandGAP 1.224volt */
-#define VREF 		1.224L
+#define VREF_MV 	1224
 
 /*
 	ADC Converter
@@ -14,72 +19,298 @@
 */
 #define ADC_CONV 	4096
 
+/* The averaged VREFINT data keeps 4 fractional bits, in 1/16 LSB. */
+#define REF_DATA_FRACTION_SHIFT 	4
+
+/* VDDA = VREF * ADC_CONV / VREFINT data, so only one integer division is left. */
+#define VREF_MV_ADC_CONV 	(((u32)VREF_MV * ADC_CONV) << REF_DATA_FRACTION_SHIFT)
+
+/* ADC1 is served by DMA1 channel 0, which reads DRH:DRL as one half word. */
+#define ADC1_DR_ADDRESS 	((u16)&ADC1->DRH)
+
+/*
+	The DMA counter is only 8 bit, so the samples are taken in windows of
+	this size and added up between the windows.
+*/
+#define BATTERY_DMA_BUFFER_SIZE 	64
+
+static u16 m_adc_buffer[BATTERY_DMA_BUFFER_SIZE];
+static volatile bool m_adc_dma_done = FALSE;
+static battery_oversample_t m_oversample = BATTERY_OVERSAMPLE_64;
+
+/* PVD thresholds in mV, the level of index i is PWR_PVDLevel_1V85 + 2 * i. */
+static const u16 m_pvd_level_mv[] = {1850, 2050, 2260, 2450, 2650, 2850, 3050};
+
+#define PVD_LEVEL_NUMBER 	(sizeof(m_pvd_level_mv) / sizeof(m_pvd_level_mv[0]))
+
+/*
+	The PVD has a single level. While low it watches the critical one, and
+	the way back up is measured every BATTERY_POLL_PERIOD instead. NORMAL
+	needs the hysteresis on top of the low threshold, so a supply sitting on
+	it does not toggle the state with every poll.
+*/
+#define BATTERY_POLL_PERIOD 	1000    // The unit is 10 ms, so one measurement every 10 s.
+#define BATTERY_HYSTERESIS_MV 	50
+
+static u16 m_low_mv = 0;
+static u16 m_critical_mv = 0;
+static battery_event_t m_battery_state = BATTERY_EVENT_NORMAL;
+static battery_event_handler_t m_battery_handler = NULL;
+
+#ifdef EVENT_ISR_PROFILE
+static u32 m_mv_max_cycles = 0;
+#endif
+
+void battery_set_oversample(battery_oversample_t oversample)
+{
+	m_oversample = oversample;
+}
+
+// Called from the DMA1 channel 0/1 interrupt.
+void battery_dma_handler(void)
+{
+	if (DMA_GetITStatus(DMA1_IT_TC0) != RESET)
+	{
+		// The ADC keeps converting, stop the transfers until the next window.
+		DMA_Cmd(DMA1_Channel0, DISABLE);
+		DMA_ClearITPendingBit(DMA1_IT_TC0);
+		m_adc_dma_done = TRUE;
+	}
+}
+
+// Fill the buffer once and sleep until the transfer complete interrupt.
+static u32 battery_dma_window(u8 samples)
+{
+	u8 i;
+	u32 sum = 0;
+
+	m_adc_dma_done = FALSE;
+	DMA_SetCurrDataCounter(DMA1_Channel0, samples);
+	DMA_Cmd(DMA1_Channel0, ENABLE);
+
+	// WFI enables interrupts, so the completion cannot slip in after the check.
+	disableInterrupts();
+	while (m_adc_dma_done == FALSE)
+	{
+		wfi();
+		disableInterrupts();
+	}
+	enableInterrupts();
+
+	for (i = 0; i < samples; i ++)
+	{
+		sum += m_adc_buffer[i];
+	}
+	return sum;
+}
+
+/* VREFINT data averaged over the selected number of samples, in 1/16 LSB. */
 u16 get_ref_voltage_data(void)
 {
-	uint8_t i;
-	uint16_t res;
+	u16 samples;
+	u16 window;
+	u32 sum;
 
-	/* Enable ADC clock */
-	CLK_PeripheralClockConfig(CLK_Peripheral_ADC1, ENABLE);
+	clock_request(CLOCK_USER_ADC);
 
-	/* de-initialize ADC */
-	ADC_DeInit(ADC1);
+	/* Enable ADC and DMA clock */
+	CLK_PeripheralClockConfig(CLK_Peripheral_ADC1, ENABLE);
+	CLK_PeripheralClockConfig(CLK_Peripheral_DMA1, ENABLE);
 
 	/*ADC configuration
 	ADC configured as follow:
 	- Channel VREF
-	- Mode = Single ConversionMode(ContinuousConvMode disabled)
+	- Mode = Continuous ConversionMode, every result moved by DMA
 	- Resolution = 12Bit
 	- Prescaler = /1
 	- sampling time 9 */
 
 	ADC_VrefintCmd(ENABLE);
-	delay_10us(3);
-
-
 	ADC_Cmd(ADC1, ENABLE);
-	ADC_Init(ADC1, ADC_ConversionMode_Single,
+	ADC_Init(ADC1, ADC_ConversionMode_Continuous,
 	ADC_Resolution_12Bit, ADC_Prescaler_1);
 
 	ADC_SamplingTimeConfig(ADC1, ADC_Group_FastChannels, ADC_SamplingTime_9Cycles);
 	ADC_ChannelCmd(ADC1, ADC_Channel_Vrefint, ENABLE);
 	delay_10us(3);
 
-	/* initialize result */
-	res = 0;
-	for(i=8; i>0; i--)
+	DMA_Init(DMA1_Channel0, (u16)m_adc_buffer, ADC1_DR_ADDRESS,
+	         BATTERY_DMA_BUFFER_SIZE, DMA_DIR_PeripheralToMemory, DMA_Mode_Normal,
+	         DMA_MemoryIncMode_Inc, DMA_Priority_High, DMA_MemoryDataSize_HalfWord);
+	DMA_ITConfig(DMA1_Channel0, DMA_ITx_TC, ENABLE);
+	DMA_GlobalCmd(ENABLE);
+	ADC_DMACmd(ADC1, ENABLE);
+
+	/* start ADC convertion by software, it runs until the ADC is powered off */
+	ADC_SoftwareStartConv(ADC1);
+
+	sum = 0;
+	samples = (u16)1 << m_oversample;
+	while (samples > 0)
 	{
-		/* start ADC convertion by software */
-		ADC_SoftwareStartConv(ADC1);
-		/* wait until end-of-covertion */
-		while( ADC_GetFlagStatus(ADC1, ADC_FLAG_EOC) == 0 );
-		/* read ADC convertion result */
-		res += ADC_GetConversionValue(ADC1);
+		window = (samples > BATTERY_DMA_BUFFER_SIZE) ? BATTERY_DMA_BUFFER_SIZE : samples;
+		sum += battery_dma_window((u8)window);
+		samples -= window;
 	}
 
-	/* de-initialize ADC */
+	/* power off ADC and VREFINT as soon as the last window is in */
+	ADC_DMACmd(ADC1, DISABLE);
+	ADC_Cmd(ADC1, DISABLE);
+	ADC_ChannelCmd(ADC1, ADC_Channel_Vrefint, DISABLE);
 	ADC_VrefintCmd(DISABLE);
 
-	ADC_DeInit(ADC1);
+	DMA_GlobalCmd(DISABLE);
+	DMA_DeInit(DMA1_Channel0);
 
 	/* disable SchmittTrigger for ADC_Channel_24, to save power */
 	ADC_SchmittTriggerConfig(ADC1, ADC_Channel_24, DISABLE);
 
+	CLK_PeripheralClockConfig(CLK_Peripheral_DMA1, DISABLE);
 	CLK_PeripheralClockConfig(CLK_Peripheral_ADC1, DISABLE);
-	ADC_ChannelCmd(ADC1, ADC_Channel_Vrefint, DISABLE);
+	clock_release(CLOCK_USER_ADC);
 
-	return (res>>3);
+	// Decimate: 16 samples give the 1/16 LSB fraction, more samples are averaged.
+	return (u16)(sum >> (m_oversample - REF_DATA_FRACTION_SHIFT));
 }
 
 
-float read_battery_voltage_mv(void)
+// Rounded to the nearest mV, ref_vol_data must not be 0.
+static u16 battery_data_to_mv(u16 ref_vol_data)
 {
-	float batt_vol_mv;
-	u16 ref_vol_mv;
+	return (u16)((VREF_MV_ADC_CONV + (ref_vol_data / 2)) / ref_vol_data);
+}
 
-	ref_vol_mv = get_ref_voltage_data();
+u16 read_battery_voltage_mv(void)
+{
+	u16 ref_vol_data;
+	u16 mv;
+#ifdef EVENT_ISR_PROFILE
+	u32 start;
+	u32 cycles;
+#endif
 
-	batt_vol_mv = (VREF/ref_vol_mv) * ADC_CONV;
+	ref_vol_data = get_ref_voltage_data();
+	if (ref_vol_data == 0)
+	{
+		return 0;
+	}
 
-	return batt_vol_mv;
+#ifdef EVENT_ISR_PROFILE
+	start = event_cycles();
+	mv = battery_data_to_mv(ref_vol_data);
+	cycles = event_cycles() - start;
+	if (cycles > m_mv_max_cycles)
+	{
+		m_mv_max_cycles = cycles;
+	}
+#else
+	mv = battery_data_to_mv(ref_vol_data);
+#endif
+	return mv;
+}
+
+#ifdef EVENT_ISR_PROFILE
+u32 battery_mv_max_cycles(void)
+{
+	return m_mv_max_cycles;
+}
+#endif
+
+// Highest PVD level at or below the given supply, so a trip means it is crossed.
+static PWR_PVDLevel_TypeDef battery_pvd_level(u16 mv)
+{
+	u8 i;
+
+	for (i = PVD_LEVEL_NUMBER - 1; i > 0; i --)
+	{
+		if (m_pvd_level_mv[i] <= mv)
+		{
+			break;
+		}
+	}
+	return (PWR_PVDLevel_TypeDef)(PWR_PVDLevel_1V85 + (i << 1));
+}
+
+// Watch the threshold below the current state, a crossing in either direction interrupts.
+static void battery_pvd_arm(void)
+{
+	u16 threshold_mv = (m_battery_state == BATTERY_EVENT_NORMAL) ? m_low_mv : m_critical_mv;
+
+	PWR_PVDITConfig(DISABLE);
+	PWR_PVDLevelConfig(battery_pvd_level(threshold_mv));
+	PWR_PVDClearITPendingBit();
+	PWR_PVDITConfig(ENABLE);
+
+	if (m_battery_state == BATTERY_EVENT_LOW)
+	{
+		timer_start_periodic(TIMER_ID_BATTERY_CHECK, BATTERY_POLL_PERIOD, BATTERY_POLL_PERIOD);
+	}
+	else
+	{
+		timer_stop(TIMER_ID_BATTERY_CHECK);
+	}
+}
+
+// Runs from main(), measures once and reports a state change.
+static void battery_check(void)
+{
+	u16 mv = read_battery_voltage_mv();
+	u16 low_mv = m_low_mv;
+	battery_event_t state = BATTERY_EVENT_NORMAL;
+
+	if (m_battery_state != BATTERY_EVENT_NORMAL)
+	{
+		low_mv += BATTERY_HYSTERESIS_MV;
+	}
+	if (mv < m_critical_mv)
+	{
+		state = BATTERY_EVENT_CRITICAL;
+	}
+	else if (mv < low_mv)
+	{
+		state = BATTERY_EVENT_LOW;
+	}
+
+	if (state != m_battery_state)
+	{
+		m_battery_state = state;
+		battery_pvd_arm();
+		m_battery_handler(state);
+	}
+}
+
+/*
+	Except for the poll while low, nothing is sampled while the supply stays
+	on one side of the PVD level. The PVD needs the internal reference in halt, so ultra low power mode is
+	left off while the monitor runs.
+*/
+void battery_monitor_init(u16 low_mv, u16 critical_mv, battery_event_handler_t handler)
+{
+	m_low_mv = low_mv;
+	m_critical_mv = critical_mv;
+	m_battery_handler = handler;
+	m_battery_state = BATTERY_EVENT_NORMAL;
+
+	PWR_UltraLowPowerCmd(DISABLE);
+	PWR_PVDCmd(ENABLE);
+	battery_pvd_arm();
+
+	// The supply may already be low at power up.
+	battery_check();
+}
+
+void battery_check_timeout_handler(u8 timer_index)
+{
+	battery_check();
+}
+
+// Called from the PVD interrupt.
+void battery_pvd_handler(void)
+{
+	if (PWR_PVDGetITStatus() != RESET)
+	{
+		PWR_PVDClearITPendingBit();
+		// Through the check timer, which posts again if the queue is full.
+		timer_fire(TIMER_ID_BATTERY_CHECK);
+	}
 }
@@ -2,6 +2,10 @@
 #include "stm8l15x_gpio.h"
 #include "stm8l15x_exti.h"
 
+#include "event.h"
+#include "gpio_fast.h"
+#include "settings.h"
+#include "sys_time.h"
 #include "timer.h"
 #include "button.h"
 
@@ -12,22 +16,17 @@
 #define BUTTON_PORT  (GPIOB)
 #define BUTTON_PIN1  (GPIO_Pin_6)
 #define BUTTON_PIN2  (GPIO_Pin_7)
+#define BUTTON_PORT_IT (EXTI_IT_PortB)  // Port interrupt of BUTTON_PORT, covers every button.
 
-#define BUTTON_DEBONCE_DURATION    3    // The unit is 10 ms, so the duration is 30 ms.
+#define BUTTON_DEBONCE_DURATION    3    // The unit is 10 ms, so the pin is masked for 30 ms.
+#define BUTTON_SAMPLE_PERIOD       1    // The unit is 10 ms, a level holds for 4 samples, 30 to 40 ms.
+#define BUTTON_SAMPLE_LATENCY_MS   (3 * BUTTON_SAMPLE_PERIOD * 10)   // From the first of the 4 samples.
 #define BUTTON_WAIT_2S             200  // The unit is 10 ms, so the duration is 2 s.
 #define BUTTON_WAIT_3S             300  // The unit is 10 ms, so the duration is 3 s.
-#define BUTTON_DOUBLE_BTN_DURATION 50   // The unit is 10 ms, so the duration is 500 ms.
+#define BUTTON_DOUBLE_BTN_DURATION 50   // The unit is 10 ms, so the window for the next click is 500 ms.
+#define BUTTON_CLICK_MAX           4    // Clicks reported without waiting, 2 for double press only.
 #define BUTTON_DOUBLE_BTN_TRACK_DURATION 300 // The unit is 10 ms, so the duration is 3 s.
 
-#define CMD_TO_8670_PAIRING        1
-#define CMD_TO_8670_POWER_OFF      2
-#define CMD_TO_8670_INQUIRY        3
-#define CMD_TO_8670_DISCOVERY      4
-
-#define CMD_PULSE_DURATION               120
-#define CMD_PULSE_ON_DURATION            (CMD_PULSE_DURATION / 2)
-#define CMD_PULSE_HALF_OFF_DURATION      (CMD_PULSE_DURATION / 4)
-
 
 typedef enum button_timer_status_e
 {
@@ -35,183 +34,168 @@ typedef enum button_timer_status_e
 	BUTTON_STATUS_LESS_2S,
 	BUTTON_STATUS_MORE_2S,
 	BUTTON_STATUS_MORE_5S,
+	BUTTON_STATUS_CLICK_WAIT,
 	BUTTON_STATUS_DOUBLE_TRACK
 }button_timer_status_t;
 
-typedef enum button_event_e
+/* Offset of each gesture from the first event of a button in button_event_t. */
+typedef enum button_gesture_e
+{
+	BUTTON_GESTURE_SHORT_PRESS = 0,
+	BUTTON_GESTURE_DOUBLE_PRESS,
+	BUTTON_GESTURE_LONG_HOLD,
+	BUTTON_GESTURE_LONG_PRESS,
+	BUTTON_GESTURE_VERY_LONG_HOLD,
+	BUTTON_GESTURE_VERY_LONG_PRESS,
+	BUTTON_GESTURE_MULTI_PRESS       // Three clicks and more, see click_count.
+} button_gesture_t;
+
+typedef struct button_config_s
+{
+	GPIO_TypeDef     *port;
+	u8               pin;
+	EXTI_Pin_TypeDef exti_pin;
+	EXTI_IT_TypeDef  exti_it;             // Pending bit of exti_pin.
+	u16              debounce_duration;   // EXTI masked after an edge.
+	button_event_t   first_event;         // SHORT_PRESS event of the button.
+	u16              hold_duration;       // Push time until LONG_HOLD, by default.
+	u16              very_long_duration;  // Time after LONG_HOLD until VERY_LONG_HOLD, by default.
+	u16              click_duration;      // Window for the next click, by default.
+	u8               timer_id_detet;      // Hold durations and click window, from TIMER_LIST.
+	u8               timer_id_debounce;   // TIMER_NUMBER when sampled.
+} button_config_t;
+
+typedef struct button_s
 {
-	BUTTON_INVALID = 0,
-	BUTTON1_SHORT_PRESS,
-	BUTTON1_DOUBLE_PRESS,
-	BUTTON1_LONG_HOLD,
-	BUTTON1_LONG_PRESS,
-	BUTTON1_VERY_LONG_HOLD,
-	BUTTON1_VERY_LONG_PRESS,
-	BUTTON2_SHORT_PRESS,
-	BUTTON2_DOUBLE_PRESS,
-	BUTTON2_LONG_HOLD,
-	BUTTON2_LONG_PRESS,
-	BUTTON2_VERY_LONG_HOLD,
-	BUTTON2_VERY_LONG_PRESS,
-	DOUBLE_BTN_TRACK
-} button_event_t;
-
-typedef enum cmd_to_8670_e
+	button_timer_status_t timer_status;
+	bool is_pushed;
+	BitStatus status;                // Debounced pin level.
+	button_event_info_t info;        // Reported by pointer, filled as the gesture goes.
+} button_t;
+
+#ifdef BUTTON_SAMPLED_DEBOUNCE
+#define BUTTON_DEBOUNCE_TIMER(id)    (TIMER_NUMBER)
+#else
+#define BUTTON_DEBOUNCE_TIMER(id)    (id)
+#endif
+
+/*
+	Buttons 0 and 1 also form the double button long hold. Adding a button
+	only takes a line here, its events in button_event_t, its two timers in
+	TIMER_LIST and its EXTI line.
+*/
+static const button_config_t m_button_config[] =
 {
-	HEADSET1_PAIRING = 0,
-	HEADSET1_POWEROFF,
-	HEADSET2_PAIRING,
-	HEADSET2_POWEROFF,
-	HEADSET_COMBINATION
-} cmd_to_8670_t;
+	{BUTTON_PORT, BUTTON_PIN1, EXTI_Pin_6, EXTI_IT_Pin6, BUTTON_DEBONCE_DURATION,
+	 BUTTON1_SHORT_PRESS, BUTTON_WAIT_2S, BUTTON_WAIT_3S, BUTTON_DOUBLE_BTN_DURATION,
+	 TIMER_ID_BUTTON1_DETECT, BUTTON_DEBOUNCE_TIMER(TIMER_ID_BUTTON1_DEBOUNCE)},
+	{BUTTON_PORT, BUTTON_PIN2, EXTI_Pin_7, EXTI_IT_Pin7, BUTTON_DEBONCE_DURATION,
+	 BUTTON2_SHORT_PRESS, BUTTON_WAIT_2S, BUTTON_WAIT_3S, BUTTON_DOUBLE_BTN_DURATION,
+	 TIMER_ID_BUTTON2_DETECT, BUTTON_DEBOUNCE_TIMER(TIMER_ID_BUTTON2_DEBOUNCE)},
+};
 
-static button_timer_status_t  m_button1_timer_status = BUTTON_STATUS_INIT;
-static button_timer_status_t  m_button2_timer_status = BUTTON_STATUS_INIT;
+#define BUTTON_NUMBER    (sizeof(m_button_config) / sizeof(m_button_config[0]))
 
-static bool detect_double_button1_press = FALSE;
-static bool detect_double_button2_press = FALSE;
+/* m_button_debounce_pending has a bit per button. */
+typedef char button_number_check_t[(BUTTON_NUMBER <= 8) ? 1 : -1];
+
+static button_t m_button[BUTTON_NUMBER];
 
-static bool button1_is_pushed = FALSE;
-static bool button2_is_pushed = FALSE;
 static bool double_button_track = FALSE;
 
-static u8   button_status = 0xFF;
-static u8   button_first_detect_status = 0xFF;
+static button_event_handler_t m_button_handler = NULL;
+
+static volatile u32 m_button_edge_ms[BUTTON_NUMBER];   // Time of the edge that masked the pin, or of the first sample of the level.
+#ifndef BUTTON_SAMPLED_DEBOUNCE
+static volatile u8  m_button_debounce_pending = 0;      // Masked pins whose timer is not started yet.
+static volatile u8  m_button_edge_at_wake = 0;          // Edges that woke the core from halt.
+#endif
 
-static u8   m_timer_id_button1_detet;
-static u8   m_timer_id_double_btn1_detet;
-static u8   m_timer_id_button2_detet;
-static u8   m_timer_id_double_btn2_detet;
+#ifdef BUTTON_STATS
+static button_stats_t m_button_stats[BUTTON_NUMBER];
+#endif
 
-static u8   m_timer_id_debonce_detet;
+#ifdef BUTTON_SAMPLED_DEBOUNCE
+/* Debounced BUTTON_PORT levels and a 2 bit counter per pin, one bit plane each. */
+static u8 m_button_port_state = 0xFF;
+static u8 m_button_count0 = 0xFF;
+static u8 m_button_count1 = 0xFF;
+#endif
 
-extern u32 int_timer1;
-extern u32 int_timer2;
 
-void app_button_event_handler(button_event_t button_event);
-void button1_push(void);
-void button1_release(void);
-void button2_push(void);
-void button2_release(void);
+static void button_push(u8 index);
+static void button_release(u8 index);
 
-void send_8670_cmd(cmd_to_8670_t cmd)
+static u8 button_find_by_timer(u8 timer_index)
 {
-	u8 headset1_pulse_num = 0;
-	u8 headset2_pulse_num = 0;
-	switch (cmd)
+	u8 index;
+
+	for (index = 0; index < BUTTON_NUMBER; index ++)
 	{
-		case HEADSET1_PAIRING:
-		{
-			headset1_pulse_num = CMD_TO_8670_PAIRING;
-			break;
-		}
-		case HEADSET1_POWEROFF:
-		{
-			headset1_pulse_num = CMD_TO_8670_POWER_OFF;
-			break;
-		}
-		case HEADSET2_PAIRING:
-		{
-			headset2_pulse_num = CMD_TO_8670_PAIRING;
-			break;
-		}
-		case HEADSET2_POWEROFF:
-		{
-			headset2_pulse_num = CMD_TO_8670_PAIRING;
-			break;
-		}
-		case HEADSET_COMBINATION:
-		{
-			headset1_pulse_num = CMD_TO_8670_INQUIRY;
-			headset2_pulse_num = CMD_TO_8670_DISCOVERY;
-			break;
-		}
-		default:
+		if ((m_button_config[index].timer_id_detet == timer_index) ||
+		    (m_button_config[index].timer_id_debounce == timer_index))
 		{
 			break;
 		}
 	}
+	return index;
+}
 
-	while ((headset1_pulse_num > 0) && (headset2_pulse_num > 0))
-	{
-		headset1_pulse_num --;
-		headset2_pulse_num --;
-		delay_ms(CMD_PULSE_HALF_OFF_DURATION);
-		GPIO_WriteBit(LEDS_PORT, LED_PIN1, SET);
-		GPIO_WriteBit(LEDS_PORT, LED_PIN2, SET);
-		delay_ms(CMD_PULSE_ON_DURATION);
-		GPIO_WriteBit(LEDS_PORT, LED_PIN1, RESET);
-		GPIO_WriteBit(LEDS_PORT, LED_PIN2, RESET);
-		delay_ms(CMD_PULSE_HALF_OFF_DURATION);
-	}
+static u16 button_elapsed_ms(u32 since_ms, u32 now_ms)
+{
+	u32 elapsed = now_ms - since_ms;
 
-	while (headset1_pulse_num > 0)
-	{
-		headset1_pulse_num --;
-		delay_ms(CMD_PULSE_HALF_OFF_DURATION);
-		GPIO_WriteBit(LEDS_PORT, LED_PIN1, SET);
-		delay_ms(CMD_PULSE_ON_DURATION);
-		GPIO_WriteBit(LEDS_PORT, LED_PIN1, RESET);
-		delay_ms(CMD_PULSE_HALF_OFF_DURATION);
-	}
+	return (elapsed > 0xFFFF) ? 0xFFFF : (u16)elapsed;
+}
 
-	while (headset2_pulse_num > 0)
-	{
-		headset2_pulse_num --;
-		delay_ms(CMD_PULSE_HALF_OFF_DURATION);
-		GPIO_WriteBit(LEDS_PORT, LED_PIN2, SET);
-		delay_ms(CMD_PULSE_ON_DURATION);
-		GPIO_WriteBit(LEDS_PORT, LED_PIN2, RESET);
-		delay_ms(CMD_PULSE_HALF_OFF_DURATION);
-	}
+static u32 button_edge_ms(u8 index)
+{
+	u32 edge_ms;
+
+	disableInterrupts();
+	edge_ms = m_button_edge_ms[index];
+	enableInterrupts();
+	return edge_ms;
 }
 
-static void button1_duration_timeout_handler(void)
+static void button_report(u8 index, button_event_t button_event)
 {
-	button_event_t button_event = BUTTON_INVALID;
-	switch (m_button1_timer_status)
+	m_button[index].info.event = button_event;
+	m_button_handler(&m_button[index].info);
+}
+
+static button_event_t button_click_event(u8 index)
+{
+	button_gesture_t gesture;
+
+	switch (m_button[index].info.click_count)
 	{
-		case BUTTON_STATUS_INIT:
-		{
-			break;
-		}
-		case BUTTON_STATUS_LESS_2S:
+		case 1:
 		{
-			button_event = BUTTON1_LONG_HOLD;
-			timer_start(m_timer_id_button1_detet, BUTTON_WAIT_3S);
-			m_button1_timer_status = BUTTON_STATUS_MORE_2S;
+			gesture = BUTTON_GESTURE_SHORT_PRESS;
 			break;
 		}
-		case BUTTON_STATUS_MORE_2S:
+		case 2:
 		{
-			button_event = BUTTON1_VERY_LONG_HOLD;
-			m_button1_timer_status = BUTTON_STATUS_MORE_5S;
+			gesture = BUTTON_GESTURE_DOUBLE_PRESS;
 			break;
 		}
-		case BUTTON_STATUS_MORE_5S:
-		{
-			break;
-		}
-		case BUTTON_STATUS_DOUBLE_TRACK:
-		{
-			button_event = DOUBLE_BTN_TRACK;
-			m_button1_timer_status = BUTTON_STATUS_INIT;
-		}
 		default:
 		{
+			gesture = BUTTON_GESTURE_MULTI_PRESS;
 			break;
 		}
 	}
-	if (button_event != BUTTON_INVALID)
-	{
-		app_button_event_handler(button_event);
-	}
+	return (button_event_t)(m_button_config[index].first_event + gesture);
 }
 
-static void button2_duration_timeout_handler(void)
+void button_duration_timeout_handler(u8 timer_index)
 {
+	u8 index = button_find_by_timer(timer_index);
+	button_t *p_button = &m_button[index];
 	button_event_t button_event = BUTTON_INVALID;
-	switch (m_button2_timer_status)
+
+	switch (p_button->timer_status)
 	{
 		case BUTTON_STATUS_INIT:
 		{
@@ -219,23 +203,33 @@ static void button2_duration_timeout_handler(void)
 		}
 		case BUTTON_STATUS_LESS_2S:
 		{
-			button_event = BUTTON2_LONG_HOLD;
-			timer_start(m_timer_id_button2_detet, BUTTON_WAIT_3S);
-			m_button2_timer_status = BUTTON_STATUS_MORE_2S;
+			button_event = (button_event_t)(m_button_config[index].first_event + BUTTON_GESTURE_LONG_HOLD);
+			timer_start(m_button_config[index].timer_id_detet,
+			            settings_get(SETTINGS_KEY_BUTTON_VERY_LONG, m_button_config[index].very_long_duration));
+			p_button->timer_status = BUTTON_STATUS_MORE_2S;
 			break;
 		}
 		case BUTTON_STATUS_MORE_2S:
 		{
-			button_event = BUTTON2_VERY_LONG_HOLD;
-			m_button2_timer_status = BUTTON_STATUS_MORE_5S;
+			button_event = (button_event_t)(m_button_config[index].first_event + BUTTON_GESTURE_VERY_LONG_HOLD);
+			p_button->timer_status = BUTTON_STATUS_MORE_5S;
 			break;
 		}
 		case BUTTON_STATUS_MORE_5S:
 		{
 			break;
 		}
+		case BUTTON_STATUS_CLICK_WAIT:
+		{
+			// No further click came within the window.
+			button_event = button_click_event(index);
+			p_button->timer_status = BUTTON_STATUS_INIT;
+			break;
+		}
 		case BUTTON_STATUS_DOUBLE_TRACK:
 		{
+			button_event = DOUBLE_BTN_TRACK;
+			p_button->timer_status = BUTTON_STATUS_INIT;
 			break;
 		}
 		default:
@@ -243,271 +237,173 @@ static void button2_duration_timeout_handler(void)
 			break;
 		}
 	}
+	if ((button_event != BUTTON_INVALID) && (p_button->is_pushed == TRUE))
+	{
+		p_button->info.hold_ms = button_elapsed_ms(p_button->info.press_ms, sys_time_now_ms());
+	}
 	if (button_event != BUTTON_INVALID)
 	{
-		app_button_event_handler(button_event);
+		button_report(index, button_event);
 	}
 }
 
-void double_btn1_timeout_handler(void)
-{
-	button_event_t button_event = BUTTON1_SHORT_PRESS;
-	detect_double_button1_press = FALSE;
-	m_button1_timer_status = BUTTON_STATUS_INIT;
-	timer_stop(m_timer_id_double_btn1_detet);
-	app_button_event_handler(button_event);
-}
-
-void double_btn2_timeout_handler(void)
+static void button_level_changed(u8 index, BitStatus current_status)
 {
-	button_event_t button_event = BUTTON2_SHORT_PRESS;
-	detect_double_button2_press = FALSE;
-	m_button2_timer_status = BUTTON_STATUS_INIT;
-	timer_stop(m_timer_id_double_btn2_detet);
-	app_button_event_handler(button_event);
+	m_button[index].status = current_status;
+#ifdef BUTTON_STATS
+	m_button_stats[index].change_count ++;
+#endif
+	timer_stop(m_button_config[index].timer_id_detet);
+	if (current_status == RESET)
+	{
+		button_push(index);
+	}
+	else
+	{
+		button_release(index);
+	}
 }
 
-void btn_debonce_timeout_handler(void)
+#ifdef BUTTON_SAMPLED_DEBOUNCE
+/*
+	Debounces all 8 pins of BUTTON_PORT at once. A pin that differs from its
+	debounced level counts down its 2 bit counter, a pin that agrees resets
+	it, and the level flips when the counter wraps after 4 equal samples.
+	The cost per tick does not depend on the number of buttons. The edge is
+	stamped at the first of those samples, within a period after the last
+	bounce, where the EXTI debounce stamps the first edge of the bounce.
+*/
+void btn_sample_timeout_handler(u8 timer_index)
 {
-	u8 valid_button;
-	u8 current_button;
-	u8 changed_button;
-
-	current_button = GPIO_ReadInputData(BUTTON_PORT);
-
-
-	valid_button = ~(current_button ^ button_first_detect_status);
-
-
-	changed_button = ((current_button^button_status) & valid_button);
-	button_status = current_button;
-	if ((changed_button & BUTTON_PIN1)!= 0)
+	u8 index;
+	u8 changed = (u8)(m_button_port_state ^ GPIO_FAST_READ(BUTTON_PORT, 0xFF));
+	u32 edge_ms;
+
+	m_button_count0 = (u8)~(m_button_count0 & changed);
+	m_button_count1 = (u8)(m_button_count0 ^ (m_button_count1 & changed));
+	changed &= (u8)(m_button_count0 & m_button_count1);
+	m_button_port_state ^= changed;
+	if (changed == 0)
 	{
-		timer_stop(m_timer_id_button1_detet);
-		if ((current_button & BUTTON_PIN1) == 0)
-		{
-			button1_push();
-		}
-		else
-		{
-			button1_release();
-		}
+		return;
 	}
 
-	if ((changed_button & BUTTON_PIN2)!= 0)
+	edge_ms = sys_time_now_ms() - BUTTON_SAMPLE_LATENCY_MS;
+	for (index = 0; index < BUTTON_NUMBER; index ++)
 	{
-		timer_stop(m_timer_id_button2_detet);
-		if ((current_button & BUTTON_PIN2) == 0)
-		{
-			button2_push();
-		}
-		else
+		if ((changed & m_button_config[index].pin) != 0)
 		{
-			button2_release();
+			m_button_edge_ms[index] = edge_ms;
+			button_level_changed(index, ((m_button_port_state & m_button_config[index].pin) != 0) ? SET : RESET);
 		}
 	}
 }
+#else
+void btn_debonce_timeout_handler(u8 timer_index)
+{
+	u8 index = button_find_by_timer(timer_index);
+	const button_config_t *p_config = &m_button_config[index];
+	BitStatus current_status;
+
+	// Unmask before sampling, so a change right after the sample interrupts again.
+	disableInterrupts();
+	EXTI_ClearITPendingBit(p_config->exti_it);
+	GPIO_FAST_IT_ENABLE(p_config->port, p_config->pin);
+	enableInterrupts();
+
+	// The bounce is over, a level back where it was is no change.
+	current_status = (GPIO_FAST_READ(p_config->port, p_config->pin) != 0) ? SET : RESET;
+	if (current_status != m_button[index].status)
+	{
+		button_level_changed(index, current_status);
+	}
+}
+#endif
 
 
-void button_init()
+void button_init(button_event_handler_t handler)
 {
+  u8 index;
+
+  m_button_handler = handler;
+
   disableInterrupts();
   GPIO_Init(LEDS_PORT, (LED_PIN1 | LED_PIN2), GPIO_Mode_Out_PP_Low_Fast);
-  GPIO_Init(BUTTON_PORT, (BUTTON_PIN1 | BUTTON_PIN2), GPIO_Mode_In_PU_IT);
   EXTI_DeInit();
   EXTI_SelectPort(EXTI_Port_B);
-  EXTI_SetPinSensitivity(EXTI_Pin_6, EXTI_Trigger_Rising_Falling);
-  EXTI_SetPinSensitivity(EXTI_Pin_7, EXTI_Trigger_Rising_Falling);
+  for (index = 0; index < BUTTON_NUMBER; index ++)
+  {
+#ifdef BUTTON_SAMPLED_DEBOUNCE
+    GPIO_Init(m_button_config[index].port, m_button_config[index].pin, GPIO_Mode_In_PU_No_IT);
+#else
+    GPIO_Init(m_button_config[index].port, m_button_config[index].pin, GPIO_Mode_In_PU_IT);
+    EXTI_SetPinSensitivity(m_button_config[index].exti_pin, EXTI_Trigger_Rising_Falling);
+#endif
+    m_button[index].status = SET;
+  }
   enableInterrupts();
-
-  timer_create(&m_timer_id_button1_detet, button1_duration_timeout_handler);
-  timer_create(&m_timer_id_double_btn1_detet, double_btn1_timeout_handler);
-  timer_create(&m_timer_id_button2_detet, button2_duration_timeout_handler);
-  timer_create(&m_timer_id_double_btn2_detet, double_btn2_timeout_handler);
-  timer_create(&m_timer_id_debonce_detet, btn_debonce_timeout_handler);
-}
-
-
-void btn_short_button1_press(void)
-{
-}
-
-void btn_double_button1_press(void)
-{
-}
-
-void btn_long_hold_button1_press(void)
-{
-}
-
-void btn_long_button1_press(void)
-{
-	send_8670_cmd(HEADSET1_PAIRING);
-}
-
-void btn_very_long_hold_button1_press(void)
-{
-	send_8670_cmd(HEADSET1_POWEROFF);
-}
-
-void btn_very_long_button1_press(void)
-{
-}
-
-void btn_short_button2_press(void)
-{
-}
-
-void btn_double_button2_press(void)
-{
-}
-
-void btn_long_hold_button2_press(void)
-{
+#ifdef BUTTON_SAMPLED_DEBOUNCE
+  timer_start_periodic(TIMER_ID_BUTTON_SAMPLE, BUTTON_SAMPLE_PERIOD, BUTTON_SAMPLE_PERIOD);
+#endif
 }
 
-void btn_long_button2_press(void)
-{
-	send_8670_cmd(HEADSET2_PAIRING);
-}
-
-void btn_very_long_hold_button2_press(void)
-{
-	send_8670_cmd(HEADSET2_POWEROFF);
-}
-
-void btn_very_long_button2_press(void)
-{
-}
-
-void btn_double_long_hold_press(void)
-{
-	send_8670_cmd(HEADSET_COMBINATION);
-}
-
-void app_button_event_handler(button_event_t button_event)
-{
-	switch (button_event)
-	{
-		case BUTTON_INVALID:
-		{
-			break;
-		}
-		case BUTTON1_SHORT_PRESS:
-		{
-			btn_short_button1_press();
-			break;
-		}
-		case BUTTON1_DOUBLE_PRESS:
-		{
-			btn_double_button1_press();
-			break;
-		}
-		case BUTTON1_LONG_HOLD:
-		{
-			btn_long_hold_button1_press();
-			break;
-		}
-		case BUTTON1_LONG_PRESS:
-		{
-			btn_long_button1_press();
-			break;
-		}
-		case BUTTON1_VERY_LONG_HOLD:
-		{
-			btn_very_long_hold_button1_press();
-			break;
-		}
-		case BUTTON1_VERY_LONG_PRESS:
-		{
-			btn_very_long_button1_press();
-			break;
-		}
-		case BUTTON2_SHORT_PRESS:
-		{
-			btn_short_button2_press();
-			break;
-		}
-		case BUTTON2_DOUBLE_PRESS:
-		{
-			btn_double_button2_press();
-			break;
-		}
-		case BUTTON2_LONG_HOLD:
-		{
-			btn_long_hold_button2_press();
-			break;
-		}
-		case BUTTON2_LONG_PRESS:
-		{
-			btn_long_button2_press();
-			break;
-		}
-		case BUTTON2_VERY_LONG_HOLD:
-		{
-			btn_very_long_hold_button2_press();
-			break;
-		}
-		case BUTTON2_VERY_LONG_PRESS:
-		{
-			btn_very_long_button2_press();
-			break;
-		}
-		case DOUBLE_BTN_TRACK:
-		{
-			btn_double_long_hold_press();
-		}
-		default:
-		{
-			break;
-		}
-	}
-}
 
 // Only use button1_timer to track double button long hold.
 void check_track_double_button(void)
 {
-	if ((button1_is_pushed == TRUE) && (button2_is_pushed == TRUE))
+	if ((m_button[0].is_pushed == TRUE) && (m_button[1].is_pushed == TRUE))
 	{
-		timer_stop(m_timer_id_button2_detet);  // Disable btn2_timer when tracking double hold.
-		m_button1_timer_status = BUTTON_STATUS_DOUBLE_TRACK;
-		m_button2_timer_status = BUTTON_STATUS_INIT;
+		timer_stop(m_button_config[1].timer_id_detet);  // Disable btn2_timer when tracking double hold.
+		m_button[0].timer_status = BUTTON_STATUS_DOUBLE_TRACK;
+		m_button[1].timer_status = BUTTON_STATUS_INIT;
 		double_button_track = TRUE;
-		timer_start(m_timer_id_button2_detet,BUTTON_DOUBLE_BTN_TRACK_DURATION);  //3 s
+		timer_start(m_button_config[0].timer_id_detet, BUTTON_DOUBLE_BTN_TRACK_DURATION);  //3 s
 	}
 	else
 	{
 		if (double_button_track == TRUE)
 		{
-			m_button1_timer_status = BUTTON_STATUS_INIT;
-			m_button2_timer_status = BUTTON_STATUS_INIT;
+			m_button[0].timer_status = BUTTON_STATUS_INIT;
+			m_button[1].timer_status = BUTTON_STATUS_INIT;
 			double_button_track = FALSE;
-			timer_stop(m_timer_id_button2_detet);
+			timer_stop(m_button_config[0].timer_id_detet);
 		}
 	}
 }
 
-void button1_push(void)
+static void button_push(u8 index)
 {
-	button1_is_pushed = TRUE;
+	button_t *p_button = &m_button[index];
+
+	p_button->is_pushed = TRUE;
+	p_button->info.press_ms = button_edge_ms(index);
+	p_button->info.hold_ms = 0;
+	// A push inside the click window continues the sequence.
+	p_button->info.click_count = (p_button->timer_status == BUTTON_STATUS_CLICK_WAIT) ? (u8)(p_button->info.click_count + 1) : 1;
 
 	check_track_double_button();
 
 	if (double_button_track == FALSE)
 	{
-		m_button1_timer_status = BUTTON_STATUS_LESS_2S;
-		timer_start(m_timer_id_button1_detet, BUTTON_WAIT_2S);
+		p_button->timer_status = BUTTON_STATUS_LESS_2S;
+		timer_start(m_button_config[index].timer_id_detet,
+		            settings_get(SETTINGS_KEY_BUTTON_HOLD, m_button_config[index].hold_duration));
 	}
 }
 
-void button1_release(void)
+static void button_release(u8 index)
 {
-	button1_is_pushed = FALSE;
+	button_t *p_button = &m_button[index];
+	button_event_t first_event = m_button_config[index].first_event;
 	button_event_t button_event = BUTTON_INVALID;
+	button_timer_status_t next_status = BUTTON_STATUS_INIT;
+
+	p_button->is_pushed = FALSE;
+	p_button->info.hold_ms = button_elapsed_ms(p_button->info.press_ms, button_edge_ms(index));
 
 	check_track_double_button();
 
-	switch (m_button1_timer_status)
+	switch (p_button->timer_status)
 	{
 		case BUTTON_STATUS_INIT:
 			{
@@ -515,27 +411,27 @@ void button1_release(void)
 			}
 		case BUTTON_STATUS_LESS_2S:
 			{
-				if (detect_double_button1_press == FALSE)
+				// The hold timer doubles as the click window while released.
+				if (p_button->info.click_count < BUTTON_CLICK_MAX)
 				{
-					detect_double_button1_press = TRUE;
-					timer_start(m_timer_id_double_btn1_detet,BUTTON_DOUBLE_BTN_DURATION);  //500ms
+					next_status = BUTTON_STATUS_CLICK_WAIT;
+					timer_start(m_button_config[index].timer_id_detet,
+					            settings_get(SETTINGS_KEY_BUTTON_CLICK, m_button_config[index].click_duration));
 				}
 				else
 				{
-					button_event = BUTTON1_DOUBLE_PRESS;
-					detect_double_button1_press = FALSE;
-					timer_stop(m_timer_id_double_btn1_detet);
+					button_event = button_click_event(index);
 				}
 				break;
 			}
 		case BUTTON_STATUS_MORE_2S:
 			{
-				button_event = BUTTON1_LONG_PRESS;
+				button_event = (button_event_t)(first_event + BUTTON_GESTURE_LONG_PRESS);
 				break;
 			}
 		case BUTTON_STATUS_MORE_5S:
 			{
-				button_event = BUTTON1_VERY_LONG_PRESS;
+				button_event = (button_event_t)(first_event + BUTTON_GESTURE_VERY_LONG_PRESS);
 				break;
 			}
 		default:
@@ -543,78 +439,105 @@ void button1_release(void)
 				break;
 			}
 	}
-	m_button1_timer_status = BUTTON_STATUS_INIT;
+	p_button->timer_status = next_status;
 	if (button_event != BUTTON_INVALID)
 	{
-		app_button_event_handler(button_event);
+		button_report(index, button_event);
 	}
 }
 
-void button2_push(void)
+#ifdef BUTTON_SAMPLED_DEBOUNCE
+// The pins have no interrupt when sampled.
+void button_event_handler(EXTI_IT_TypeDef exti_it)
 {
-	button2_is_pushed = TRUE;
-
-	check_track_double_button();
+}
+#else
+static void btn_debonce_start(void)
+{
+	u8 index;
+	u8 pending;
+
+	disableInterrupts();
+	pending = m_button_debounce_pending;
+	m_button_debounce_pending = 0;
+	// An edge that woke the core was stamped before the halt time was
+	// accounted, the time now is the closer one.
+	for (index = 0; index < BUTTON_NUMBER; index ++)
+	{
+		if ((m_button_edge_at_wake & (u8)(1 << index)) != 0)
+		{
+			m_button_edge_ms[index] = sys_time_now_ms();
+		}
+	}
+	m_button_edge_at_wake = 0;
+	enableInterrupts();
 
-	if (double_button_track == FALSE)
+	for (index = 0; index < BUTTON_NUMBER; index ++)
 	{
-		m_button2_timer_status = BUTTON_STATUS_LESS_2S;
-		timer_start(m_timer_id_button2_detet, BUTTON_WAIT_2S);
+		if ((pending & (u8)(1 << index)) != 0)
+		{
+			timer_start(m_button_config[index].timer_id_debounce, m_button_config[index].debounce_duration);
+		}
 	}
 }
 
-void button2_release(void)
+/*
+	Called from the EXTI pin and port interrupts. The pin's interrupt is masked in GPIO CR2
+	until its debounce timer expires, so a bouncing contact costs a single
+	interrupt. The timer is started from main().
+*/
+void button_event_handler(EXTI_IT_TypeDef exti_it)
 {
-	button2_is_pushed = FALSE;
-	button_event_t button_event = BUTTON_INVALID;
-
-	check_track_double_button();
+	u8 index;
+	u8 masked = 0;
+	u32 now_ms = sys_time_now_ms();
+	bool is_frozen = sys_time_is_frozen();
 
-	switch (m_button2_timer_status)
+	for (index = 0; index < BUTTON_NUMBER; index ++)
 	{
-		case BUTTON_STATUS_INIT:
-			{
-				break;
-			}
-		case BUTTON_STATUS_LESS_2S:
-			{
-				if (detect_double_button2_press == FALSE)
-				{
-					detect_double_button2_press = TRUE;
-					timer_start(m_timer_id_double_btn2_detet,BUTTON_DOUBLE_BTN_DURATION);  //500ms
-				}
-				else
-				{
-					button_event = BUTTON2_DOUBLE_PRESS;
-					detect_double_button2_press = FALSE;
-					timer_stop(m_timer_id_double_btn2_detet);
-				}
-				break;
-			}
-		case BUTTON_STATUS_MORE_2S:
-			{
-				button_event = BUTTON2_LONG_PRESS;
-				break;
-			}
-		case BUTTON_STATUS_MORE_5S:
-			{
-				button_event = BUTTON2_VERY_LONG_PRESS;
-				break;
-			}
-		default:
+		if ((m_button_config[index].exti_it == exti_it) || (exti_it == BUTTON_PORT_IT))
+		{
+			GPIO_FAST_IT_DISABLE(m_button_config[index].port, m_button_config[index].pin);
+			m_button_edge_ms[index] = now_ms;
+			if (is_frozen == TRUE)
 			{
-				break;
+				m_button_edge_at_wake |= (u8)(1 << index);
 			}
+			masked |= (u8)(1 << index);
+#ifdef BUTTON_STATS
+			m_button_stats[index].irq_count ++;
+#endif
+		}
 	}
-	m_button2_timer_status = BUTTON_STATUS_INIT;
-	if (button_event != BUTTON_INVALID)
+	// Pins already pending wait for a start that is in the queue.
+	masked &= (u8)~m_button_debounce_pending;
+	if (masked == 0)
+	{
+		return;
+	}
+	m_button_debounce_pending |= masked;
+	if (event_put(btn_debonce_start) == FALSE)
 	{
-		app_button_event_handler(button_event);
+		// Event queue full, nothing would unmask the pins. Give them back
+		// to the interrupt so the next edge tries again.
+		m_button_debounce_pending &= (u8)~masked;
+		m_button_edge_at_wake &= (u8)~masked;
+		for (index = 0; index < BUTTON_NUMBER; index ++)
+		{
+			if ((masked & (u8)(1 << index)) != 0)
+			{
+				GPIO_FAST_IT_ENABLE(m_button_config[index].port, m_button_config[index].pin);
+			}
+		}
 	}
 }
+#endif
 
-void button_event_handler(void)
+#ifdef BUTTON_STATS
+void button_get_stats(u8 index, button_stats_t *p_stats)
 {
-	button_first_detect_status = GPIO_ReadInputData(BUTTON_PORT);
-	timer_start(m_timer_id_debonce_detet, BUTTON_DEBONCE_DURATION);
+	disableInterrupts();
+	*p_stats = m_button_stats[index];
+	enableInterrupts();
 }
+#endif
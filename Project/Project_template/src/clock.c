@@ -0,0 +1,53 @@
+#include "stm8l15x.h"
+#include "stm8l15x_clk.h"
+
+#include "timer.h"
+#include "clock.h"
+
+/*
+	SYSCLK stays on HSI and only the divider changes, so a switch takes
+	effect at once and TIM4 can follow it with its power of two prescaler.
+*/
+static u8 m_clock_users = 0;
+static CLK_SYSCLKDiv_TypeDef m_clock_div = CLK_SYSCLKDiv_1;
+
+static void clock_apply(void)
+{
+	CLK_SYSCLKDiv_TypeDef div = (m_clock_users != 0) ? CLK_SYSCLKDiv_1 : CLOCK_IDLE_DIV;
+
+	if (div == m_clock_div)
+	{
+		return;
+	}
+
+	// No tick may be counted at the old rate after the divider changed.
+	disableInterrupts();
+	CLK_SYSCLKDivConfig(div);
+	timer_set_sysclk_div(div);
+	enableInterrupts();
+	m_clock_div = div;
+}
+
+void clock_init(void)
+{
+	CLK_DeInit();
+	CLK_HSICmd(ENABLE);
+	CLK_SYSCLKSourceConfig(CLK_SYSCLKSource_HSI);
+	CLK_SYSCLKDivConfig(CLK_SYSCLKDiv_1);
+	CLK_PeripheralClockConfig(CLK_Peripheral_TIM4, ENABLE);
+
+	m_clock_div = CLK_SYSCLKDiv_1;
+	m_clock_users = CLOCK_USER_INIT;
+}
+
+void clock_request(clock_user_t user)
+{
+	m_clock_users |= user;
+	clock_apply();
+}
+
+void clock_release(clock_user_t user)
+{
+	m_clock_users &= (u8)~user;
+	clock_apply();
+}
@@ -1,31 +1,195 @@
 #include "stm8l15x.h"
+#include "stm8l15x_clk.h"
+#include "stm8l15x_tim1.h"
 
+#include "event.h"
 #include "delay.h"
 
-void delay_ms(u16 time_ms)   // ms
+/*
+  Delays are timed by TIM1, so they follow CLK_SYSCLKDivConfig instead of
+  depending on how the compiler builds a loop. The prescaler brings the
+  count rate down to at most 1 MHz; below 1 MHz SYSCLK is counted directly.
+  The count is rounded up, so a delay is never short by more than one count.
+*/
+#define DELAY_US_PER_S        1000000
+#define DELAY_MAX_RATE_HZ     1000000
+#ifdef EVENT_ISR_PROFILE
+#define DELAY_MAX_WINDOW      0x8000  // Half the free running counter, so a late poll still sees the end.
+#else
+#define DELAY_MAX_WINDOW      0xFFFF  // Counts the 16 bit counter times in one go.
+#endif
+#define DELAY_SLEEP_MIN_US    1000    // Shorter waits are not worth a wakeup.
+
+#ifndef EVENT_ISR_PROFILE
+static volatile bool m_delay_done = FALSE;
+#endif
+
+/*
+  SYSCLK from the source and the divider. CLK_GetClockFreq() looks the
+  divider up in a table of the driver that ends at 16, so it reads past it
+  at the dividers 32 to 128, and it returns 0 on the LSE.
+*/
+static u32 delay_sysclk_hz(void)
 {
-  u16 tick;
-  while (time_ms != 0)
+  u32 source_hz;
+
+  switch ((CLK_SYSCLKSource_TypeDef)CLK->SCSR)
   {
-    time_ms--;
-    tick = 2666;
-    while (tick != 0)
+    case CLK_SYSCLKSource_HSI:
     {
-      tick --;
+      source_hz = HSI_VALUE;
+      break;
+    }
+    case CLK_SYSCLKSource_LSI:
+    {
+      source_hz = LSI_VALUE;
+      break;
+    }
+    case CLK_SYSCLKSource_HSE:
+    {
+      source_hz = HSE_VALUE;
+      break;
+    }
+    default:
+    {
+      source_hz = LSE_VALUE;
+      break;
     }
   }
+  return source_hz >> (CLK->CKDIVR & CLK_CKDIVR_CKM);
 }
 
-void delay_10us(u16 time_10us)
+// TIM1 prescaler for the given SYSCLK, the count rate is sysclk_hz / (prescaler + 1).
+u16 delay_prescaler(u32 sysclk_hz)
+{
+#ifdef EVENT_ISR_PROFILE
+  // TIM1 already free runs at SYSCLK as the cycle counter.
+  (void)sysclk_hz;
+  return 0;
+#else
+  return (u16)((sysclk_hz + DELAY_MAX_RATE_HZ - 1) / DELAY_MAX_RATE_HZ - 1);
+#endif
+}
+
+/*
+  Counts at rate_hz covering time_us. The whole counts per us are scaled
+  first, then the rest of the rate, below 1 MHz, over seconds, ms and us,
+  so no product leaves 32 bits. Only the result does, for delays of more
+  than 268 s at 16 MHz.
+*/
+u32 delay_us_to_counts(u32 time_us, u32 rate_hz)
 {
-  u16 tick;
-  while (time_10us != 0)
+  u32 counts_per_us = rate_hz / DELAY_US_PER_S;
+  u32 rest_hz = rate_hz % DELAY_US_PER_S;
+  u32 seconds = time_us / DELAY_US_PER_S;
+  u32 ms = (time_us % DELAY_US_PER_S) / 1000;
+  u32 us = time_us % 1000;
+
+  return time_us * counts_per_us +
+         seconds * rest_hz +
+         (ms * rest_hz) / 1000 +
+         (us * rest_hz + DELAY_US_PER_S - 1) / DELAY_US_PER_S;
+}
+
+#ifdef EVENT_ISR_PROFILE
+// Poll the free running counter, it must not be restarted under the profiler.
+static void delay_window(u16 counts, bool sleep)
+{
+  u16 start = TIM1_GetCounter();
+
+  (void)sleep;
+  while ((u16)(TIM1_GetCounter() - start) < counts)
+  {
+  }
+}
+#else
+// One pulse of the given length, the counter stops by itself at the update.
+static void delay_window(u16 counts, bool sleep)
+{
+  if (counts <= 1)
+  {
+    // An autoreload of 0 stops TIM1, and one count is shorter than the call.
+    return;
+  }
+  TIM1_SetCounter(0);
+  TIM1_SetAutoreload(counts - 1);
+  TIM1_ClearFlag(TIM1_FLAG_Update);
+  m_delay_done = FALSE;
+
+  if (sleep == TRUE)
   {
-    time_10us--;
-    tick = 26;
-    while (tick != 0)
+    TIM1_ITConfig(TIM1_IT_Update, ENABLE);
+    TIM1_Cmd(ENABLE);
+    // WFI enables interrupts, so the update cannot slip in after the check.
+    disableInterrupts();
+    while (m_delay_done == FALSE)
     {
-      tick --;
+      wfi();
+      disableInterrupts();
     }
+    enableInterrupts();
+    TIM1_ITConfig(TIM1_IT_Update, DISABLE);
   }
+  else
+  {
+    TIM1_Cmd(ENABLE);
+    while (TIM1_GetFlagStatus(TIM1_FLAG_Update) == RESET)
+    {
+    }
+  }
+}
+#endif
+
+void delay_us(u32 time_us)
+{
+  u32 sysclk_hz = delay_sysclk_hz();
+  u16 prescaler = delay_prescaler(sysclk_hz);
+  u32 counts = delay_us_to_counts(time_us, sysclk_hz / ((u32)prescaler + 1));
+  u16 window;
+  bool sleep = FALSE;
+
+#ifdef DELAY_SLEEP
+  if (time_us > DELAY_SLEEP_MIN_US)
+  {
+    sleep = TRUE;
+  }
+#endif
+
+#ifndef EVENT_ISR_PROFILE
+  CLK_PeripheralClockConfig(CLK_Peripheral_TIM1, ENABLE);
+  TIM1_DeInit();
+  TIM1_UpdateRequestConfig(TIM1_UpdateSource_Regular);  // Loading the prescaler sets no flag.
+  TIM1_SelectOnePulseMode(TIM1_OPMode_Single);
+  TIM1_PrescalerConfig(prescaler, TIM1_PSCReloadMode_Immediate);
+#endif
+
+  while (counts != 0)
+  {
+    window = (counts > DELAY_MAX_WINDOW) ? DELAY_MAX_WINDOW : (u16)counts;
+    delay_window(window, sleep);
+    counts -= window;
+  }
+
+#ifndef EVENT_ISR_PROFILE
+  CLK_PeripheralClockConfig(CLK_Peripheral_TIM1, DISABLE);
+#endif
+}
+
+void delay_ms(u16 time_ms)   // ms
+{
+  delay_us((u32)time_ms * 1000);
+}
+
+void delay_10us(u16 time_10us)
+{
+  delay_us((u32)time_10us * 10);
+}
+
+#ifndef EVENT_ISR_PROFILE
+// Called from the TIM1 update interrupt.
+void delay_timer_handler(void)
+{
+  TIM1_ClearITPendingBit(TIM1_IT_Update);
+  m_delay_done = TRUE;
 }
+#endif
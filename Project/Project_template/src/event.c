@@ -0,0 +1,129 @@
+#include "stm8l15x.h"
+#include "stm8l15x_clk.h"
+#include "stm8l15x_tim1.h"
+
+#include "event.h"
+
+#define EVENT_QUEUE_SIZE    16   // Must be a power of two.
+#define EVENT_QUEUE_MASK    (EVENT_QUEUE_SIZE - 1)
+
+/*
+	Single producer, single consumer ring. Only the producers write
+	m_event_head and only event_dispatch() writes m_event_tail. The
+	interrupt routines all run at the same level and never nest, and main()
+	only posts with interrupts disabled, so they count as one producer.
+*/
+static event_handler_t m_event_queue[EVENT_QUEUE_SIZE];
+static volatile u8 m_event_head = 0;
+static volatile u8 m_event_tail = 0;
+static volatile u8 m_event_dropped = 0;   // Stops at 255.
+
+#ifdef EVENT_ISR_PROFILE
+static volatile u16 m_event_cycle_wraps = 0;
+static u32 m_isr_start = 0;
+static u32 m_isr_max_cycles = 0;
+#endif
+
+void event_init(void)
+{
+	m_event_dropped = 0;
+#ifdef EVENT_ISR_PROFILE
+	// TIM1 free runs at SYSCLK as the cycle counter.
+	CLK_PeripheralClockConfig(CLK_Peripheral_TIM1, ENABLE);
+	TIM1_DeInit();
+	TIM1_TimeBaseInit(0, TIM1_CounterMode_Up, 0xFFFF, 0);
+	TIM1_ITConfig(TIM1_IT_Update, ENABLE);
+	TIM1_Cmd(ENABLE);
+#endif
+}
+
+// Called from interrupt context, or from main() with interrupts disabled.
+bool event_put(event_handler_t handler)
+{
+	u8 head = m_event_head;
+
+	if (((head + 1) & EVENT_QUEUE_MASK) == m_event_tail)
+	{
+		// Queue is full, the event is lost.
+		if (m_event_dropped != 0xFF)
+		{
+			m_event_dropped ++;
+		}
+		return FALSE;
+	}
+	m_event_queue[head] = handler;
+	m_event_head = (head + 1) & EVENT_QUEUE_MASK;
+	return TRUE;
+}
+
+// Called from main() only, runs every pending event.
+void event_dispatch(void)
+{
+	u8 tail = m_event_tail;
+
+	while (tail != m_event_head)
+	{
+		m_event_queue[tail]();
+		tail = (tail + 1) & EVENT_QUEUE_MASK;
+		m_event_tail = tail;
+	}
+}
+
+bool event_is_empty(void)
+{
+	return (m_event_tail == m_event_head) ? TRUE : FALSE;
+}
+
+u8 event_dropped_count(void)
+{
+	return m_event_dropped;
+}
+
+#ifdef EVENT_ISR_PROFILE
+/*
+	TIM1 counts the low 16 bits and its update interrupt the wraps. A wrap
+	whose interrupt is still pending, as in an interrupt routine, shows in
+	the update flag, and a wrap counted during the read makes it try again.
+*/
+u32 event_cycles(void)
+{
+	u16 wraps;
+	u16 counter;
+	u16 pending;
+
+	do
+	{
+		wraps = m_event_cycle_wraps;
+		counter = TIM1_GetCounter();
+		pending = (((TIM1->SR1 & TIM1_SR1_UIF) != 0) && (counter < 0x8000)) ? 1 : 0;
+	} while (wraps != m_event_cycle_wraps);
+
+	return ((u32)(u16)(wraps + pending) << 16) | counter;
+}
+
+void event_cycle_wrap_handler(void)
+{
+	TIM1_ClearITPendingBit(TIM1_IT_Update);
+	m_event_cycle_wraps ++;
+}
+
+void event_isr_enter(void)
+{
+	m_isr_start = event_cycles();
+}
+
+void event_isr_exit(void)
+{
+	u32 cycles = event_cycles() - m_isr_start;
+
+	if (cycles > m_isr_max_cycles)
+	{
+		m_isr_max_cycles = cycles;
+	}
+}
+
+u32 event_isr_max_cycles(void)
+{
+	return m_isr_max_cycles;
+}
+#endif
@@ -0,0 +1,263 @@
+#include "stm8l15x.h"
+#include "stm8l15x_clk.h"
+#include "stm8l15x_pwr.h"
+#include "stm8l15x_rtc.h"
+#include "stm8l15x_tim1.h"
+
+#include "event.h"
+#include "pulse.h"
+#include "sys_time.h"
+#include "timer.h"
+#include "idle.h"
+
+/*
+	The RTC runs from LSI in every power mode. The prescalers divide it by
+	38 for the sub-second counter, 1 kHz at the nominal 38 kHz, and the
+	wakeup timer counts RTCCLK/16. The LSI of a part is anywhere from 26 to
+	56 kHz, so idle_init() measures it against HSI, and the wakeup counts
+	and the elapsed time are both scaled with the result.
+*/
+#define IDLE_RTC_ASYNCH_PREDIV      37     // 38 LSI clocks per count.
+#define IDLE_RTC_SYNCH_PREDIV       999    // 1000 counts per calendar second.
+#define IDLE_RTC_COUNT_CLOCKS       (IDLE_RTC_ASYNCH_PREDIV + 1)
+#define IDLE_RTC_COUNTS_PER_HOUR    3600000
+
+#define IDLE_WAKEUP_CLOCKS          16     // RTCCLK/16.
+#define IDLE_WAKEUP_COUNTS_MAX      0x10000UL
+
+#define IDLE_LSI_NOMINAL_HZ         38000
+#define IDLE_LSI_MIN_HZ             20000  // Outside, the measurement failed and the nominal is kept.
+#define IDLE_LSI_MAX_HZ             80000
+#define IDLE_CALIBRATION_COUNTS     64     // Wakeup counts timed, 1024 LSI clocks.
+
+#define IDLE_TICK_MS                10     // Software timer tick.
+#define IDLE_TICK_WAKEUP_DIV        (1000 / IDLE_TICK_MS * IDLE_WAKEUP_CLOCKS)   // ticks * LSI Hz / this = wakeup counts.
+#define IDLE_HALT_MIN_TICKS         5      // Shorter waits stay in wait mode.
+
+static idle_stats_t m_idle_stats = {0};
+static u32 m_idle_last_counts = 0;
+static u16 m_idle_halt_fraction_ms = 0;
+static u32 m_idle_lsi_hz = IDLE_LSI_NOMINAL_HZ;
+static u32 m_idle_lsi_fraction = 0;   // ms * LSI Hz not yet reported.
+static u32 m_idle_halt_max_ticks = IDLE_WAKEUP_COUNTS_MAX * IDLE_TICK_WAKEUP_DIV / IDLE_LSI_NOMINAL_HZ;
+
+static u8 idle_bcd_to_byte(u8 value)
+{
+	return (u8)(((value >> 4) * 10) + (value & 0x0F));
+}
+
+// Sub-second counts since the start of the RTC hour.
+static u32 idle_rtc_counts(void)
+{
+	u16 sub_second;
+	u8  seconds;
+	u8  minutes;
+
+	// Reading SSRL freezes the calendar shadow registers until DR3 is read,
+	// so the three fields belong to the same instant.
+	sub_second = (u16)((u16)RTC->SSRH << 8);
+	sub_second |= RTC->SSRL;
+	seconds = RTC->TR1;
+	minutes = RTC->TR2;
+	(void)RTC->DR3;
+
+	return ((u32)idle_bcd_to_byte(minutes) * 60 + idle_bcd_to_byte(seconds)) * (IDLE_RTC_SYNCH_PREDIV + 1) +
+	       (IDLE_RTC_SYNCH_PREDIV - sub_second);
+}
+
+// ms of the measured LSI since the last call, the remainder is carried.
+static u32 idle_elapsed_ms(u32 now_counts)
+{
+	u32 counts = now_counts - m_idle_last_counts;
+	u32 clocks;
+	u32 rest;
+
+	if (now_counts < m_idle_last_counts)
+	{
+		counts += IDLE_RTC_COUNTS_PER_HOUR;
+	}
+	m_idle_last_counts = now_counts;
+
+	// The clocks of an hour times 1000 do not fit 32 bits, so in two steps.
+	clocks = counts * IDLE_RTC_COUNT_CLOCKS;
+	rest = (clocks % m_idle_lsi_hz) * 1000 + m_idle_lsi_fraction;
+	m_idle_lsi_fraction = rest % m_idle_lsi_hz;
+	return (clocks / m_idle_lsi_hz) * 1000 + rest / m_idle_lsi_hz;
+}
+
+// SYSCLK cycles up to the next wakeup flag, the TIM1 wraps are added up.
+static u32 idle_cycles_to_wakeup(void)
+{
+	u32 cycles = 0;
+	u16 last = TIM1_GetCounter();
+	u16 counter;
+
+	while (RTC_GetFlagStatus(RTC_FLAG_WUTF) == RESET)
+	{
+		counter = TIM1_GetCounter();
+		cycles += (u16)(counter - last);
+		last = counter;
+	}
+	RTC_ClearFlag(RTC_FLAG_WUTF);
+	return cycles;
+}
+
+/*
+	Times IDLE_CALIBRATION_COUNTS wakeup counts from one wakeup flag to the
+	next, so the start of the wakeup timer is left out. TIM1 free runs at
+	SYSCLK meanwhile, an interrupt in between only delays the poll.
+*/
+static void idle_lsi_calibrate(void)
+{
+	u32 sysclk_hz = CLK_GetClockFreq();
+	u32 cycles;
+	u32 lsi_hz = 0;
+
+#ifndef EVENT_ISR_PROFILE
+	CLK_PeripheralClockConfig(CLK_Peripheral_TIM1, ENABLE);
+	TIM1_DeInit();
+	TIM1_TimeBaseInit(0, TIM1_CounterMode_Up, 0xFFFF, 0);
+	TIM1_Cmd(ENABLE);
+#endif
+	RTC_SetWakeUpCounter(IDLE_CALIBRATION_COUNTS - 1);
+	RTC_ClearFlag(RTC_FLAG_WUTF);
+	RTC_WakeUpCmd(ENABLE);
+	(void)idle_cycles_to_wakeup();
+	cycles = idle_cycles_to_wakeup();
+	RTC_WakeUpCmd(DISABLE);
+#ifndef EVENT_ISR_PROFILE
+	TIM1_DeInit();
+	CLK_PeripheralClockConfig(CLK_Peripheral_TIM1, DISABLE);
+#endif
+
+	// Both in 1/16, so the product stays in 32 bits.
+	if (cycles >= 16)
+	{
+		lsi_hz = sysclk_hz / 16 * (IDLE_CALIBRATION_COUNTS * IDLE_WAKEUP_CLOCKS) / (cycles / 16);
+	}
+	if ((lsi_hz < IDLE_LSI_MIN_HZ) || (lsi_hz > IDLE_LSI_MAX_HZ))
+	{
+		lsi_hz = IDLE_LSI_NOMINAL_HZ;
+	}
+	m_idle_lsi_hz = lsi_hz;
+	m_idle_stats.lsi_hz = lsi_hz;
+	m_idle_lsi_fraction = 0;
+	m_idle_halt_max_ticks = IDLE_WAKEUP_COUNTS_MAX * IDLE_TICK_WAKEUP_DIV / lsi_hz;
+}
+
+void idle_init(void)
+{
+	RTC_InitTypeDef rtc_init;
+
+	CLK_LSICmd(ENABLE);
+	while (CLK_GetFlagStatus(CLK_FLAG_LSIRDY) == RESET);
+	CLK_RTCClockConfig(CLK_RTCCLKSource_LSI, CLK_RTCCLKDiv_1);
+	CLK_PeripheralClockConfig(CLK_Peripheral_RTC, ENABLE);
+
+	rtc_init.RTC_HourFormat = RTC_HourFormat_24;
+	rtc_init.RTC_AsynchPrediv = IDLE_RTC_ASYNCH_PREDIV;
+	rtc_init.RTC_SynchPrediv = IDLE_RTC_SYNCH_PREDIV;
+	RTC_Init(&rtc_init);
+
+	RTC_WakeUpCmd(DISABLE);
+	RTC_WakeUpClockConfig(RTC_WakeUpClock_RTCCLK_Div16);
+	// Polls the wakeup flag, so before the interrupt takes it.
+	idle_lsi_calibrate();
+	RTC_ITConfig(RTC_IT_WUT, ENABLE);
+
+	// Keep HSI as wakeup clock, and let the regulator skip VREFINT in halt.
+	CLK_HaltConfig(CLK_Halt_FastWakeup, ENABLE);
+	PWR_UltraLowPowerCmd(ENABLE);
+	PWR_FastWakeUpCmd(ENABLE);
+
+	RTC_WaitForSynchro();
+	m_idle_last_counts = idle_rtc_counts();
+}
+
+static void idle_halt(u32 ticks)
+{
+	u32 halt_ms;
+	u32 elapsed_ticks;
+
+	// Without a started timer only an EXTI line wakes the core.
+	if (ticks != TIMER_NO_EXPIRY)
+	{
+		// The counter range is 27.6 s at the nominal LSI.
+		if (ticks > m_idle_halt_max_ticks)
+		{
+			ticks = m_idle_halt_max_ticks;
+		}
+		RTC_SetWakeUpCounter((u16)(ticks * m_idle_lsi_hz / IDLE_TICK_WAKEUP_DIV - 1));
+		RTC_WakeUpCmd(ENABLE);
+	}
+
+	// HALT enables interrupts, so no event can slip in after the check.
+	disableInterrupts();
+	if (event_is_empty() == TRUE)
+	{
+		sys_time_freeze();
+		halt();
+	}
+	enableInterrupts();
+
+	RTC_WakeUpCmd(DISABLE);
+	RTC_WaitForSynchro();
+
+	// TIM4 was stopped as well, hand the halt time to the timer module
+	// and the system time.
+	halt_ms = idle_elapsed_ms(idle_rtc_counts());
+	m_idle_stats.halt_ms += halt_ms;
+	sys_time_advance_ms(halt_ms);
+	halt_ms += m_idle_halt_fraction_ms;
+	elapsed_ticks = halt_ms / IDLE_TICK_MS;
+	m_idle_halt_fraction_ms = (u16)(halt_ms % IDLE_TICK_MS);
+	timer_resume(elapsed_ticks);
+}
+
+static void idle_wait(void)
+{
+	disableInterrupts();
+	if (event_is_empty() == TRUE)
+	{
+		wfi();
+	}
+	enableInterrupts();
+
+	m_idle_stats.wait_ms += idle_elapsed_ms(idle_rtc_counts());
+}
+
+void idle_enter(void)
+{
+	u32 ticks;
+
+	m_idle_stats.run_ms += idle_elapsed_ms(idle_rtc_counts());
+
+	if (event_is_empty() == FALSE)
+	{
+		return;
+	}
+
+	// The pulse timers and short timeouts need the system clock.
+	ticks = timer_next_expiry();
+	if ((pulse_is_busy() == TRUE) || (ticks < IDLE_HALT_MIN_TICKS))
+	{
+		idle_wait();
+	}
+	else
+	{
+		idle_halt(ticks);
+	}
+}
+
+void idle_get_stats(idle_stats_t *p_stats)
+{
+	disableInterrupts();
+	*p_stats = m_idle_stats;
+	enableInterrupts();
+}
+
+// Called from the RTC interrupt, the wakeup itself is all that is needed.
+void idle_wakeup_handler(void)
+{
+	RTC_ClearITPendingBit(RTC_IT_WUT);
+}
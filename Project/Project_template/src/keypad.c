@@ -0,0 +1,235 @@
+#include "stm8l15x.h"
+#include "stm8l15x_gpio.h"
+#include "stm8l15x_exti.h"
+
+#include "delay.h"
+#include "event.h"
+#include "gpio_fast.h"
+#include "timer.h"
+#include "keypad.h"
+
+#ifdef KEYPAD_MATRIX
+
+#define KEYPAD_ROW_MASK    ((u8)((1 << KEYPAD_ROWS) - 1))
+#define KEYPAD_COL_MASK    ((u8)((1 << KEYPAD_COLS) - 1))
+
+typedef char keypad_size_check_t[((KEYPAD_ROWS <= 8) && (KEYPAD_COLS <= 8)) ? 1 : -1];
+
+static keypad_event_handler_t m_keypad_event_handler = NULL;
+
+/* Debounced columns of each row and a 2 bit counter per key, one bit plane each. */
+static u8 m_keypad_state[KEYPAD_ROWS];
+static u8 m_keypad_count0[KEYPAD_ROWS];
+static u8 m_keypad_count1[KEYPAD_ROWS];
+
+/* Scans each key has been down, saturating. */
+static u16 m_keypad_hold[KEYPAD_KEY_NUMBER];
+
+
+static void keypad_report(keypad_event_t event, u8 key)
+{
+	keypad_event_info_t info;
+	u32 hold_ms = (u32)m_keypad_hold[key] * KEYPAD_SCAN_PERIOD * 10;
+
+	info.event = event;
+	info.key = key;
+	info.hold_ms = (hold_ms > 0xFFFF) ? 0xFFFF : (u16)hold_ms;
+	m_keypad_event_handler(&info);
+}
+
+// Pressed columns of one row, as set bits.
+static u8 keypad_read_row(u8 row)
+{
+	u8 columns;
+
+	GPIO_FAST_WRITE(KEYPAD_ROW_PORT, KEYPAD_ROW_MASK, ~(1 << row));
+	delay_us(KEYPAD_SETTLE_US);
+	columns = (u8)(GPIO_FAST_READ(KEYPAD_COL_PORT, KEYPAD_COL_MASK) ^ KEYPAD_COL_MASK);
+	GPIO_FAST_SET(KEYPAD_ROW_PORT, KEYPAD_ROW_MASK);
+	return columns;
+}
+
+// Two rows sharing two columns are a rectangle, one of its keys may be a ghost.
+static bool keypad_is_ghosted(const u8 *p_rows)
+{
+	u8 row;
+	u8 other;
+	u8 common;
+
+	for (row = 0; row < KEYPAD_ROWS; row ++)
+	{
+		for (other = (u8)(row + 1); other < KEYPAD_ROWS; other ++)
+		{
+			common = (u8)(p_rows[row] & p_rows[other]);
+			if ((common & (u8)(common - 1)) != 0)
+			{
+				return TRUE;
+			}
+		}
+	}
+	return FALSE;
+}
+
+static void keypad_debounce_row(u8 row, u8 columns)
+{
+	u8 col;
+	u8 key;
+	u8 changed = (u8)(m_keypad_state[row] ^ columns);
+
+	m_keypad_count0[row] = (u8)~(m_keypad_count0[row] & changed);
+	m_keypad_count1[row] = (u8)(m_keypad_count0[row] ^ (m_keypad_count1[row] & changed));
+	changed &= (u8)(m_keypad_count0[row] & m_keypad_count1[row]);
+	m_keypad_state[row] ^= changed;
+
+	for (col = 0; changed != 0; col ++, changed >>= 1)
+	{
+		if ((changed & 0x01) != 0)
+		{
+			key = KEYPAD_KEY(row, col);
+			if ((m_keypad_state[row] & (u8)(1 << col)) != 0)
+			{
+				m_keypad_hold[key] = 0;
+				keypad_report(KEYPAD_EVENT_PRESS, key);
+			}
+			else
+			{
+				keypad_report(KEYPAD_EVENT_RELEASE, key);
+			}
+		}
+	}
+}
+
+static void keypad_count_holds(void)
+{
+	u8 row;
+	u8 col;
+	u8 key;
+
+	for (row = 0; row < KEYPAD_ROWS; row ++)
+	{
+		for (col = 0; col < KEYPAD_COLS; col ++)
+		{
+			key = KEYPAD_KEY(row, col);
+			if (((m_keypad_state[row] & (u8)(1 << col)) != 0) && (m_keypad_hold[key] != 0xFFFF))
+			{
+				m_keypad_hold[key] ++;
+				if (m_keypad_hold[key] == (KEYPAD_HOLD_DURATION / KEYPAD_SCAN_PERIOD))
+				{
+					keypad_report(KEYPAD_EVENT_LONG_HOLD, key);
+				}
+			}
+		}
+	}
+}
+
+static void keypad_scan_start(void)
+{
+	timer_start_periodic(TIMER_ID_KEYPAD_SCAN, KEYPAD_SCAN_PERIOD, KEYPAD_SCAN_PERIOD);
+}
+
+#ifdef KEYPAD_WAKEUP
+// All rows low, so any key pulls its column down and interrupts.
+static void keypad_sleep(void)
+{
+	timer_stop(TIMER_ID_KEYPAD_SCAN);
+
+	disableInterrupts();
+	GPIO_FAST_RESET(KEYPAD_ROW_PORT, KEYPAD_ROW_MASK);
+	EXTI_ClearITPendingBit(KEYPAD_COL_EXTI_IT);
+	GPIO_FAST_IT_ENABLE(KEYPAD_COL_PORT, KEYPAD_COL_MASK);
+	enableInterrupts();
+
+	// A key that went down before the unmask gave no edge.
+	delay_us(KEYPAD_SETTLE_US);
+	if (GPIO_FAST_READ(KEYPAD_COL_PORT, KEYPAD_COL_MASK) != KEYPAD_COL_MASK)
+	{
+		disableInterrupts();
+		keypad_wakeup_handler();
+		enableInterrupts();
+	}
+}
+#endif
+
+void keypad_scan_timeout_handler(u8 timer_index)
+{
+	u8 row;
+	u8 columns[KEYPAD_ROWS];
+#ifdef KEYPAD_WAKEUP
+	u8 is_any_down = 0;
+#endif
+
+	for (row = 0; row < KEYPAD_ROWS; row ++)
+	{
+		columns[row] = keypad_read_row(row);
+	}
+
+	keypad_count_holds();
+	// Keep the last levels until the rectangle is gone.
+	if (keypad_is_ghosted(columns) == FALSE)
+	{
+		for (row = 0; row < KEYPAD_ROWS; row ++)
+		{
+			keypad_debounce_row(row, columns[row]);
+		}
+	}
+
+#ifdef KEYPAD_WAKEUP
+	for (row = 0; row < KEYPAD_ROWS; row ++)
+	{
+		is_any_down |= (u8)(columns[row] | m_keypad_state[row]);
+	}
+	if (is_any_down == 0)
+	{
+		keypad_sleep();
+	}
+#endif
+}
+
+void keypad_wakeup_handler(void)
+{
+	// With the event queue full the matrix stays asleep, the next column
+	// edge tries again.
+	if (event_put(keypad_scan_start) == TRUE)
+	{
+		GPIO_FAST_IT_DISABLE(KEYPAD_COL_PORT, KEYPAD_COL_MASK);
+		GPIO_FAST_SET(KEYPAD_ROW_PORT, KEYPAD_ROW_MASK);
+	}
+}
+
+void keypad_init(keypad_event_handler_t handler)
+{
+	u8 row;
+
+	m_keypad_event_handler = handler;
+	for (row = 0; row < KEYPAD_ROWS; row ++)
+	{
+		m_keypad_state[row] = 0;
+		m_keypad_count0[row] = 0xFF;
+		m_keypad_count1[row] = 0xFF;
+	}
+
+	disableInterrupts();
+	GPIO_Init(KEYPAD_ROW_PORT, KEYPAD_ROW_MASK, GPIO_Mode_Out_OD_HiZ_Fast);
+	GPIO_Init(KEYPAD_COL_PORT, KEYPAD_COL_MASK, GPIO_Mode_In_PU_No_IT);
+#ifdef KEYPAD_WAKEUP
+	// The columns interrupt as a port, the edge tells nothing about the key.
+	EXTI_SetPortSensitivity(KEYPAD_COL_EXTI_PORT, EXTI_Trigger_Falling);
+	EXTI_SelectPort(KEYPAD_COL_EXTI_PORT);
+	EXTI_SetHalfPortSelection(KEYPAD_COL_HALF_LSB, ENABLE);
+	if (KEYPAD_COLS > 4)
+	{
+		EXTI_SetHalfPortSelection(KEYPAD_COL_HALF_MSB, ENABLE);
+	}
+#endif
+	enableInterrupts();
+
+	keypad_scan_start();
+}
+
+#else
+
+void keypad_wakeup_handler(void)
+{
+}
+
+#endif // KEYPAD_MATRIX
@@ -20,10 +20,16 @@
 
 /* Includes ------------------------------------------------------------------*/
 #include "stm8l15x.h"
-#include "stm8l15x_clk.h"
 
+#include "app.h"
+#include "battery.h"
+#include "clock.h"
+#include "event.h"
+#include "idle.h"
+#include "settings.h"
 #include "timer.h"
 #include "button.h"
+#include "keypad.h"
 
 /** @addtogroup Template
   * @{
@@ -36,15 +42,6 @@
 /* Private function prototypes -----------------------------------------------*/
 
 /* Private functions ---------------------------------------------------------*/
-static void clock_init(void)
-{
-  CLK_DeInit();
-  CLK_HSICmd(ENABLE);
-  CLK_SYSCLKDivConfig(CLK_SYSCLKDiv_1);
-  CLK_PeripheralClockConfig(CLK_Peripheral_TIM4, ENABLE);
-}
-
-
 /**
   * @brief  Main program.
   * @param  None
@@ -53,12 +50,25 @@ static void clock_init(void)
 void main(void)
 {
   clock_init();
+  settings_init();
+  event_init();
   timer_init();
-  button_init();
+  button_init(app_button_event_handler);
+#ifdef KEYPAD_MATRIX
+  keypad_init(app_keypad_event_handler);
+#endif
+  idle_init();
+  battery_monitor_init(BATTERY_LOW_MV, BATTERY_CRITICAL_MV, app_battery_event_handler);
+
+  /* Only the pulse generator and the ADC need 16 MHz from here on */
+  clock_release(CLOCK_USER_INIT);
 
   /* Infinite loop */
   while (1)
   {
+    /* Timer and button handlers posted by the interrupts run here */
+    event_dispatch();
+    idle_enter();
   }
 }
 
@@ -0,0 +1,269 @@
+#include "stm8l15x.h"
+#include "stm8l15x_clk.h"
+#include "stm8l15x_tim2.h"
+#include "stm8l15x_tim3.h"
+
+#include "clock.h"
+#include "event.h"
+#include "pulse.h"
+
+#define PULSE_QUEUE_SIZE    4   // Must be a power of two.
+#define PULSE_QUEUE_MASK    (PULSE_QUEUE_SIZE - 1)
+
+/* The timers count SYSCLK/128, that is 125 counts per ms at 16 MHz. */
+#define PULSE_COUNT_PER_MS  125
+
+/*
+	Each channel drives its pin from a timer output compare in PWM mode 2:
+	low while the counter is below the off time, high until the autoreload.
+	The update interrupt counts the pulses and switches to one pulse mode
+	before the last one, so the hardware stops the counter by itself.
+*/
+typedef struct pulse_channel_manager_s
+{
+	pulse_cmd_t queue[PULSE_QUEUE_SIZE];   // Head entry is the train in flight.
+	u8   head;
+	u8   tail;
+	volatile u8 remaining;
+} pulse_channel_manager_t;
+
+static pulse_channel_manager_t m_pulse_channel[PULSE_CHANNEL_NUMBER];
+
+static void pulse_channel1_done(void);
+static void pulse_channel2_done(void);
+
+// Everything but the counter enable, so several trains can start together.
+static void pulse_hw_setup(pulse_channel_t channel, const pulse_cmd_t *p_cmd)
+{
+	u16 off_count = p_cmd->off_ms * PULSE_COUNT_PER_MS;
+	u16 period = (u16)((p_cmd->off_ms + p_cmd->on_ms) * PULSE_COUNT_PER_MS - 1);
+
+	m_pulse_channel[channel].remaining = p_cmd->pulse_num;
+
+	if (channel == PULSE_CHANNEL_1)
+	{
+		CLK_PeripheralClockConfig(CLK_Peripheral_TIM2, ENABLE);
+		TIM2_DeInit();
+		TIM2_TimeBaseInit(TIM2_Prescaler_128, TIM2_CounterMode_Up, period);
+		TIM2_OC1Init(TIM2_OCMode_PWM2, TIM2_OutputState_Enable, off_count,
+		             TIM2_OCPolarity_High, TIM2_OCIdleState_Reset);
+		TIM2_SelectOnePulseMode((p_cmd->pulse_num == 1) ? TIM2_OPMode_Single : TIM2_OPMode_Repetitive);
+		TIM2_ClearFlag(TIM2_FLAG_Update);
+		TIM2_ITConfig(TIM2_IT_Update, ENABLE);
+		TIM2_CtrlPWMOutputs(ENABLE);
+	}
+	else
+	{
+		CLK_PeripheralClockConfig(CLK_Peripheral_TIM3, ENABLE);
+		TIM3_DeInit();
+		TIM3_TimeBaseInit(TIM3_Prescaler_128, TIM3_CounterMode_Up, period);
+		TIM3_OC1Init(TIM3_OCMode_PWM2, TIM3_OutputState_Enable, off_count,
+		             TIM3_OCPolarity_High, TIM3_OCIdleState_Reset);
+		TIM3_SelectOnePulseMode((p_cmd->pulse_num == 1) ? TIM3_OPMode_Single : TIM3_OPMode_Repetitive);
+		TIM3_ClearFlag(TIM3_FLAG_Update);
+		TIM3_ITConfig(TIM3_IT_Update, ENABLE);
+		TIM3_CtrlPWMOutputs(ENABLE);
+	}
+}
+
+/*
+	Starts the counters of the channels set up, a bit each. The CEN bits
+	are set with a BSET each and nothing in between, so two trains started
+	together run a few cycles apart, not a whole setup apart.
+*/
+static void pulse_hw_enable(u8 channels)
+{
+	disableInterrupts();
+	if ((channels & (1 << PULSE_CHANNEL_1)) != 0)
+	{
+		TIM2->CR1 |= TIM_CR1_CEN;
+	}
+	if ((channels & (1 << PULSE_CHANNEL_2)) != 0)
+	{
+		TIM3->CR1 |= TIM_CR1_CEN;
+	}
+	enableInterrupts();
+}
+
+static void pulse_hw_stop(pulse_channel_t channel)
+{
+	if (channel == PULSE_CHANNEL_1)
+	{
+		TIM2_DeInit();
+		CLK_PeripheralClockConfig(CLK_Peripheral_TIM2, DISABLE);
+	}
+	else
+	{
+		TIM3_DeInit();
+		CLK_PeripheralClockConfig(CLK_Peripheral_TIM3, DISABLE);
+	}
+}
+
+// Called from the TIM2/TIM3 update interrupts at the end of every pulse.
+void pulse_update_handler(pulse_channel_t channel)
+{
+	pulse_channel_manager_t *p_channel = &m_pulse_channel[channel];
+
+	if (p_channel->remaining == 0)
+	{
+		return;
+	}
+	p_channel->remaining --;
+
+	if (p_channel->remaining == 1)
+	{
+		// The counter stops at the end of the last pulse.
+		if (channel == PULSE_CHANNEL_1)
+		{
+			TIM2_SelectOnePulseMode(TIM2_OPMode_Single);
+		}
+		else
+		{
+			TIM3_SelectOnePulseMode(TIM3_OPMode_Single);
+		}
+	}
+	else if (p_channel->remaining == 0)
+	{
+		if (channel == PULSE_CHANNEL_1)
+		{
+			TIM2_CtrlPWMOutputs(DISABLE);
+			if (event_put(pulse_channel1_done) == TRUE)
+			{
+				TIM2_ITConfig(TIM2_IT_Update, DISABLE);
+			}
+			else
+			{
+				// Event queue full, time one more period with the output
+				// off and post again at its end.
+				p_channel->remaining = 1;
+				TIM2_Cmd(ENABLE);
+			}
+		}
+		else
+		{
+			TIM3_CtrlPWMOutputs(DISABLE);
+			if (event_put(pulse_channel2_done) == TRUE)
+			{
+				TIM3_ITConfig(TIM3_IT_Update, DISABLE);
+			}
+			else
+			{
+				// Event queue full, time one more period with the output
+				// off and post again at its end.
+				p_channel->remaining = 1;
+				TIM3_Cmd(ENABLE);
+			}
+		}
+	}
+}
+
+static void pulse_channel_done(pulse_channel_t channel)
+{
+	pulse_channel_manager_t *p_channel = &m_pulse_channel[channel];
+	pulse_done_handler_t done_handler = p_channel->queue[p_channel->head].done_handler;
+
+	p_channel->head = (p_channel->head + 1) & PULSE_QUEUE_MASK;
+	if (p_channel->head != p_channel->tail)
+	{
+		pulse_hw_setup(channel, &p_channel->queue[p_channel->head]);
+		pulse_hw_enable((u8)(1 << channel));
+	}
+	else
+	{
+		pulse_hw_stop(channel);
+		if (pulse_is_busy() == FALSE)
+		{
+			clock_release(CLOCK_USER_PULSE);
+		}
+	}
+
+	if (done_handler != NULL)
+	{
+		done_handler();
+	}
+}
+
+static void pulse_channel1_done(void)
+{
+	pulse_channel_done(PULSE_CHANNEL_1);
+}
+
+static void pulse_channel2_done(void)
+{
+	pulse_channel_done(PULSE_CHANNEL_2);
+}
+
+static bool pulse_has_room(const pulse_cmd_t *p_cmd)
+{
+	pulse_channel_manager_t *p_channel;
+
+	if ((p_cmd == NULL) || (p_cmd->pulse_num == 0))
+	{
+		return TRUE;
+	}
+	p_channel = &m_pulse_channel[p_cmd->channel];
+	return (((p_channel->tail + 1) & PULSE_QUEUE_MASK) != p_channel->head) ? TRUE : FALSE;
+}
+
+// Queues the train and sets its timer up if the channel was idle. Returns
+// the bit of the channel to start, 0 if none.
+static u8 pulse_queue(const pulse_cmd_t *p_cmd)
+{
+	pulse_channel_manager_t *p_channel;
+	u8 tail;
+
+	if ((p_cmd == NULL) || (p_cmd->pulse_num == 0))
+	{
+		return 0;
+	}
+	p_channel = &m_pulse_channel[p_cmd->channel];
+	tail = p_channel->tail;
+	p_channel->queue[tail] = *p_cmd;
+	p_channel->tail = (tail + 1) & PULSE_QUEUE_MASK;
+	if (p_channel->head != tail)
+	{
+		return 0;
+	}
+	pulse_hw_setup(p_cmd->channel, &p_channel->queue[tail]);
+	return (u8)(1 << p_cmd->channel);
+}
+
+bool pulse_send(const pulse_cmd_t *p_cmd)
+{
+	return pulse_send_pair(p_cmd, NULL);
+}
+
+bool pulse_send_pair(const pulse_cmd_t *p_cmd1, const pulse_cmd_t *p_cmd2)
+{
+	u8 channels;
+
+	if ((pulse_has_room(p_cmd1) == FALSE) || (pulse_has_room(p_cmd2) == FALSE))
+	{
+		// No space for one of the trains, neither is queued.
+		return FALSE;
+	}
+
+	channels = pulse_queue(p_cmd1);
+	channels |= pulse_queue(p_cmd2);
+	if (channels != 0)
+	{
+		// The counts per ms above assume SYSCLK at 16 MHz.
+		clock_request(CLOCK_USER_PULSE);
+		pulse_hw_enable(channels);
+	}
+	return TRUE;
+}
+
+bool pulse_is_busy(void)
+{
+	u8 channel;
+
+	for (channel = 0; channel < PULSE_CHANNEL_NUMBER; channel ++)
+	{
+		if (m_pulse_channel[channel].head != m_pulse_channel[channel].tail)
+		{
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
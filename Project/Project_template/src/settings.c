@@ -0,0 +1,231 @@
+#include "stm8l15x.h"
+#include "stm8l15x_flash.h"
+
+#include "settings.h"
+
+/*
+	Every EEPROM block holds a log of 4 byte records, written with a single
+	FLASH_ProgramWord each: the tag, the value high and low byte and a check
+	byte. Word 0 is the header, tagged SETTINGS_TAG_HEADER with a sequence
+	number as value, and the valid header with the newest sequence marks the
+	live block. Later records of a key override earlier ones.
+
+	Once the live block is full, the live values are programmed into the next
+	block round robin, with the header word left empty, and the header is
+	written last. A reset before the header keeps the old block live, and
+	every block takes the same share of the writes.
+*/
+#define SETTINGS_BLOCKS        FLASH_DATA_EEPROM_BLOCKS_NUMBER
+#define SETTINGS_WORDS         (FLASH_BLOCK_SIZE / 4)
+#define SETTINGS_TAG_HEADER    0xFF
+#define SETTINGS_CHECK_SEED    0xA5   // An erased word, all 0, is never valid.
+
+/* A full block must still have room for one record after compaction. */
+typedef char settings_key_check_t[(SETTINGS_KEY_NUMBER < SETTINGS_WORDS) ? 1 : -1];
+
+typedef struct settings_record_s
+{
+	u8   tag;
+	u16  value;
+	u8   check;
+} settings_record_t;
+
+static u16 m_settings_value[SETTINGS_KEY_NUMBER];
+static u32 m_settings_stored = 0;   // A bit per key with a record.
+static u8  m_settings_block = 0;
+static u16 m_settings_sequence = 0;
+static u8  m_settings_word = SETTINGS_WORDS;   // Next free record of the live block.
+
+static u8  m_settings_buffer[FLASH_BLOCK_SIZE];
+
+
+static u32 settings_address(u8 block, u8 word)
+{
+	return FLASH_DATA_EEPROM_START_PHYSICAL_ADDRESS + (u16)block * FLASH_BLOCK_SIZE + (u16)word * 4;
+}
+
+static u8 settings_check(u8 tag, u16 value)
+{
+	return (u8)(tag ^ (u8)(value >> 8) ^ (u8)value ^ SETTINGS_CHECK_SEED);
+}
+
+static void settings_read(u8 block, u8 word, settings_record_t *p_record)
+{
+	u32 address = settings_address(block, word);
+
+	p_record->tag = FLASH_ReadByte(address);
+	p_record->value = (u16)(((u16)FLASH_ReadByte(address + 1) << 8) | FLASH_ReadByte(address + 2));
+	p_record->check = FLASH_ReadByte(address + 3);
+}
+
+static bool settings_is_valid(const settings_record_t *p_record)
+{
+	return (p_record->check == settings_check(p_record->tag, p_record->value)) ? TRUE : FALSE;
+}
+
+static bool settings_is_empty(const settings_record_t *p_record)
+{
+	return ((p_record->tag == 0) && (p_record->value == 0) && (p_record->check == 0)) ? TRUE : FALSE;
+}
+
+static void settings_pack(u8 *p_bytes, u8 tag, u16 value)
+{
+	p_bytes[0] = tag;
+	p_bytes[1] = (u8)(value >> 8);
+	p_bytes[2] = (u8)value;
+	p_bytes[3] = settings_check(tag, value);
+}
+
+static void settings_unlock(void)
+{
+	FLASH_Unlock(FLASH_MemType_Data);
+	while (FLASH_GetFlagStatus(FLASH_FLAG_DUL) == RESET)
+	{
+	}
+}
+
+static bool settings_wait(void)
+{
+	u8 status = (u8)FLASH_WaitForLastOperation(FLASH_MemType_Data);
+
+	return ((status == FLASH_Status_TimeOut) ||
+	        ((status & FLASH_Status_Write_Protection_Error) != 0)) ? FALSE : TRUE;
+}
+
+static bool settings_program_word(u8 block, u8 word, u8 tag, u16 value)
+{
+	union
+	{
+		u32 word;
+		u8  bytes[4];
+	} record;
+
+	// FLASH_ProgramWord writes the bytes of the word in memory order.
+	settings_pack(record.bytes, tag, value);
+	FLASH_ProgramWord(settings_address(block, word), record.word);
+	return settings_wait();
+}
+
+// Moves the live values to block, EEPROM unlocked.
+static bool settings_compact(u8 block, u16 sequence)
+{
+	u8 key;
+	u8 word = 1;
+	u8 index;
+
+	for (index = 0; index < FLASH_BLOCK_SIZE; index ++)
+	{
+		m_settings_buffer[index] = 0;
+	}
+	for (key = SETTINGS_KEY_NONE + 1; key < SETTINGS_KEY_NUMBER; key ++)
+	{
+		if ((m_settings_stored & ((u32)1 << key)) != 0)
+		{
+			settings_pack(&m_settings_buffer[word * 4], key, m_settings_value[key]);
+			word ++;
+		}
+	}
+
+	// Also clears the records an earlier round left in the block.
+	FLASH_ProgramBlock(block, FLASH_MemType_Data, FLASH_ProgramMode_Standard, m_settings_buffer);
+	if (settings_wait() == FALSE)
+	{
+		return FALSE;
+	}
+	if (settings_program_word(block, 0, SETTINGS_TAG_HEADER, sequence) == FALSE)
+	{
+		return FALSE;
+	}
+
+	m_settings_block = block;
+	m_settings_sequence = sequence;
+	m_settings_word = word;
+	return TRUE;
+}
+
+void settings_init(void)
+{
+	u8 block;
+	u8 word;
+	bool is_found = FALSE;
+	settings_record_t record;
+
+	// The RAM index is rebuilt from the EEPROM alone, also on a second call.
+	m_settings_stored = 0;
+	for (block = 0; block < SETTINGS_BLOCKS; block ++)
+	{
+		settings_read(block, 0, &record);
+		if ((settings_is_valid(&record) == TRUE) && (record.tag == SETTINGS_TAG_HEADER) &&
+		    ((is_found == FALSE) || ((s16)(record.value - m_settings_sequence) > 0)))
+		{
+			is_found = TRUE;
+			m_settings_block = block;
+			m_settings_sequence = record.value;
+		}
+	}
+
+	if (is_found == FALSE)
+	{
+		settings_unlock();
+		settings_compact(0, 0);
+		FLASH_Lock(FLASH_MemType_Data);
+		return;
+	}
+
+	// Compaction leaves the words after the last record erased.
+	for (word = 1; word < SETTINGS_WORDS; word ++)
+	{
+		settings_read(m_settings_block, word, &record);
+		if (settings_is_empty(&record) == TRUE)
+		{
+			break;
+		}
+		// A torn record fails the check and is skipped.
+		if ((settings_is_valid(&record) == TRUE) &&
+		    (record.tag > SETTINGS_KEY_NONE) && (record.tag < SETTINGS_KEY_NUMBER))
+		{
+			m_settings_value[record.tag] = record.value;
+			m_settings_stored |= (u32)1 << record.tag;
+		}
+	}
+	m_settings_word = word;
+}
+
+u16 settings_get(settings_key_t key, u16 default_value)
+{
+	if ((key >= SETTINGS_KEY_NUMBER) || ((m_settings_stored & ((u32)1 << key)) == 0))
+	{
+		return default_value;
+	}
+	return m_settings_value[key];
+}
+
+bool settings_set(settings_key_t key, u16 value)
+{
+	bool is_done;
+
+	if ((key == SETTINGS_KEY_NONE) || (key >= SETTINGS_KEY_NUMBER))
+	{
+		return FALSE;
+	}
+	if (((m_settings_stored & ((u32)1 << key)) != 0) && (m_settings_value[key] == value))
+	{
+		// Nothing to write, saves an EEPROM cycle.
+		return TRUE;
+	}
+	m_settings_value[key] = value;
+	m_settings_stored |= (u32)1 << key;
+
+	settings_unlock();
+	if (m_settings_word < SETTINGS_WORDS)
+	{
+		is_done = settings_program_word(m_settings_block, m_settings_word, key, value);
+		m_settings_word ++;
+	}
+	else
+	{
+		is_done = settings_compact((u8)((m_settings_block + 1) % SETTINGS_BLOCKS), (u16)(m_settings_sequence + 1));
+	}
+	FLASH_Lock(FLASH_MemType_Data);
+	return is_done;
+}
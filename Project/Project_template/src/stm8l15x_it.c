@@ -22,8 +22,16 @@
 /* Includes ------------------------------------------------------------------*/
 #include "stm8l15x_it.h"
 #include "stm8l15x_exti.h"
+#include "stm8l15x_tim2.h"
+#include "stm8l15x_tim3.h"
 
+#include "battery.h"
 #include "button.h"
+#include "delay.h"
+#include "event.h"
+#include "idle.h"
+#include "pulse.h"
+#include "sys_time.h"
 #include "timer.h"
 
 u32 int_timer4 = 0;
@@ -90,6 +98,9 @@ INTERRUPT_HANDLER(DMA1_CHANNEL0_1_IRQHandler, 2)
   /* In order to detect unexpected events during development,
      it is recommended to set a breakpoint on the following instruction.
   */
+  EVENT_ISR_ENTER();
+  battery_dma_handler();
+  EVENT_ISR_EXIT();
 }
 /**
   * @brief  DMA1 channel2 and channel3 Interrupt routine.
@@ -112,6 +123,7 @@ INTERRUPT_HANDLER(RTC_IRQHandler, 4)
   /* In order to detect unexpected events during development,
      it is recommended to set a breakpoint on the following instruction.
   */
+  idle_wakeup_handler();
 }
 /**
   * @brief  External IT PORTE/F and PVD Interrupt routine.
@@ -123,6 +135,9 @@ INTERRUPT_HANDLER(EXTIE_F_PVD_IRQHandler, 5)
   /* In order to detect unexpected events during development,
      it is recommended to set a breakpoint on the following instruction.
   */
+  EVENT_ISR_ENTER();
+  battery_pvd_handler();
+  EVENT_ISR_EXIT();
 }
 
 /**
@@ -135,7 +150,10 @@ INTERRUPT_HANDLER(EXTIB_IRQHandler, 6)
   /* In order to detect unexpected events during development,
      it is recommended to set a breakpoint on the following instruction.
   */
-  button_event_handler();
+  EVENT_ISR_ENTER();
+  button_event_handler(EXTI_IT_PortB);
+  EXTI_ClearITPendingBit(EXTI_IT_PortB);
+  EVENT_ISR_EXIT();
 }
 
 /**
@@ -148,6 +166,10 @@ INTERRUPT_HANDLER(EXTID_IRQHandler, 7)
   /* In order to detect unexpected events during development,
      it is recommended to set a breakpoint on the following instruction.
   */
+  EVENT_ISR_ENTER();
+  keypad_wakeup_handler();
+  EXTI_ClearITPendingBit(EXTI_IT_PortD);
+  EVENT_ISR_EXIT();
 }
 
 /**
@@ -232,8 +254,10 @@ INTERRUPT_HANDLER(EXTI6_IRQHandler, 14)
   /* In order to detect unexpected events during development,
      it is recommended to set a breakpoint on the following instruction.
   */
-  button_event_handler();
+  EVENT_ISR_ENTER();
+  button_event_handler(EXTI_IT_Pin6);
   EXTI_ClearITPendingBit(EXTI_IT_Pin6);
+  EVENT_ISR_EXIT();
 }
 
 /**
@@ -246,8 +270,10 @@ INTERRUPT_HANDLER(EXTI7_IRQHandler, 15)
   /* In order to detect unexpected events during development,
      it is recommended to set a breakpoint on the following instruction.
   */
-  button_event_handler();
+  EVENT_ISR_ENTER();
+  button_event_handler(EXTI_IT_Pin7);
   EXTI_ClearITPendingBit(EXTI_IT_Pin7);
+  EVENT_ISR_EXIT();
 }
 /**
   * @brief  LCD start of new frame Interrupt routine.
@@ -294,6 +320,10 @@ INTERRUPT_HANDLER(TIM2_UPD_OVF_TRG_BRK_IRQHandler, 19)
   /* In order to detect unexpected events during development,
      it is recommended to set a breakpoint on the following instruction.
   */
+  EVENT_ISR_ENTER();
+  pulse_update_handler(PULSE_CHANNEL_1);
+  TIM2_ClearITPendingBit(TIM2_IT_Update);
+  EVENT_ISR_EXIT();
 }
 
 /**
@@ -319,6 +349,10 @@ INTERRUPT_HANDLER(TIM3_UPD_OVF_TRG_BRK_IRQHandler, 21)
   /* In order to detect unexpected events during development,
      it is recommended to set a breakpoint on the following instruction.
   */
+  EVENT_ISR_ENTER();
+  pulse_update_handler(PULSE_CHANNEL_2);
+  TIM3_ClearITPendingBit(TIM3_IT_Update);
+  EVENT_ISR_EXIT();
 }
 /**
   * @brief  Timer3 Capture/Compare Interrupt routine.
@@ -341,6 +375,12 @@ INTERRUPT_HANDLER(TIM1_UPD_OVF_TRG_COM_IRQHandler, 23)
   /* In order to detect unexpected events during development,
      it is recommended to set a breakpoint on the following instruction.
   */
+#ifdef EVENT_ISR_PROFILE
+  /* TIM1 free runs as the cycle counter, the update is a wrap. */
+  event_cycle_wrap_handler();
+#else
+  delay_timer_handler();
+#endif
 }
 /**
   * @brief  TIM1 Capture/Compare Interrupt routine.
@@ -364,6 +404,15 @@ INTERRUPT_HANDLER(TIM4_UPD_OVF_TRG_IRQHandler, 25)
   /* In order to detect unexpected events during development,
      it is recommended to set a breakpoint on the following instruction.
   */
+  TIMER_ISR_ENTER();
+  EVENT_ISR_ENTER();
+#ifdef TIMER_TICKLESS
+  /* The timer module programs every update to land on a deadline, and
+     checks the flag for a period that ends while it reprograms. */
+  TIM4_ClearITPendingBit(TIM4_IT_Update);
+  tick_timeout_handler();
+#else
+  sys_time_update_handler();
   int_timer4 ++;
   if ((int_timer4%5) == 0)
   {
@@ -371,6 +420,9 @@ INTERRUPT_HANDLER(TIM4_UPD_OVF_TRG_IRQHandler, 25)
     tick_timeout_handler();
   }
   TIM4_ClearITPendingBit(TIM4_IT_Update);
+#endif
+  EVENT_ISR_EXIT();
+  TIMER_ISR_EXIT();
 }
 /**
   * @brief  SPI1 Interrupt routine.
@@ -0,0 +1,116 @@
+#include "stm8l15x.h"
+#include "stm8l15x_tim4.h"
+
+#include "timer.h"
+#include "sys_time.h"
+
+#define SYS_TIME_US_PER_S    1000000
+
+/* TIM4 count length, the timer module keeps it at any SYSCLK divider. */
+#ifdef TIMER_TICKLESS
+#define SYS_TIME_US_PER_COUNT    2048   // SYSCLK/32768
+#else
+#define SYS_TIME_US_PER_COUNT    8      // SYSCLK/128
+#endif
+
+/*
+	The base is the time at which TIM4 stood at m_sys_time_counter_base,
+	readers add the counts since then. Every write makes the sequence odd
+	first and even again after, a reader that sees it change tries again.
+	Writers in main() run with interrupts disabled, so an interrupt never
+	reads a half written base.
+*/
+static volatile u8 m_sys_time_seq = 0;
+static volatile u32 m_sys_time_base_sec = 0;
+static volatile u32 m_sys_time_base_us = 0;
+static volatile u8  m_sys_time_counter_base = 0;
+static volatile bool m_sys_time_is_frozen = FALSE;
+
+static void sys_time_add_us(u32 us)
+{
+	m_sys_time_base_us += us;
+	while (m_sys_time_base_us >= SYS_TIME_US_PER_S)
+	{
+		m_sys_time_base_us -= SYS_TIME_US_PER_S;
+		m_sys_time_base_sec ++;
+	}
+}
+
+void sys_time_now(sys_time_t *p_time)
+{
+	u8  seq;
+	u8  counter;
+	u16 counts;
+
+	do
+	{
+		seq = m_sys_time_seq;
+		p_time->sec = m_sys_time_base_sec;
+		p_time->us = m_sys_time_base_us;
+		counter = TIM4_GetCounter();
+		counts = (u16)(counter - m_sys_time_counter_base);
+		if (TIM4_GetFlagStatus(TIM4_FLAG_Update) != RESET)
+		{
+			// The update is pending behind a masked interrupt, the counter restarted.
+			counter = TIM4_GetCounter();
+			counts = (u16)TIM4->ARR + 1 - m_sys_time_counter_base + counter;
+		}
+	} while ((seq != m_sys_time_seq) || ((seq & 1) != 0));
+
+	p_time->us += (u32)counts * SYS_TIME_US_PER_COUNT;
+	while (p_time->us >= SYS_TIME_US_PER_S)
+	{
+		p_time->us -= SYS_TIME_US_PER_S;
+		p_time->sec ++;
+	}
+}
+
+u32 sys_time_now_us(void)
+{
+	sys_time_t now;
+
+	sys_time_now(&now);
+	return now.sec * SYS_TIME_US_PER_S + now.us;
+}
+
+u32 sys_time_now_ms(void)
+{
+	sys_time_t now;
+
+	sys_time_now(&now);
+	return now.sec * 1000 + now.us / 1000;
+}
+
+void sys_time_update_handler(void)
+{
+	sys_time_account((u16)TIM4->ARR + 1 - m_sys_time_counter_base, 0);
+}
+
+void sys_time_account(u16 counts, u8 counter_base)
+{
+	m_sys_time_seq ++;
+	sys_time_add_us((u32)counts * SYS_TIME_US_PER_COUNT);
+	m_sys_time_counter_base = counter_base;
+	m_sys_time_seq ++;
+}
+
+void sys_time_freeze(void)
+{
+	m_sys_time_is_frozen = TRUE;
+}
+
+bool sys_time_is_frozen(void)
+{
+	return m_sys_time_is_frozen;
+}
+
+void sys_time_advance_ms(u32 ms)
+{
+	disableInterrupts();
+	m_sys_time_seq ++;
+	m_sys_time_base_sec += ms / 1000;
+	sys_time_add_us((ms % 1000) * 1000);
+	m_sys_time_seq ++;
+	m_sys_time_is_frozen = FALSE;
+	enableInterrupts();
+}
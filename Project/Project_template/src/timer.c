@@ -1,110 +1,571 @@
 #include "stm8l15x.h"
 #include "stm8l15x_tim4.h"
 
+#include "event.h"
+#include "sys_time.h"
 #include "timer.h"
 
-#define MAX_TIMER_NUMBER    6
+#define TIMER_INDEX_NONE    0xFF
 
+#if defined(TIMER_STATS) && !defined(EVENT_ISR_PROFILE)
+#error "TIMER_STATS reads the cycle counter of EVENT_ISR_PROFILE, define it as well"
+#endif
+
+/* The queue links are u8 with 0xFF as end marker, more timers fail to build. */
+typedef char timer_number_check_t[(TIMER_NUMBER < TIMER_INDEX_NONE) ? 1 : -1];
+
+/*
+	Started timers are kept in a queue sorted by expiry. Each entry only stores
+	the ticks left after the previous entry expires, so a tick only touches
+	the head of the queue. The queue also knows when its tail expires, so a
+	start walks in from whichever end is nearer: short debounce timers from
+	the head, long timeouts from the tail. The ends are picked by time, so
+	deadlines bunched at one end can still make a start walk past nearly all
+	started timers. test_timer_bench shows the walks of a full pool.
+*/
 typedef struct timer_manager_s
 {
-    u8   timer_index;
     bool timer_started;
-    s32  timer_left;
-    app_timer_timeout_handler_t handler;
+    bool timer_expired;   // Handler waits to run from main().
+    u8   prev;
+    u8   next;
+    u32  timer_delta;
+    u32  timer_interval;  // Ticks between expiries, 0 for a one shot timer.
 } timer_manager_t;
 
-static timer_manager_t m_timer_manager[MAX_TIMER_NUMBER] = {0};
-static u8 m_current_timer_num = 0;
-static u8 m_running_timer_num = 0;
-static s32 m_wait_timer_tick = 0;
-static s32 system_past_tick = 0;
+/*
+	The prescalers below are for SYSCLK at 16 MHz. A SYSCLK divider of 2^n
+	takes n off the prescaler, so TIM4 keeps counting at the same rate.
+*/
+#ifdef TIMER_TICKLESS
+#define TIMER_HW_PRESCALER    TIM4_Prescaler_32768
+#else
+#define TIMER_HW_PRESCALER    TIM4_Prescaler_128
+#endif
+
+#ifdef TIMER_TICKLESS
+/*
+	TIM4 counts SYSCLK/32768, so one count is 2.048 ms and one 10 ms tick is
+	625/128 counts. Elapsed counts are converted into ticks in 1/625 tick
+	units and the remainder is carried over, so reprogramming the autoreload
+	never loses time.
+*/
+#define TIMER_HW_COUNT_FRACTION    128   // One count in 1/625 tick units.
+#define TIMER_HW_TICK_FRACTION     625   // One tick in 1/625 tick units.
+#define TIMER_HW_MAX_PERIOD        256   // Counts until the 8 bit counter overflows.
+#endif
+
+#define TIMER_HANDLER(id, handler)    handler,
+
+// Indexed by timer id, kept in flash.
+static const app_timer_timeout_handler_t m_timer_handler[TIMER_NUMBER] =
+{
+	TIMER_LIST(TIMER_HANDLER)
+};
+
+static timer_manager_t m_timer_manager[TIMER_NUMBER] = {0};
+static u8 m_timer_queue_head = TIMER_INDEX_NONE;
+static u8 m_timer_queue_tail = TIMER_INDEX_NONE;
+static u32 m_timer_queue_span = 0;    // Ticks until the tail expires.
+static volatile bool m_timer_dispatch_due = FALSE;      // Expired timers wait for a dispatch.
+static volatile bool m_timer_dispatch_posted = FALSE;   // The dispatch is in the event queue.
+static CLK_SYSCLKDiv_TypeDef m_timer_sysclk_div = CLK_SYSCLKDiv_1;
+
+#ifdef TIMER_STATS
+static timer_stats_t m_timer_stats[TIMER_NUMBER];
+static u32 m_timer_stats_deadline[TIMER_NUMBER];   // Tick the last expiry was due.
+static u32 m_timer_stats_ticks = 0;                // Ticks advanced since boot.
+static u32 m_timer_stats_isr_count = 0;
+static u32 m_timer_stats_isr_cycles = 0;
+static u32 m_timer_stats_isr_start = 0;
+#endif
+
+#ifdef TIMER_TICKLESS
+static bool m_timer_hw_running = FALSE;
+static u16  m_timer_hw_period = TIMER_HW_MAX_PERIOD;  // Counts of the period being timed.
+static u16  m_timer_hw_base = 0;                      // Counts of it already accounted.
+static u16  m_timer_hw_fraction = 0;                  // Accounted time short of a whole tick.
+#endif
+
+#ifdef TIMER_TICKLESS
+static void timer_hw_program(void);
+#endif
 
 void timer_init(void)
 {
+    u8 index;
+
+    for (index = 0; index < TIMER_NUMBER; index ++)
+    {
+        m_timer_manager[index].timer_started = FALSE;
+        m_timer_manager[index].timer_expired = FALSE;
+        m_timer_manager[index].prev = TIMER_INDEX_NONE;
+        m_timer_manager[index].next = TIMER_INDEX_NONE;
+    }
+
     TIM4_DeInit();
-    TIM4_TimeBaseInit(TIM4_Prescaler_128, 250); // (1/16MHz)*128*125 = 1mS
+#ifdef TIMER_TICKLESS
+    TIM4_PrescalerConfig((TIM4_Prescaler_TypeDef)(TIMER_HW_PRESCALER - m_timer_sysclk_div), TIM4_PSCReloadMode_Immediate); // (1/16MHz)*32768 = 2.048mS
+    TIM4_SetAutoreload(TIMER_HW_MAX_PERIOD - 1);
+    TIM4_ClearFlag(TIM4_FLAG_Update);
+    TIM4_ITConfig(TIM4_IT_Update, ENABLE); //Enable TIM4 IT UPDATE
+    timer_hw_program();
+#else
+    TIM4_TimeBaseInit((TIM4_Prescaler_TypeDef)(TIMER_HW_PRESCALER - m_timer_sysclk_div), 249); // (1/16MHz)*128*250 = 2mS, the counter counts 0 to 249
     TIM4_SetCounter(0); // T = n * 1mS
+    TIM4_ClearFlag(TIM4_FLAG_Update); // Set by the update that loaded the prescaler.
     TIM4_ITConfig(TIM4_IT_Update, ENABLE); //Enable TIM4 IT UPDATE
     TIM4_Cmd(ENABLE);
+#endif
 }
 
-void timer_create(u8 *timer_index, app_timer_timeout_handler_t timerout_hander)
+static void timer_queue_remove(u8 timer_index)
 {
-	if (m_current_timer_num >= MAX_TIMER_NUMBER)
+	timer_manager_t *p_timer = &m_timer_manager[timer_index];
+
+	if (p_timer->next != TIMER_INDEX_NONE)
 	{
-		// No space for the new timer.
-		return;
+		// The follower inherits the ticks of the removed timer.
+		m_timer_manager[p_timer->next].timer_delta += p_timer->timer_delta;
+		m_timer_manager[p_timer->next].prev = p_timer->prev;
+	}
+	else
+	{
+		m_timer_queue_tail = p_timer->prev;
+		m_timer_queue_span -= p_timer->timer_delta;
+	}
+	if (p_timer->prev != TIMER_INDEX_NONE)
+	{
+		m_timer_manager[p_timer->prev].next = p_timer->next;
 	}
 	else
 	{
-		*timer_index = m_current_timer_num;
-		m_timer_manager[m_current_timer_num].timer_index = m_current_timer_num;
-		m_timer_manager[m_current_timer_num].timer_started = FALSE;
-		m_timer_manager[m_current_timer_num].handler = timerout_hander;
-		m_current_timer_num ++;
+		m_timer_queue_head = p_timer->next;
 	}
+	p_timer->prev = TIMER_INDEX_NONE;
+	p_timer->next = TIMER_INDEX_NONE;
+	p_timer->timer_started = FALSE;
 }
 
-void timer_schedule(bool is_new)
+static void timer_queue_insert(u8 timer_index, u32 duration)
 {
-	u8 index = 0;
-	m_wait_timer_tick = 0x7FFFFFFF;
-	m_running_timer_num = 0;
+	u8 prev;
+	u8 curr;
+	u32 deadline;
+	timer_manager_t *p_timer = &m_timer_manager[timer_index];
 
-	for (index = 0; index < m_current_timer_num; index ++)
+	// Timers with the same deadline expire in the order they were started.
+	if (duration <= m_timer_queue_span / 2)
+	{
+		prev = TIMER_INDEX_NONE;
+		curr = m_timer_queue_head;
+		while ((curr != TIMER_INDEX_NONE) && (m_timer_manager[curr].timer_delta <= duration))
+		{
+			duration -= m_timer_manager[curr].timer_delta;
+			prev = curr;
+			curr = m_timer_manager[curr].next;
+		}
+	}
+	else
 	{
-		if (m_timer_manager[index].timer_started == TRUE)
+		// Walk back to the last timer that expires no later than this one.
+		prev = m_timer_queue_tail;
+		deadline = m_timer_queue_span;
+		while ((prev != TIMER_INDEX_NONE) && (deadline > duration))
 		{
-			if (is_new == FALSE)
-			{
-				m_timer_manager[index].timer_left -= system_past_tick;
-			}
-			if (m_timer_manager[index].timer_left > 0)
-			{
-				if (m_wait_timer_tick >= m_timer_manager[index].timer_left)
-				{
-					m_running_timer_num ++;
-					m_wait_timer_tick = m_timer_manager[index].timer_left;
-				}
-			}
-			else
-			{
-				m_timer_manager[index].timer_left = 0;
-				m_timer_manager[index].timer_started = FALSE;
-				m_timer_manager[index].handler();
-			}
+			deadline -= m_timer_manager[prev].timer_delta;
+			prev = m_timer_manager[prev].prev;
 		}
+		duration -= deadline;
+		curr = (prev != TIMER_INDEX_NONE) ? m_timer_manager[prev].next : m_timer_queue_head;
 	}
-	system_past_tick = 0;
-	if (m_wait_timer_tick == 0xFFFFFFFF)
+
+	p_timer->timer_delta = duration;
+	p_timer->prev = prev;
+	p_timer->next = curr;
+	p_timer->timer_started = TRUE;
+
+	if (curr != TIMER_INDEX_NONE)
 	{
-		m_wait_timer_tick = 0;
+		m_timer_manager[curr].timer_delta -= duration;
+		m_timer_manager[curr].prev = timer_index;
+	}
+	else
+	{
+		m_timer_queue_tail = timer_index;
+		m_timer_queue_span += duration;
+	}
+	if (prev != TIMER_INDEX_NONE)
+	{
+		m_timer_manager[prev].next = timer_index;
+	}
+	else
+	{
+		m_timer_queue_head = timer_index;
 	}
 }
 
+#ifdef TIMER_STATS
+static void timer_stats_dispatch(u8 index)
+{
+	u32 late;
+	u32 start;
+	u32 cycles;
+	u8  bucket = 0;
 
-void timer_start(u8 timer_index, u32 duration)
+	disableInterrupts();
+	late = m_timer_stats_ticks - m_timer_stats_deadline[index];
+	enableInterrupts();
+	while ((late != 0) && (bucket < TIMER_STATS_LATE_BUCKETS - 1))
+	{
+		late >>= 1;
+		bucket ++;
+	}
+	m_timer_stats[index].late_histogram[bucket] ++;
+
+	start = event_cycles();
+	m_timer_handler[index](index);
+	cycles = event_cycles() - start;
+	if (cycles > m_timer_stats[index].handler_max_cycles)
+	{
+		m_timer_stats[index].handler_max_cycles = cycles;
+	}
+}
+#endif
+
+// Runs from main(), calls the handlers of the expired timers.
+static void timer_dispatch(void)
 {
-	m_timer_manager[timer_index].timer_started = TRUE;
-	m_timer_manager[timer_index].timer_left = duration;
+	u8 index;
 
-	timer_schedule(TRUE);
+	m_timer_dispatch_posted = FALSE;
+	m_timer_dispatch_due = FALSE;
+	for (index = 0; index < TIMER_NUMBER; index ++)
+	{
+		if (m_timer_manager[index].timer_expired == TRUE)
+		{
+			m_timer_manager[index].timer_expired = FALSE;
+#ifdef TIMER_STATS
+			timer_stats_dispatch(index);
+#else
+			m_timer_handler[index](index);
+#endif
+		}
+	}
 }
 
-void timer_stop(u8 timer_index)
+// One dispatch serves every expired timer. With the event queue full the
+// timers stay due, and the next tick or sync posts the dispatch again.
+static void timer_dispatch_post(void)
 {
-	m_timer_manager[timer_index].timer_started = FALSE;
+	if ((m_timer_dispatch_due == TRUE) && (m_timer_dispatch_posted == FALSE))
+	{
+		m_timer_dispatch_posted = event_put(timer_dispatch);
+	}
 }
 
+// Expire the given number of ticks from the head of the queue.
+static void timer_queue_advance(u32 ticks)
+{
+	u8 index;
+#ifdef TIMER_STATS
+	u32 deadline = m_timer_stats_ticks;
 
-void tick_timeout_handler(void)
+	m_timer_stats_ticks += ticks;
+#endif
+
+	// Handlers run later from main(), only mark them here.
+	while (m_timer_queue_head != TIMER_INDEX_NONE)
+	{
+		index = m_timer_queue_head;
+		if (m_timer_manager[index].timer_delta > ticks)
+		{
+			m_timer_manager[index].timer_delta -= ticks;
+			m_timer_queue_span -= ticks;
+			break;
+		}
+		ticks -= m_timer_manager[index].timer_delta;
+		m_timer_queue_span -= m_timer_manager[index].timer_delta;
+#ifdef TIMER_STATS
+		deadline += m_timer_manager[index].timer_delta;
+		m_timer_stats_deadline[index] = deadline;
+		m_timer_stats[index].fire_count ++;
+#endif
+		m_timer_manager[index].timer_delta = 0;
+		timer_queue_remove(index);
+		if (m_timer_manager[index].timer_interval != 0)
+		{
+			// Counted from the deadline just reached, the ticks left over
+			// are taken off below, so lateness never adds up.
+			timer_queue_insert(index, m_timer_manager[index].timer_interval);
+		}
+		m_timer_manager[index].timer_expired = TRUE;
+		m_timer_dispatch_due = TRUE;
+	}
+	timer_dispatch_post();
+}
+
+#ifdef TIMER_TICKLESS
+static void timer_hw_account(u16 counts)
 {
-	if (m_running_timer_num > 0)
+	u32 fraction;
+
+	fraction = (u32)counts * TIMER_HW_COUNT_FRACTION + m_timer_hw_fraction;
+	m_timer_hw_fraction = (u16)(fraction % TIMER_HW_TICK_FRACTION);
+	timer_queue_advance(fraction / TIMER_HW_TICK_FRACTION);
+}
+
+// Account the counts elapsed in the current period before the queue changes.
+static void timer_hw_sync(void)
+{
+	u8 counter;
+
+	if (m_timer_hw_running == FALSE)
 	{
-		system_past_tick ++;
-		if (system_past_tick >= m_wait_timer_tick)
+		return;
+	}
+	// The flag is checked after the counter is read, a wrap in between
+	// would otherwise go unnoticed and the counter look like it went back.
+	counter = TIM4_GetCounter();
+	if (TIM4_GetFlagStatus(TIM4_FLAG_Update) != RESET)
+	{
+		// The period ended behind the masked interrupt. Account it here, the
+		// autoreload may change before the interrupt would see it.
+		TIM4_ClearITPendingBit(TIM4_IT_Update);
+		sys_time_account(m_timer_hw_period - m_timer_hw_base, 0);
+		timer_hw_account(m_timer_hw_period - m_timer_hw_base);
+		m_timer_hw_base = 0;
+		counter = TIM4_GetCounter();
+	}
+	if (counter > m_timer_hw_base)
+	{
+		sys_time_account(counter - m_timer_hw_base, counter);
+		timer_hw_account(counter - m_timer_hw_base);
+		m_timer_hw_base = counter;
+	}
+}
+
+// Set the autoreload so the next update interrupt hits the head deadline.
+static void timer_hw_program(void)
+{
+	u32 delta;
+	u32 counts;
+	u16 period;
+	u16 counter = 0;
+
+	if (m_timer_hw_running == FALSE)
+	{
+		TIM4_SetCounter(0);
+		TIM4_ClearFlag(TIM4_FLAG_Update);
+		m_timer_hw_base = 0;
+		m_timer_hw_fraction = 0;
+	}
+	else
+	{
+		// Until a counter read sees no update behind it, the period being
+		// replaced may have ended and must be accounted with the old length.
+		do
 		{
-			timer_schedule(FALSE);
+			timer_hw_sync();
+			counter = TIM4_GetCounter();
+		} while (TIM4_GetFlagStatus(TIM4_FLAG_Update) != RESET);
+	}
+
+	// With no timer started the counter keeps running for the system time.
+	// In u32 throughout, the products pass the 16 bit int of IAR.
+	delta = (m_timer_queue_head != TIMER_INDEX_NONE) ? m_timer_manager[m_timer_queue_head].timer_delta : TIMER_NO_EXPIRY;
+	if (delta > (u32)TIMER_HW_MAX_PERIOD * TIMER_HW_COUNT_FRACTION / TIMER_HW_TICK_FRACTION + 1)
+	{
+		period = TIMER_HW_MAX_PERIOD;
+	}
+	else
+	{
+		// Round up so the deadline is never reported early, and clamp
+		// before the counts are narrowed.
+		counts = (delta * TIMER_HW_TICK_FRACTION - m_timer_hw_fraction +
+		          TIMER_HW_COUNT_FRACTION - 1) / TIMER_HW_COUNT_FRACTION + m_timer_hw_base;
+		period = (counts > TIMER_HW_MAX_PERIOD) ? TIMER_HW_MAX_PERIOD : (u16)counts;
+	}
+
+	if (m_timer_hw_running == TRUE)
+	{
+		// Keep the autoreload ahead of the running counter.
+		if (period < counter + 2)
+		{
+			period = counter + 2;
 		}
+		if (period > TIMER_HW_MAX_PERIOD)
+		{
+			period = TIMER_HW_MAX_PERIOD;
+		}
+	}
+
+	m_timer_hw_period = period;
+	TIM4_SetAutoreload((u8)(period - 1));
+	if (m_timer_hw_running == FALSE)
+	{
+		m_timer_hw_running = TRUE;
+		TIM4_Cmd(ENABLE);
+	}
+}
+#endif
+
+static void timer_start_interval(u8 timer_index, u32 duration, u32 interval)
+{
+	// The queue is shared with the TIM4 interrupt.
+	disableInterrupts();
+#ifdef TIMER_TICKLESS
+	timer_hw_sync();
+#endif
+	// A restart also drops a handler that has not run yet.
+	m_timer_manager[timer_index].timer_expired = FALSE;
+	m_timer_manager[timer_index].timer_interval = interval;
+#ifdef TIMER_STATS
+	m_timer_stats[timer_index].start_count ++;
+#endif
+	if (m_timer_manager[timer_index].timer_started == TRUE)
+	{
+		timer_queue_remove(timer_index);
+	}
+	if (duration == 0)
+	{
+		// The earliest a timer can expire is the next tick.
+		duration = 1;
 	}
+	timer_queue_insert(timer_index, duration);
+#ifdef TIMER_TICKLESS
+	timer_hw_program();
+#endif
+	enableInterrupts();
+}
+
+void timer_start(u8 timer_index, u32 duration)
+{
+	timer_start_interval(timer_index, duration, 0);
+}
+
+void timer_start_periodic(u8 timer_index, u32 phase, u32 interval)
+{
+	if (interval == 0)
+	{
+		interval = 1;
+	}
+	timer_start_interval(timer_index, phase, interval);
+}
+
+void timer_stop(u8 timer_index)
+{
+	disableInterrupts();
+#ifdef TIMER_TICKLESS
+	timer_hw_sync();
+#endif
+	m_timer_manager[timer_index].timer_expired = FALSE;
+	if (m_timer_manager[timer_index].timer_started == TRUE)
+	{
+		timer_queue_remove(timer_index);
+	}
+#ifdef TIMER_TICKLESS
+	// The sync may have taken over the update, so always aim the next one.
+	timer_hw_program();
+#endif
+	enableInterrupts();
+}
+
+void timer_fire(u8 timer_index)
+{
+	m_timer_manager[timer_index].timer_expired = TRUE;
+	m_timer_dispatch_due = TRUE;
+	timer_dispatch_post();
+}
+
+u32 timer_next_expiry(void)
+{
+	u32 ticks = TIMER_NO_EXPIRY;
+
+	disableInterrupts();
+#ifdef TIMER_TICKLESS
+	// The queue is only advanced at the update interrupt, so it can be up to
+	// a whole TIM4 period behind.
+	timer_hw_sync();
+	timer_hw_program();
+#endif
+	// The caller is about to sleep, a dispatch still waiting for room in
+	// the event queue goes in first.
+	timer_dispatch_post();
+	if (m_timer_queue_head != TIMER_INDEX_NONE)
+	{
+		ticks = m_timer_manager[m_timer_queue_head].timer_delta;
+	}
+	enableInterrupts();
+	return ticks;
+}
+
+void timer_resume(u32 elapsed_ticks)
+{
+	disableInterrupts();
+#ifdef TIMER_TICKLESS
+	timer_hw_sync();
+#endif
+	timer_queue_advance(elapsed_ticks);
+#ifdef TIMER_TICKLESS
+	timer_hw_program();
+#endif
+	enableInterrupts();
+}
+
+void timer_set_sysclk_div(CLK_SYSCLKDiv_TypeDef div)
+{
+	u8 counter = TIM4_GetCounter();
+
+	m_timer_sysclk_div = div;
+	// Loading the prescaler restarts the counter, put it back where it was.
+	// Only the prescaler fraction of one count is lost.
+	TIM4_UpdateRequestConfig(TIM4_UpdateSource_Regular);
+	TIM4_PrescalerConfig((TIM4_Prescaler_TypeDef)(TIMER_HW_PRESCALER - div), TIM4_PSCReloadMode_Immediate);
+	TIM4_SetCounter(counter);
+	TIM4_UpdateRequestConfig(TIM4_UpdateSource_Global);
+}
+
+void tick_timeout_handler(void)
+{
+#ifdef TIMER_TICKLESS
+	// The interrupt clears the update flag first, so a flag seen from here
+	// on is a new period.
+	u16 counts = m_timer_hw_period - m_timer_hw_base;
+
+	m_timer_hw_base = 0;
+	sys_time_account(counts, 0);
+	timer_hw_account(counts);
+	timer_hw_program();
+#else
+	timer_queue_advance(1);
+#endif
+}
+
+#ifdef TIMER_STATS
+void timer_get_stats(u8 timer_index, timer_stats_t *p_stats)
+{
+	disableInterrupts();
+	*p_stats = m_timer_stats[timer_index];
+	enableInterrupts();
+}
+
+void timer_get_isr_stats(u32 *p_isr_count, u32 *p_isr_cycles)
+{
+	disableInterrupts();
+	*p_isr_count = m_timer_stats_isr_count;
+	*p_isr_cycles = m_timer_stats_isr_cycles;
+	enableInterrupts();
+}
+
+void timer_isr_enter(void)
+{
+	m_timer_stats_isr_start = event_cycles();
+}
+
+void timer_isr_exit(void)
+{
+	m_timer_stats_isr_count ++;
+	m_timer_stats_isr_cycles += event_cycles() - m_timer_stats_isr_start;
 }
+#endif
@@ -0,0 +1,1629 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stm8l15x.h"
+#include "stm8l15x_exti.h"
+#include "stm8l15x_flash.h"
+#include "stm8l15x_rtc.h"
+#include "stm8l15x_tim1.h"
+#include "stm8l15x_tim2.h"
+#include "stm8l15x_tim3.h"
+#include "stm8l15x_tim4.h"
+
+#include "event.h"
+#include "host.h"
+
+/*
+	Time is kept in ps, a count of the 16 MHz HSI is 62500 ps. The model
+	steps from one timer update to the next, so an interrupt is delivered
+	at the time its flag is set, and the firmware sees the registers as
+	the hardware leaves them there. Halt stops the timers, the RTC on
+	LSI and the pin edges scheduled ahead go on.
+*/
+#define HOST_HSI_PS            62500ULL
+#define HOST_PS_PER_S          1000000000000ULL
+#define HOST_NEVER             (~0ULL)
+#define HOST_STORM_LIMIT       100000   // Interrupts in a row with the time standing still.
+#define HOST_LSI_NOMINAL_HZ    38000
+#define HOST_EDGES_MAX         32
+
+u8 host_register[0x8000];
+host_vector_t host_vector[HOST_VECTOR_NUMBER];
+void (*host_wfi_hook)(void) = NULL;
+void (*host_tim4_read_hook)(void) = NULL;
+void (*host_oc1_hook)(TIM_TypeDef *tim, bool is_high) = NULL;
+u32 host_lsi_hz = HOST_LSI_NOMINAL_HZ;
+
+u8  host_eeprom[HOST_EEPROM_SIZE];
+u32 host_eeprom_writes[HOST_EEPROM_SIZE];
+
+static unsigned long long m_host_now_ps = 0;
+static bool m_host_is_enabled = TRUE;
+static bool m_host_is_in_isr = FALSE;
+static bool m_host_is_halted = FALSE;
+static u32  m_host_storm = 0;
+
+static u8  m_host_exti_pending = 0;        // EXTI0 to EXTI7, SR1 is write 1 to clear.
+static u8  m_host_exti_port_pending = 0;   // Port lines as in SR2, write 1 to clear too.
+
+/* Prescalers in use, PSCR is only loaded on an update event */
+static u8  m_host_tim4_psc = 0;
+static u16 m_host_tim1_psc = 0;
+static unsigned long long m_host_tim4_ps = 0;   // Time into the current count.
+static unsigned long long m_host_tim4_dropped_ps = 0;
+static unsigned long long m_host_tim1_ps = 0;
+
+/* LSI clocks since host_reset() at which the calendar started and the
+   wakeup timer flags next */
+static bool m_host_rtc_is_running = FALSE;
+static unsigned long long m_host_rtc_start_clock = 0;
+static unsigned long long m_host_wakeup_clock = 0;
+
+/* Pin edges ahead, in the order of their time. A NULL port is a key of
+   the matrix, pins is then its row * 8 + column */
+typedef struct host_edge_s
+{
+	unsigned long long at_ps;
+	GPIO_TypeDef *port;
+	u8 pins;
+	bool is_high;
+} host_edge_t;
+
+static host_edge_t m_host_edge[HOST_EDGES_MAX];
+static u8 m_host_edge_count = 0;
+
+/* Key matrix, the columns down of each row */
+static GPIO_TypeDef *m_host_matrix_row_port = NULL;
+static GPIO_TypeDef *m_host_matrix_col_port = NULL;
+static u8 m_host_matrix_rows = 0;
+static u8 m_host_matrix_cols = 0;
+static u8 m_host_matrix_key[8];
+
+static u32 m_host_eeprom_operations = 0;
+static u32 m_host_eeprom_fail_at = 0;
+static jmp_buf *m_host_eeprom_env = NULL;
+static u32 m_host_eeprom_seed = 1;
+
+
+static void host_advance_ps(unsigned long long ps);
+
+static void host_fatal(const char *p_message)
+{
+	fprintf(stderr, "host: %s at %llu us\n", p_message, m_host_now_ps / 1000000ULL);
+	abort();
+}
+
+static unsigned long long host_sysclk_ps(void)
+{
+	return HOST_HSI_PS << (CLK->CKDIVR & 0x07);
+}
+
+/* TIM4 --------------------------------------------------------------------*/
+
+static unsigned long long host_tim4_count_ps(void)
+{
+	return host_sysclk_ps() << m_host_tim4_psc;
+}
+
+static void host_tim4_update_event(bool is_flagged)
+{
+	TIM4->CNTR = 0;
+	m_host_tim4_psc = (u8)(TIM4->PSCR & 0x0F);
+	m_host_tim4_ps = 0;
+	if (is_flagged == TRUE)
+	{
+		TIM4->SR1 |= TIM4_SR1_UIF;
+	}
+}
+
+static unsigned long long host_tim4_next_ps(void)
+{
+	u16 counts;
+
+	if (((TIM4->CR1 & TIM4_CR1_CEN) == 0) || (m_host_is_halted == TRUE))
+	{
+		return HOST_NEVER;
+	}
+	// Past ARR the counter runs up to 0xFF and wraps without an update.
+	counts = (TIM4->CNTR <= TIM4->ARR) ? (u16)(TIM4->ARR - TIM4->CNTR + 1) : (u16)(0x100 - TIM4->CNTR);
+	return counts * host_tim4_count_ps() - m_host_tim4_ps;
+}
+
+static void host_tim4_step(unsigned long long step_ps)
+{
+	unsigned long long count_ps = host_tim4_count_ps();
+	u32 counts;
+
+	if (((TIM4->CR1 & TIM4_CR1_CEN) == 0) || (m_host_is_halted == TRUE))
+	{
+		return;
+	}
+	m_host_tim4_ps += step_ps;
+	counts = (u32)(m_host_tim4_ps / count_ps);
+	m_host_tim4_ps %= count_ps;
+	if (counts == 0)
+	{
+		return;
+	}
+	// The step never passes the next update.
+	if ((TIM4->CNTR <= TIM4->ARR) && ((u32)TIM4->CNTR + counts > TIM4->ARR))
+	{
+		host_tim4_update_event(TRUE);
+		if ((TIM4->CR1 & TIM4_CR1_OPM) != 0)
+		{
+			TIM4->CR1 &= (u8)~TIM4_CR1_CEN;
+		}
+	}
+	else
+	{
+		TIM4->CNTR = (u8)(TIM4->CNTR + counts);
+	}
+}
+
+void TIM4_DeInit(void)
+{
+	TIM4->CR1 = TIM4_CR1_RESET_VALUE;
+	TIM4->CR2 = TIM4_CR2_RESET_VALUE;
+	TIM4->SMCR = TIM4_SMCR_RESET_VALUE;
+	TIM4->IER = TIM4_IER_RESET_VALUE;
+	TIM4->CNTR = TIM4_CNTR_RESET_VALUE;
+	TIM4->PSCR = TIM4_PSCR_RESET_VALUE;
+	TIM4->ARR = TIM4_ARR_RESET_VALUE;
+	TIM4->SR1 = TIM4_SR1_RESET_VALUE;
+	m_host_tim4_psc = 0;
+	m_host_tim4_ps = 0;
+}
+
+void TIM4_TimeBaseInit(TIM4_Prescaler_TypeDef TIM4_Prescaler, uint8_t TIM4_Period)
+{
+	TIM4->ARR = TIM4_Period;
+	TIM4->PSCR = (u8)TIM4_Prescaler;
+	m_host_tim4_dropped_ps += m_host_tim4_ps;
+	host_tim4_update_event(((TIM4->CR1 & TIM4_CR1_URS) == 0) ? TRUE : FALSE);
+}
+
+void TIM4_PrescalerConfig(TIM4_Prescaler_TypeDef Prescaler, TIM4_PSCReloadMode_TypeDef TIM4_PSCReloadMode)
+{
+	TIM4->PSCR = (u8)Prescaler;
+	if (TIM4_PSCReloadMode == TIM4_PSCReloadMode_Immediate)
+	{
+		// The prescaler counter restarts, the time into the count is lost.
+		m_host_tim4_dropped_ps += m_host_tim4_ps;
+		host_tim4_update_event(((TIM4->CR1 & TIM4_CR1_URS) == 0) ? TRUE : FALSE);
+	}
+}
+
+void TIM4_Cmd(FunctionalState NewState)
+{
+	if (NewState != DISABLE)
+	{
+		TIM4->CR1 |= TIM4_CR1_CEN;
+	}
+	else
+	{
+		TIM4->CR1 &= (u8)~TIM4_CR1_CEN;
+	}
+}
+
+void TIM4_UpdateRequestConfig(TIM4_UpdateSource_TypeDef TIM4_UpdateSource)
+{
+	if (TIM4_UpdateSource != TIM4_UpdateSource_Global)
+	{
+		TIM4->CR1 |= TIM4_CR1_URS;
+	}
+	else
+	{
+		TIM4->CR1 &= (u8)~TIM4_CR1_URS;
+	}
+}
+
+void TIM4_SelectOnePulseMode(TIM4_OPMode_TypeDef TIM4_OPMode)
+{
+	if (TIM4_OPMode != TIM4_OPMode_Repetitive)
+	{
+		TIM4->CR1 |= TIM4_CR1_OPM;
+	}
+	else
+	{
+		TIM4->CR1 &= (u8)~TIM4_CR1_OPM;
+	}
+}
+
+void TIM4_SetCounter(uint8_t Counter)
+{
+	TIM4->CNTR = Counter;
+}
+
+void TIM4_SetAutoreload(uint8_t Autoreload)
+{
+	TIM4->ARR = Autoreload;
+}
+
+uint8_t TIM4_GetCounter(void)
+{
+	if (host_tim4_read_hook != NULL)
+	{
+		host_tim4_read_hook();
+	}
+	return TIM4->CNTR;
+}
+
+void TIM4_ITConfig(TIM4_IT_TypeDef TIM4_IT, FunctionalState NewState)
+{
+	if (NewState != DISABLE)
+	{
+		TIM4->IER |= (u8)TIM4_IT;
+	}
+	else
+	{
+		TIM4->IER &= (u8)~(u8)TIM4_IT;
+	}
+}
+
+FlagStatus TIM4_GetFlagStatus(TIM4_FLAG_TypeDef TIM4_FLAG)
+{
+	return ((TIM4->SR1 & (u8)TIM4_FLAG) != 0) ? SET : RESET;
+}
+
+void TIM4_ClearFlag(TIM4_FLAG_TypeDef TIM4_FLAG)
+{
+	TIM4->SR1 &= (u8)~(u8)TIM4_FLAG;
+}
+
+ITStatus TIM4_GetITStatus(TIM4_IT_TypeDef TIM4_IT)
+{
+	return (((TIM4->SR1 & (u8)TIM4_IT) != 0) && ((TIM4->IER & (u8)TIM4_IT) != 0)) ? SET : RESET;
+}
+
+void TIM4_ClearITPendingBit(TIM4_IT_TypeDef TIM4_IT)
+{
+	TIM4->SR1 &= (u8)~(u8)TIM4_IT;
+}
+
+/* TIM1 --------------------------------------------------------------------*/
+
+static u16 host_tim1_counter(void)
+{
+	return (u16)(((u16)TIM1->CNTRH << 8) | TIM1->CNTRL);
+}
+
+static void host_tim1_set_counter(u16 counter)
+{
+	TIM1->CNTRH = (u8)(counter >> 8);
+	TIM1->CNTRL = (u8)counter;
+}
+
+static u16 host_tim1_autoreload(void)
+{
+	return (u16)(((u16)TIM1->ARRH << 8) | TIM1->ARRL);
+}
+
+static unsigned long long host_tim1_count_ps(void)
+{
+	return host_sysclk_ps() * ((unsigned long long)m_host_tim1_psc + 1);
+}
+
+static void host_tim1_update_event(bool is_flagged)
+{
+	host_tim1_set_counter(0);
+	m_host_tim1_psc = (u16)(((u16)TIM1->PSCRH << 8) | TIM1->PSCRL);
+	m_host_tim1_ps = 0;
+	if (is_flagged == TRUE)
+	{
+		TIM1->SR1 |= TIM1_SR1_UIF;
+	}
+}
+
+static unsigned long long host_tim1_next_ps(void)
+{
+	u32 counts;
+	u16 counter = host_tim1_counter();
+	u16 autoreload = host_tim1_autoreload();
+
+	if (((TIM1->CR1 & TIM1_CR1_CEN) == 0) || (m_host_is_halted == TRUE))
+	{
+		return HOST_NEVER;
+	}
+	counts = (counter <= autoreload) ? (u32)(autoreload - counter + 1) : (u32)(0x10000 - counter);
+	return counts * host_tim1_count_ps() - m_host_tim1_ps;
+}
+
+static void host_tim1_step(unsigned long long step_ps)
+{
+	unsigned long long count_ps = host_tim1_count_ps();
+	u32 counts;
+	u16 counter = host_tim1_counter();
+	u16 autoreload = host_tim1_autoreload();
+
+	if (((TIM1->CR1 & TIM1_CR1_CEN) == 0) || (m_host_is_halted == TRUE))
+	{
+		return;
+	}
+	m_host_tim1_ps += step_ps;
+	counts = (u32)(m_host_tim1_ps / count_ps);
+	m_host_tim1_ps %= count_ps;
+	if (counts == 0)
+	{
+		return;
+	}
+	if ((counter <= autoreload) && ((u32)counter + counts > autoreload))
+	{
+		host_tim1_update_event(TRUE);
+		if ((TIM1->CR1 & TIM1_CR1_OPM) != 0)
+		{
+			TIM1->CR1 &= (u8)~TIM1_CR1_CEN;
+		}
+	}
+	else
+	{
+		host_tim1_set_counter((u16)(counter + counts));
+	}
+}
+
+void TIM1_DeInit(void)
+{
+	TIM1->CR1 = TIM1_CR1_RESET_VALUE;
+	TIM1->IER = TIM1_IER_RESET_VALUE;
+	TIM1->CNTRH = TIM1_CNTRH_RESET_VALUE;
+	TIM1->CNTRL = TIM1_CNTRL_RESET_VALUE;
+	TIM1->PSCRH = TIM1_PSCRH_RESET_VALUE;
+	TIM1->PSCRL = TIM1_PSCRL_RESET_VALUE;
+	TIM1->ARRH = TIM1_ARRH_RESET_VALUE;
+	TIM1->ARRL = TIM1_ARRL_RESET_VALUE;
+	host_tim1_update_event(FALSE);
+	TIM1->SR1 = TIM1_SR1_RESET_VALUE;
+}
+
+void TIM1_TimeBaseInit(uint16_t TIM1_Prescaler, TIM1_CounterMode_TypeDef TIM1_CounterMode,
+                       uint16_t TIM1_Period, uint8_t TIM1_RepetitionCounter)
+{
+	// Only counting up, and the prescaler waits for the next update as on the chip.
+	TIM1->ARRH = (u8)(TIM1_Period >> 8);
+	TIM1->ARRL = (u8)TIM1_Period;
+	TIM1->PSCRH = (u8)(TIM1_Prescaler >> 8);
+	TIM1->PSCRL = (u8)TIM1_Prescaler;
+}
+
+void TIM1_PrescalerConfig(uint16_t Prescaler, TIM1_PSCReloadMode_TypeDef TIM1_PSCReloadMode)
+{
+	TIM1->PSCRH = (u8)(Prescaler >> 8);
+	TIM1->PSCRL = (u8)Prescaler;
+	if (TIM1_PSCReloadMode == TIM1_PSCReloadMode_Immediate)
+	{
+		host_tim1_update_event(((TIM1->CR1 & TIM1_CR1_URS) == 0) ? TRUE : FALSE);
+	}
+}
+
+void TIM1_Cmd(FunctionalState NewState)
+{
+	if (NewState != DISABLE)
+	{
+		TIM1->CR1 |= TIM1_CR1_CEN;
+	}
+	else
+	{
+		TIM1->CR1 &= (u8)~TIM1_CR1_CEN;
+	}
+}
+
+void TIM1_UpdateRequestConfig(TIM1_UpdateSource_TypeDef TIM1_UpdateSource)
+{
+	if (TIM1_UpdateSource != TIM1_UpdateSource_Global)
+	{
+		TIM1->CR1 |= TIM1_CR1_URS;
+	}
+	else
+	{
+		TIM1->CR1 &= (u8)~TIM1_CR1_URS;
+	}
+}
+
+void TIM1_SelectOnePulseMode(TIM1_OPMode_TypeDef TIM1_OPMode)
+{
+	if (TIM1_OPMode != TIM1_OPMode_Repetitive)
+	{
+		TIM1->CR1 |= TIM1_CR1_OPM;
+	}
+	else
+	{
+		TIM1->CR1 &= (u8)~TIM1_CR1_OPM;
+	}
+}
+
+void TIM1_SetCounter(uint16_t Counter)
+{
+	host_tim1_set_counter(Counter);
+}
+
+void TIM1_SetAutoreload(uint16_t Autoreload)
+{
+	TIM1->ARRH = (u8)(Autoreload >> 8);
+	TIM1->ARRL = (u8)Autoreload;
+}
+
+/* Firmware polling a running TIM1 spends a count per read */
+uint16_t TIM1_GetCounter(void)
+{
+	u16 counter = host_tim1_counter();
+
+	if ((TIM1->CR1 & TIM1_CR1_CEN) != 0)
+	{
+		host_advance_ps(host_tim1_count_ps());
+	}
+	return counter;
+}
+
+void TIM1_ITConfig(TIM1_IT_TypeDef TIM1_IT, FunctionalState NewState)
+{
+	if (NewState != DISABLE)
+	{
+		TIM1->IER |= (u8)TIM1_IT;
+	}
+	else
+	{
+		TIM1->IER &= (u8)~(u8)TIM1_IT;
+	}
+}
+
+/* A busy wait on the update flag lets the time run up to the update */
+FlagStatus TIM1_GetFlagStatus(TIM1_FLAG_TypeDef TIM1_FLAG)
+{
+	if (((TIM1->SR1 & (u8)TIM1_FLAG) == 0) && ((TIM1->CR1 & TIM1_CR1_CEN) != 0))
+	{
+		host_advance_ps(host_tim1_next_ps());
+	}
+	return ((TIM1->SR1 & (u8)TIM1_FLAG) != 0) ? SET : RESET;
+}
+
+void TIM1_ClearFlag(TIM1_FLAG_TypeDef TIM1_FLAG)
+{
+	TIM1->SR1 &= (u8)~(u8)TIM1_FLAG;
+	TIM1->SR2 &= (u8)~(u8)((u16)TIM1_FLAG >> 8);
+}
+
+void TIM1_ClearITPendingBit(TIM1_IT_TypeDef TIM1_IT)
+{
+	TIM1->SR1 &= (u8)~(u8)TIM1_IT;
+}
+
+/* TIM2 and TIM3 -----------------------------------------------------------*/
+
+/*
+	Counting up only, with channel 1 as an output compare in PWM mode 1 or
+	2 driving the pin of the part: PB0 for TIM2, PB1 for TIM3. The counter
+	needs its clock in CLK->PCKENR1. The output is low with CC1E clear and
+	at the idle level of OIS1 with MOE clear. The model steps to every
+	compare match as well as to the update, so the pin changes at its time.
+*/
+typedef struct host_tim_s
+{
+	TIM_TypeDef *tim;
+	u8   clock;          // Bit of CLK->PCKENR1.
+	GPIO_TypeDef *port;  // Pin of the channel 1 output.
+	u8   pin;
+	u8   psc;            // Prescaler in use, PSCR is only loaded on an update event.
+	unsigned long long ps;
+	bool is_high;
+} host_tim_t;
+
+static host_tim_t m_host_tim[] =
+{
+	{TIM2, CLK_PCKENR1_TIM2, GPIOB, GPIO_Pin_0, 0, 0, FALSE},
+	{TIM3, CLK_PCKENR1_TIM3, GPIOB, GPIO_Pin_1, 0, 0, FALSE}
+};
+
+#define HOST_TIM_NUMBER    (sizeof(m_host_tim) / sizeof(m_host_tim[0]))
+
+static host_tim_t *host_tim(TIM_TypeDef *tim)
+{
+	return (tim == TIM2) ? &m_host_tim[0] : &m_host_tim[1];
+}
+
+static u16 host_tim_counter(const host_tim_t *p_tim)
+{
+	return (u16)(((u16)p_tim->tim->CNTRH << 8) | p_tim->tim->CNTRL);
+}
+
+static void host_tim_set_counter(host_tim_t *p_tim, u16 counter)
+{
+	p_tim->tim->CNTRH = (u8)(counter >> 8);
+	p_tim->tim->CNTRL = (u8)counter;
+}
+
+static u16 host_tim_autoreload(const host_tim_t *p_tim)
+{
+	return (u16)(((u16)p_tim->tim->ARRH << 8) | p_tim->tim->ARRL);
+}
+
+static u16 host_tim_compare(const host_tim_t *p_tim)
+{
+	return (u16)(((u16)p_tim->tim->CCR1H << 8) | p_tim->tim->CCR1L);
+}
+
+static unsigned long long host_tim_count_ps(const host_tim_t *p_tim)
+{
+	return host_sysclk_ps() << p_tim->psc;
+}
+
+static bool host_tim_is_running(const host_tim_t *p_tim)
+{
+	return (((p_tim->tim->CR1 & TIM_CR1_CEN) != 0) && ((CLK->PCKENR1 & p_tim->clock) != 0) &&
+	        (m_host_is_halted == FALSE)) ? TRUE : FALSE;
+}
+
+/* Drives the pin from the registers and the counter as they are now */
+static void host_tim_output(host_tim_t *p_tim)
+{
+	TIM_TypeDef *tim = p_tim->tim;
+	u8 mode = (u8)(tim->CCMR1 & TIM_CCMR_OCM);
+	bool is_below = (host_tim_counter(p_tim) < host_tim_compare(p_tim)) ? TRUE : FALSE;
+	bool is_high = FALSE;
+
+	if ((tim->CCER1 & TIM_CCER1_CC1E) == 0)
+	{
+		is_high = FALSE;
+	}
+	else if ((tim->BKR & TIM_BKR_MOE) == 0)
+	{
+		is_high = ((tim->OISR & TIM_OISR_OIS1) != 0) ? TRUE : FALSE;
+	}
+	else
+	{
+		if (mode == TIM2_OCMode_PWM1)
+		{
+			is_high = is_below;
+		}
+		else if (mode == TIM2_OCMode_PWM2)
+		{
+			is_high = (is_below == TRUE) ? FALSE : TRUE;
+		}
+		if ((tim->CCER1 & TIM_CCER1_CC1P) != 0)
+		{
+			is_high = (is_high == TRUE) ? FALSE : TRUE;
+		}
+	}
+	if (is_high == p_tim->is_high)
+	{
+		return;
+	}
+	p_tim->is_high = is_high;
+	p_tim->port->IDR = (is_high == TRUE) ? (u8)(p_tim->port->IDR | p_tim->pin) : (u8)(p_tim->port->IDR & (u8)~p_tim->pin);
+	if (host_oc1_hook != NULL)
+	{
+		host_oc1_hook(tim, is_high);
+	}
+}
+
+static void host_tim_update_event(host_tim_t *p_tim, bool is_flagged)
+{
+	host_tim_set_counter(p_tim, 0);
+	p_tim->psc = (u8)(p_tim->tim->PSCR & 0x07);
+	p_tim->ps = 0;
+	if (is_flagged == TRUE)
+	{
+		p_tim->tim->SR1 |= TIM_SR1_UIF;
+	}
+}
+
+/* To the next compare match or update */
+static unsigned long long host_tim_next_ps(const host_tim_t *p_tim)
+{
+	u32 counts;
+	u16 counter = host_tim_counter(p_tim);
+	u16 autoreload = host_tim_autoreload(p_tim);
+	u16 compare = host_tim_compare(p_tim);
+
+	if (host_tim_is_running(p_tim) == FALSE)
+	{
+		return HOST_NEVER;
+	}
+	counts = (counter <= autoreload) ? (u32)(autoreload - counter + 1) : (u32)(0x10000 - counter);
+	if ((counter < compare) && ((u32)(compare - counter) < counts))
+	{
+		counts = (u32)(compare - counter);
+	}
+	return counts * host_tim_count_ps(p_tim) - p_tim->ps;
+}
+
+static void host_tim_step(host_tim_t *p_tim, unsigned long long step_ps)
+{
+	unsigned long long count_ps = host_tim_count_ps(p_tim);
+	u32 counts;
+	u16 counter = host_tim_counter(p_tim);
+	u16 autoreload = host_tim_autoreload(p_tim);
+
+	if (host_tim_is_running(p_tim) == FALSE)
+	{
+		return;
+	}
+	p_tim->ps += step_ps;
+	counts = (u32)(p_tim->ps / count_ps);
+	p_tim->ps %= count_ps;
+	if (counts == 0)
+	{
+		return;
+	}
+	if ((counter <= autoreload) && ((u32)counter + counts > autoreload))
+	{
+		host_tim_update_event(p_tim, TRUE);
+		if ((p_tim->tim->CR1 & TIM_CR1_OPM) != 0)
+		{
+			p_tim->tim->CR1 &= (u8)~TIM_CR1_CEN;
+		}
+	}
+	else
+	{
+		host_tim_set_counter(p_tim, (u16)(counter + counts));
+	}
+	host_tim_output(p_tim);
+}
+
+static void host_tim_deinit(host_tim_t *p_tim)
+{
+	TIM_TypeDef *tim = p_tim->tim;
+
+	tim->CR1 = TIM_CR1_RESET_VALUE;
+	tim->IER = TIM_IER_RESET_VALUE;
+	tim->CCMR1 = TIM_CCMR1_RESET_VALUE;
+	tim->CCER1 = TIM_CCER1_RESET_VALUE;
+	tim->PSCR = TIM_PSCR_RESET_VALUE;
+	tim->ARRH = TIM_ARRH_RESET_VALUE;
+	tim->ARRL = TIM_ARRL_RESET_VALUE;
+	tim->CCR1H = TIM_CCR1H_RESET_VALUE;
+	tim->CCR1L = TIM_CCR1L_RESET_VALUE;
+	tim->OISR = TIM_OISR_RESET_VALUE;
+	tim->BKR = TIM_BKR_RESET_VALUE;
+	// The driver generates an update, then clears the flags.
+	host_tim_update_event(p_tim, FALSE);
+	tim->SR1 = TIM_SR1_RESET_VALUE;
+	host_tim_output(p_tim);
+}
+
+/* As the driver, with an update event that loads the prescaler at once */
+static void host_tim_time_base_init(host_tim_t *p_tim, u8 prescaler, u16 period)
+{
+	p_tim->tim->ARRH = (u8)(period >> 8);
+	p_tim->tim->ARRL = (u8)period;
+	p_tim->tim->PSCR = prescaler;
+	host_tim_update_event(p_tim, ((p_tim->tim->CR1 & TIM_CR1_URS) == 0) ? TRUE : FALSE);
+	host_tim_output(p_tim);
+}
+
+static void host_tim_oc1_init(host_tim_t *p_tim, u8 mode, bool is_enabled, u16 pulse, bool is_low, bool is_idle_set)
+{
+	TIM_TypeDef *tim = p_tim->tim;
+
+	tim->CCMR1 = (u8)((tim->CCMR1 & (u8)~TIM_CCMR_OCM) | mode);
+	tim->CCER1 = (u8)((tim->CCER1 & (u8)~(TIM_CCER1_CC1E | TIM_CCER1_CC1P)) |
+	                  ((is_enabled == TRUE) ? TIM_CCER1_CC1E : 0) | ((is_low == TRUE) ? TIM_CCER1_CC1P : 0));
+	tim->OISR = (u8)((tim->OISR & (u8)~TIM_OISR_OIS1) | ((is_idle_set == TRUE) ? TIM_OISR_OIS1 : 0));
+	tim->CCR1H = (u8)(pulse >> 8);
+	tim->CCR1L = (u8)pulse;
+	host_tim_output(p_tim);
+}
+
+static void host_tim_cr1(host_tim_t *p_tim, u8 mask, bool is_set)
+{
+	p_tim->tim->CR1 = (is_set == TRUE) ? (u8)(p_tim->tim->CR1 | mask) : (u8)(p_tim->tim->CR1 & (u8)~mask);
+}
+
+static void host_tim_moe(host_tim_t *p_tim, bool is_set)
+{
+	p_tim->tim->BKR = (is_set == TRUE) ? (u8)(p_tim->tim->BKR | TIM_BKR_MOE) : (u8)(p_tim->tim->BKR & (u8)~TIM_BKR_MOE);
+	host_tim_output(p_tim);
+}
+
+static void host_tim_it_config(host_tim_t *p_tim, u8 it, bool is_set)
+{
+	p_tim->tim->IER = (is_set == TRUE) ? (u8)(p_tim->tim->IER | it) : (u8)(p_tim->tim->IER & (u8)~it);
+}
+
+/* The flags are cleared by writing 0, a 1 leaves them */
+static void host_tim_clear_flag(host_tim_t *p_tim, u16 flag)
+{
+	p_tim->tim->SR1 &= (u8)~(u8)flag;
+	p_tim->tim->SR2 &= (u8)~(u8)(flag >> 8);
+}
+
+/* The driver calls of pulse.c and stm8l15x_it.c, for either timer */
+#define HOST_TIM_DRIVER(TIMx) \
+	void TIMx##_DeInit(void) \
+	{ \
+		host_tim_deinit(host_tim(TIMx)); \
+	} \
+	void TIMx##_TimeBaseInit(TIMx##_Prescaler_TypeDef Prescaler, TIMx##_CounterMode_TypeDef CounterMode, \
+	                         uint16_t Period) \
+	{ \
+		host_tim_time_base_init(host_tim(TIMx), (u8)Prescaler, Period); \
+	} \
+	void TIMx##_OC1Init(TIMx##_OCMode_TypeDef OCMode, TIMx##_OutputState_TypeDef OutputState, uint16_t Pulse, \
+	                    TIMx##_OCPolarity_TypeDef OCPolarity, TIMx##_OCIdleState_TypeDef OCIdleState) \
+	{ \
+		host_tim_oc1_init(host_tim(TIMx), (u8)OCMode, (OutputState == TIMx##_OutputState_Enable) ? TRUE : FALSE, Pulse, \
+		                  (OCPolarity == TIMx##_OCPolarity_Low) ? TRUE : FALSE, \
+		                  (OCIdleState == TIMx##_OCIdleState_Set) ? TRUE : FALSE); \
+	} \
+	void TIMx##_SelectOnePulseMode(TIMx##_OPMode_TypeDef OPMode) \
+	{ \
+		host_tim_cr1(host_tim(TIMx), TIM_CR1_OPM, (OPMode == TIMx##_OPMode_Single) ? TRUE : FALSE); \
+	} \
+	void TIMx##_Cmd(FunctionalState NewState) \
+	{ \
+		host_tim_cr1(host_tim(TIMx), TIM_CR1_CEN, (NewState != DISABLE) ? TRUE : FALSE); \
+	} \
+	void TIMx##_CtrlPWMOutputs(FunctionalState NewState) \
+	{ \
+		host_tim_moe(host_tim(TIMx), (NewState != DISABLE) ? TRUE : FALSE); \
+	} \
+	void TIMx##_ITConfig(TIMx##_IT_TypeDef IT, FunctionalState NewState) \
+	{ \
+		host_tim_it_config(host_tim(TIMx), (u8)IT, (NewState != DISABLE) ? TRUE : FALSE); \
+	} \
+	void TIMx##_ClearFlag(TIMx##_FLAG_TypeDef FLAG) \
+	{ \
+		host_tim_clear_flag(host_tim(TIMx), (u16)FLAG); \
+	} \
+	void TIMx##_ClearITPendingBit(TIMx##_IT_TypeDef IT) \
+	{ \
+		host_tim_clear_flag(host_tim(TIMx), (u16)IT); \
+	}
+
+HOST_TIM_DRIVER(TIM2)
+HOST_TIM_DRIVER(TIM3)
+
+/* RTC ---------------------------------------------------------------------*/
+
+/* RTCCLK is the LSI undivided, as idle.c sets it */
+static unsigned long long host_lsi_clocks(unsigned long long ps)
+{
+	return (unsigned long long)((unsigned __int128)ps * host_lsi_hz / HOST_PS_PER_S);
+}
+
+/* Time at which the LSI clock count reaches clocks */
+static unsigned long long host_lsi_clock_ps(unsigned long long clocks)
+{
+	return (unsigned long long)(((unsigned __int128)clocks * HOST_PS_PER_S + host_lsi_hz - 1) / host_lsi_hz);
+}
+
+static u8 host_byte_to_bcd(u32 value)
+{
+	return (u8)(((value / 10) << 4) | (value % 10));
+}
+
+static u32 host_wakeup_period_clocks(void)
+{
+	u8 clock_select = (u8)(RTC->CR1 & RTC_CR1_WUCKSEL);
+
+	if (clock_select > RTC_WakeUpClock_RTCCLK_Div2)
+	{
+		host_fatal("the wakeup timer only runs on RTCCLK/2 to RTCCLK/16 here");
+	}
+	return ((((u32)RTC->WUTRH << 8) | RTC->WUTRL) + 1) << (4 - clock_select);
+}
+
+static unsigned long long host_rtc_next_ps(void)
+{
+	if ((m_host_rtc_is_running == FALSE) || ((RTC->CR2 & RTC_CR2_WUTE) == 0))
+	{
+		return HOST_NEVER;
+	}
+	return host_lsi_clock_ps(m_host_wakeup_clock) - m_host_now_ps;
+}
+
+/* The calendar shadow registers follow at once, there is no sync delay */
+static void host_rtc_step(void)
+{
+	unsigned long long clocks = host_lsi_clocks(m_host_now_ps);
+	u32 synch_prediv = ((u32)RTC->SPRERH << 8) | RTC->SPRERL;
+	unsigned long long counts;
+	u32 seconds;
+
+	if (m_host_rtc_is_running == FALSE)
+	{
+		return;
+	}
+	counts = (clocks - m_host_rtc_start_clock) / ((u32)RTC->APRER + 1);
+	seconds = (u32)(counts / (synch_prediv + 1));
+	counts %= synch_prediv + 1;
+	RTC->SSRH = (u8)((synch_prediv - counts) >> 8);
+	RTC->SSRL = (u8)(synch_prediv - counts);
+	RTC->TR1 = host_byte_to_bcd(seconds % 60);
+	RTC->TR2 = host_byte_to_bcd(seconds / 60 % 60);
+	RTC->TR3 = host_byte_to_bcd(seconds / 3600 % 24);
+
+	if (((RTC->CR2 & RTC_CR2_WUTE) != 0) && (clocks >= m_host_wakeup_clock))
+	{
+		RTC->ISR2 |= RTC_ISR2_WUTF;
+		while (clocks >= m_host_wakeup_clock)
+		{
+			m_host_wakeup_clock += host_wakeup_period_clocks();
+		}
+	}
+}
+
+/* The calendar restarts at 00:00:00 */
+ErrorStatus RTC_Init(RTC_InitTypeDef* RTC_InitStruct)
+{
+	RTC->CR1 = (u8)((RTC->CR1 & (u8)~RTC_CR1_FMT) | (u8)RTC_InitStruct->RTC_HourFormat);
+	RTC->SPRERH = (u8)(RTC_InitStruct->RTC_SynchPrediv >> 8);
+	RTC->SPRERL = (u8)RTC_InitStruct->RTC_SynchPrediv;
+	RTC->APRER = (u8)RTC_InitStruct->RTC_AsynchPrediv;
+	m_host_rtc_is_running = TRUE;
+	m_host_rtc_start_clock = host_lsi_clocks(m_host_now_ps);
+	host_rtc_step();
+	return SUCCESS;
+}
+
+ErrorStatus RTC_WaitForSynchro(void)
+{
+	RTC->ISR1 |= RTC_ISR1_RSF;
+	return SUCCESS;
+}
+
+void RTC_WakeUpClockConfig(RTC_WakeUpClock_TypeDef RTC_WakeUpClock)
+{
+	RTC->CR2 &= (u8)~RTC_CR2_WUTE;
+	RTC->CR1 = (u8)((RTC->CR1 & (u8)~RTC_CR1_WUCKSEL) | (u8)RTC_WakeUpClock);
+}
+
+void RTC_SetWakeUpCounter(uint16_t RTC_WakeupCounter)
+{
+	RTC->CR2 &= (u8)~RTC_CR2_WUTE;
+	RTC->WUTRH = (u8)(RTC_WakeupCounter >> 8);
+	RTC->WUTRL = (u8)RTC_WakeupCounter;
+}
+
+/* The first flag is a full period after the enable */
+ErrorStatus RTC_WakeUpCmd(FunctionalState NewState)
+{
+	if (NewState != DISABLE)
+	{
+		RTC->CR2 |= RTC_CR2_WUTE;
+		m_host_wakeup_clock = host_lsi_clocks(m_host_now_ps) + host_wakeup_period_clocks();
+	}
+	else
+	{
+		RTC->CR2 &= (u8)~RTC_CR2_WUTE;
+		RTC->ISR1 |= RTC_ISR1_WUTWF;
+	}
+	return SUCCESS;
+}
+
+void RTC_ITConfig(RTC_IT_TypeDef RTC_IT, FunctionalState NewState)
+{
+	if (NewState != DISABLE)
+	{
+		RTC->CR2 |= (u8)((u16)RTC_IT & 0x00F0);
+	}
+	else
+	{
+		RTC->CR2 &= (u8)~(u8)((u16)RTC_IT & 0x00F0);
+	}
+}
+
+FlagStatus RTC_GetFlagStatus(RTC_Flag_TypeDef RTC_FLAG)
+{
+	u16 flags = (u16)(((u16)RTC->ISR1 << 8) | RTC->ISR2);
+
+	return ((flags & (u16)RTC_FLAG) != 0) ? SET : RESET;
+}
+
+void RTC_ClearFlag(RTC_Flag_TypeDef RTC_FLAG)
+{
+	RTC->ISR2 &= (u8)~(u8)RTC_FLAG;
+	RTC->ISR1 &= (u8)~(u8)((u16)RTC_FLAG >> 8);
+}
+
+void RTC_ClearITPendingBit(RTC_IT_TypeDef RTC_IT)
+{
+	RTC->ISR2 &= (u8)~(u8)((u16)RTC_IT >> 4);
+}
+
+/* Data EEPROM -------------------------------------------------------------*/
+
+static u32 host_eeprom_random(void)
+{
+	m_host_eeprom_seed = m_host_eeprom_seed * 1103515245UL + 12345UL;
+	return m_host_eeprom_seed >> 16;
+}
+
+static void host_eeprom_program(u32 address, const u8 *p_bytes, u16 length)
+{
+	u16 index;
+	u16 offset;
+
+	if ((address < FLASH_DATA_EEPROM_START_PHYSICAL_ADDRESS) ||
+	    (address + length - 1 > FLASH_DATA_EEPROM_END_PHYSICAL_ADDRESS))
+	{
+		host_fatal("EEPROM programmed out of range");
+	}
+	if ((FLASH->IAPSR & FLASH_IAPSR_DUL) == 0)
+	{
+		host_fatal("EEPROM programmed while locked");
+	}
+	offset = (u16)(address - FLASH_DATA_EEPROM_START_PHYSICAL_ADDRESS);
+	m_host_eeprom_operations ++;
+	for (index = 0; index < length; index ++)
+	{
+		host_eeprom_writes[offset + index] ++;
+	}
+	if ((m_host_eeprom_fail_at != 0) && (-- m_host_eeprom_fail_at == 0))
+	{
+		// The power went while the cells were half programmed.
+		for (index = 0; index < length; index ++)
+		{
+			host_eeprom[offset + index] = (u8)host_eeprom_random();
+		}
+		longjmp(*m_host_eeprom_env, 1);
+	}
+	memcpy(&host_eeprom[offset], p_bytes, length);
+}
+
+void FLASH_Unlock(FLASH_MemType_TypeDef FLASH_MemType)
+{
+	if (FLASH_MemType == FLASH_MemType_Data)
+	{
+		FLASH->IAPSR |= FLASH_IAPSR_DUL;
+	}
+}
+
+void FLASH_Lock(FLASH_MemType_TypeDef FLASH_MemType)
+{
+	if (FLASH_MemType == FLASH_MemType_Data)
+	{
+		FLASH->IAPSR &= (u8)~FLASH_IAPSR_DUL;
+	}
+}
+
+FlagStatus FLASH_GetFlagStatus(FLASH_FLAG_TypeDef FLASH_FLAG)
+{
+	return ((FLASH->IAPSR & (u8)FLASH_FLAG) != 0) ? SET : RESET;
+}
+
+uint8_t FLASH_ReadByte(uint32_t Address)
+{
+	if ((Address < FLASH_DATA_EEPROM_START_PHYSICAL_ADDRESS) ||
+	    (Address > FLASH_DATA_EEPROM_END_PHYSICAL_ADDRESS))
+	{
+		host_fatal("EEPROM read out of range");
+	}
+	return host_eeprom[Address - FLASH_DATA_EEPROM_START_PHYSICAL_ADDRESS];
+}
+
+void FLASH_ProgramByte(uint32_t Address, uint8_t Data)
+{
+	host_eeprom_program(Address, &Data, 1);
+}
+
+/* The STM8 is big endian, so the bytes land in the memory order of Data */
+void FLASH_ProgramWord(uint32_t Address, uint32_t Data)
+{
+	u8 bytes[4];
+
+	memcpy(bytes, &Data, sizeof(bytes));
+	host_eeprom_program(Address, bytes, sizeof(bytes));
+}
+
+void FLASH_ProgramBlock(uint16_t BlockNum, FLASH_MemType_TypeDef FLASH_MemType,
+                        FLASH_ProgramMode_TypeDef FLASH_ProgMode, uint8_t *Buffer)
+{
+	if (FLASH_MemType != FLASH_MemType_Data)
+	{
+		host_fatal("program memory is not modelled");
+	}
+	host_eeprom_program(FLASH_DATA_EEPROM_START_PHYSICAL_ADDRESS + (u32)BlockNum * FLASH_BLOCK_SIZE,
+	                    Buffer, FLASH_BLOCK_SIZE);
+}
+
+FLASH_Status_TypeDef FLASH_WaitForLastOperation(FLASH_MemType_TypeDef FLASH_MemType)
+{
+	return FLASH_Status_Successful_Operation;
+}
+
+void host_eeprom_erase(void)
+{
+	memset(host_eeprom, 0, sizeof(host_eeprom));
+	memset(host_eeprom_writes, 0, sizeof(host_eeprom_writes));
+}
+
+void host_eeprom_fail_at(u32 count, jmp_buf *p_env, u32 seed)
+{
+	m_host_eeprom_fail_at = count;
+	m_host_eeprom_env = p_env;
+	m_host_eeprom_seed = seed;
+}
+
+u32 host_eeprom_operations(void)
+{
+	return m_host_eeprom_operations;
+}
+
+/* GPIO and EXTI -----------------------------------------------------------*/
+
+/* Port lines of the EXTI. Each shares its vector with another port, G, H
+   and F, and takes the pins of the halves selected in CONF1 away from the
+   pin lines */
+typedef struct host_exti_port_s
+{
+	GPIO_TypeDef *port;
+	u8 lis;       // CONF1 selector of pins 0 to 3, the next bit selects 4 to 7.
+	u8 cr3_shift; // Sensitivity of the port in CR3.
+	u8 it;        // Bit in SR2.
+	u8 vector;
+} host_exti_port_t;
+
+static const host_exti_port_t m_host_exti_port[] =
+{
+	{GPIOB, EXTI_CONF1_PBLIS, EXTI_Port_B, (u8)EXTI_IT_PortB, HOST_VECTOR_EXTIB},
+	{GPIOD, EXTI_CONF1_PDLIS, EXTI_Port_D, (u8)EXTI_IT_PortD, HOST_VECTOR_EXTID},
+	{GPIOE, EXTI_CONF1_PELIS, EXTI_Port_E, (u8)EXTI_IT_PortE, HOST_VECTOR_EXTIE}
+};
+
+#define HOST_EXTI_PORT_NUMBER    (sizeof(m_host_exti_port) / sizeof(m_host_exti_port[0]))
+
+static void host_matrix_settle(void);
+
+/* Trigger of EXTIn, as EXTI_SetPinSensitivity left it */
+static u8 host_exti_trigger(u8 line)
+{
+	return (line < 4) ? (u8)((EXTI->CR1 >> (line * 2)) & 0x03) : (u8)((EXTI->CR2 >> ((line - 4) * 2)) & 0x03);
+}
+
+static bool host_exti_is_triggered(u8 trigger, bool is_high)
+{
+	return (is_high == TRUE) ? (((trigger & 0x01) != 0) ? TRUE : FALSE) :
+	       ((trigger != EXTI_Trigger_Rising) ? TRUE : FALSE);
+}
+
+/* The port line of port, NULL if none. Its pins go to the line in *p_pins */
+static const host_exti_port_t *host_exti_port(GPIO_TypeDef *port, u8 *p_pins)
+{
+	const host_exti_port_t *p_line = NULL;
+	u8 index;
+	u8 other;
+
+	for (index = 0; index < HOST_EXTI_PORT_NUMBER; index ++)
+	{
+		if (m_host_exti_port[index].port == port)
+		{
+			p_line = &m_host_exti_port[index];
+		}
+	}
+	*p_pins = 0;
+	if (p_line == NULL)
+	{
+		return NULL;
+	}
+	// PGBS, PHDS and PFES select the other port when set.
+	other = (port == GPIOB) ? (u8)(EXTI->CONF2 & EXTI_CONF2_PGBS) :
+	        (port == GPIOD) ? (u8)(EXTI->CONF2 & EXTI_CONF2_PHDS) : (u8)(EXTI->CONF1 & EXTI_CONF1_PFES);
+	if (other == 0)
+	{
+		*p_pins = (u8)((((EXTI->CONF1 & p_line->lis) != 0) ? 0x0F : 0x00) |
+		               (((EXTI->CONF1 & (u8)(p_line->lis << 1)) != 0) ? 0xF0 : 0x00));
+	}
+	return p_line;
+}
+
+void host_pin_write(GPIO_TypeDef *port, u8 pins, bool is_high)
+{
+	const host_exti_port_t *p_line;
+	u8 line;
+	u8 level = (is_high == TRUE) ? (u8)(port->IDR | pins) : (u8)(port->IDR & (u8)~pins);
+	u8 changed = (u8)(port->IDR ^ level);
+	u8 port_pins;
+
+	port->IDR = level;
+	// Inputs with the interrupt enabled in CR2.
+	changed &= (u8)(~port->DDR & port->CR2);
+	p_line = host_exti_port(port, &port_pins);
+	if (((changed & port_pins) != 0) &&
+	    (host_exti_is_triggered((u8)((EXTI->CR3 >> p_line->cr3_shift) & 0x03), is_high) == TRUE))
+	{
+		m_host_exti_port_pending |= p_line->it;
+	}
+	changed &= (u8)~port_pins;
+	for (line = 0; line < 8; line ++)
+	{
+		if (((changed & (u8)(1 << line)) != 0) && (host_exti_is_triggered(host_exti_trigger(line), is_high) == TRUE))
+		{
+			m_host_exti_pending |= (u8)(1 << line);
+		}
+	}
+	EXTI->SR1 = m_host_exti_pending;
+	EXTI->SR2 = m_host_exti_port_pending;
+	host_irq_deliver();
+}
+
+static void host_edge_add(GPIO_TypeDef *port, u8 pins, bool is_high, u32 after_us)
+{
+	unsigned long long at_ps = m_host_now_ps + (unsigned long long)after_us * 1000000ULL;
+	u8 index = m_host_edge_count;
+
+	if (m_host_edge_count >= HOST_EDGES_MAX)
+	{
+		host_fatal("too many pin edges ahead");
+	}
+	// Edges at the same time keep the order they were scheduled in.
+	while ((index > 0) && (m_host_edge[index - 1].at_ps > at_ps))
+	{
+		m_host_edge[index] = m_host_edge[index - 1];
+		index --;
+	}
+	m_host_edge[index].at_ps = at_ps;
+	m_host_edge[index].port = port;
+	m_host_edge[index].pins = pins;
+	m_host_edge[index].is_high = is_high;
+	m_host_edge_count ++;
+}
+
+void host_pin_schedule(GPIO_TypeDef *port, u8 pins, bool is_high, u32 after_us)
+{
+	host_edge_add(port, pins, is_high, after_us);
+}
+
+void EXTI_DeInit(void)
+{
+	host_matrix_settle();
+	EXTI->CR1 = EXTI_CR1_RESET_VALUE;
+	EXTI->CR2 = EXTI_CR2_RESET_VALUE;
+	EXTI->CR3 = EXTI_CR3_RESET_VALUE;
+	EXTI->CR4 = EXTI_CR4_RESET_VALUE;
+	EXTI->CONF1 = EXTI_CONF1_RESET_VALUE;
+	EXTI->CONF2 = EXTI_CONF2_RESET_VALUE;
+	m_host_exti_pending = 0;
+	m_host_exti_port_pending = 0;
+	EXTI->SR1 = 0;
+	EXTI->SR2 = 0;
+}
+
+void EXTI_SetPinSensitivity(EXTI_Pin_TypeDef EXTI_Pin, EXTI_Trigger_TypeDef EXTI_Trigger)
+{
+	// The shift in CR1, or 0x10 and the shift in CR2.
+	volatile u8 *p_cr = ((EXTI_Pin & 0x10) == 0) ? &EXTI->CR1 : &EXTI->CR2;
+	u8 shift = (u8)(EXTI_Pin & 0x0F);
+
+	host_matrix_settle();
+	*p_cr = (u8)((*p_cr & (u8)~(0x03 << shift)) | (u8)(EXTI_Trigger << shift));
+}
+
+void EXTI_SetPortSensitivity(EXTI_Port_TypeDef EXTI_Port, EXTI_Trigger_TypeDef EXTI_Trigger)
+{
+	// The shift in CR3, or 0x10 and the shift in CR4.
+	volatile u8 *p_cr = ((EXTI_Port & 0xF0) == 0) ? &EXTI->CR3 : &EXTI->CR4;
+	u8 shift = (u8)(EXTI_Port & 0x0F);
+
+	host_matrix_settle();
+	*p_cr = (u8)((*p_cr & (u8)~(0x03 << shift)) | (u8)(EXTI_Trigger << shift));
+}
+
+void EXTI_SelectPort(EXTI_Port_TypeDef EXTI_Port)
+{
+	host_matrix_settle();
+	switch (EXTI_Port)
+	{
+		case EXTI_Port_B: EXTI->CONF2 &= (u8)~EXTI_CONF2_PGBS; break;
+		case EXTI_Port_D: EXTI->CONF2 &= (u8)~EXTI_CONF2_PHDS; break;
+		case EXTI_Port_E: EXTI->CONF1 &= (u8)~EXTI_CONF1_PFES; break;
+		case EXTI_Port_F: EXTI->CONF1 |= EXTI_CONF1_PFES; break;
+		case EXTI_Port_G: EXTI->CONF2 |= EXTI_CONF2_PGBS; break;
+		default:          EXTI->CONF2 |= EXTI_CONF2_PHDS; break;
+	}
+}
+
+void EXTI_SetHalfPortSelection(EXTI_HalfPort_TypeDef EXTI_HalfPort, FunctionalState NewState)
+{
+	volatile u8 *p_conf = ((EXTI_HalfPort & 0x80) == 0) ? &EXTI->CONF1 : &EXTI->CONF2;
+	u8 mask = (u8)(EXTI_HalfPort & 0x7F);
+
+	host_matrix_settle();
+	*p_conf = (NewState != DISABLE) ? (u8)(*p_conf | mask) : (u8)(*p_conf & (u8)~mask);
+}
+
+void EXTI_ClearITPendingBit(EXTI_IT_TypeDef EXTI_IT)
+{
+	host_matrix_settle();
+	if (((u16)EXTI_IT & 0xFF00) == 0x0100)
+	{
+		m_host_exti_port_pending &= (u8)~(u8)EXTI_IT;
+	}
+	else
+	{
+		m_host_exti_pending &= (u8)~(u8)EXTI_IT;
+	}
+	EXTI->SR1 = m_host_exti_pending;
+	EXTI->SR2 = m_host_exti_port_pending;
+}
+
+/* Key matrix ---------------------------------------------------------------*/
+
+/* Rows and columns joined through the keys down to a row driven low are
+   low, the columns then take their level from the pull ups or from it */
+static void host_matrix_settle(void)
+{
+	u8 low_rows;
+	u8 low_cols = 0;
+	u8 last_cols;
+	u8 row;
+	u8 col_levels;
+	u8 changed;
+
+	if (m_host_matrix_row_port == NULL)
+	{
+		return;
+	}
+	low_rows = (u8)(m_host_matrix_row_port->DDR & (u8)~m_host_matrix_row_port->ODR & m_host_matrix_rows);
+	do
+	{
+		last_cols = low_cols;
+		for (row = 0; row < 8; row ++)
+		{
+			if ((low_rows & (u8)(1 << row)) != 0)
+			{
+				low_cols |= m_host_matrix_key[row];
+			}
+			else if ((m_host_matrix_key[row] & low_cols) != 0)
+			{
+				low_rows |= (u8)(1 << row);
+				low_cols |= m_host_matrix_key[row];
+			}
+		}
+	} while (low_cols != last_cols);
+
+	col_levels = (u8)(m_host_matrix_cols & (u8)~low_cols);
+	changed = (u8)((m_host_matrix_col_port->IDR & m_host_matrix_cols) ^ col_levels);
+	if ((changed & (u8)~col_levels) != 0)
+	{
+		host_pin_write(m_host_matrix_col_port, (u8)(changed & (u8)~col_levels), FALSE);
+	}
+	if ((changed & col_levels) != 0)
+	{
+		host_pin_write(m_host_matrix_col_port, (u8)(changed & col_levels), TRUE);
+	}
+}
+
+void host_matrix_attach(GPIO_TypeDef *row_port, u8 rows, GPIO_TypeDef *col_port, u8 cols)
+{
+	m_host_matrix_row_port = row_port;
+	m_host_matrix_rows = rows;
+	m_host_matrix_col_port = col_port;
+	m_host_matrix_cols = cols;
+	memset(m_host_matrix_key, 0, sizeof(m_host_matrix_key));
+	host_matrix_settle();
+}
+
+void host_matrix_key(u8 row, u8 col, bool is_down)
+{
+	if (is_down == TRUE)
+	{
+		m_host_matrix_key[row] |= (u8)(1 << col);
+	}
+	else
+	{
+		m_host_matrix_key[row] &= (u8)~(1 << col);
+	}
+	host_matrix_settle();
+}
+
+void host_matrix_schedule(u8 row, u8 col, bool is_down, u32 after_us)
+{
+	host_edge_add(NULL, (u8)(row * 8 + col), is_down, after_us);
+}
+
+static unsigned long long host_edge_next_ps(void)
+{
+	return (m_host_edge_count == 0) ? HOST_NEVER : m_host_edge[0].at_ps - m_host_now_ps;
+}
+
+static void host_edge_step(void)
+{
+	host_edge_t edge;
+
+	while ((m_host_edge_count > 0) && (m_host_edge[0].at_ps <= m_host_now_ps))
+	{
+		edge = m_host_edge[0];
+		m_host_edge_count --;
+		memmove(&m_host_edge[0], &m_host_edge[1], m_host_edge_count * sizeof(m_host_edge[0]));
+		if (edge.port == NULL)
+		{
+			host_matrix_key((u8)(edge.pins / 8), (u8)(edge.pins % 8), edge.is_high);
+		}
+		else
+		{
+			host_pin_write(edge.port, edge.pins, edge.is_high);
+		}
+	}
+}
+
+/* Interrupts --------------------------------------------------------------*/
+
+static bool host_irq_is_pending(u8 vector)
+{
+	TIM_TypeDef *tim;
+	u8 index;
+
+	if ((vector >= HOST_VECTOR_EXTI0) && (vector < HOST_VECTOR_EXTI0 + 8))
+	{
+		return ((m_host_exti_pending & (u8)(1 << (vector - HOST_VECTOR_EXTI0))) != 0) ? TRUE : FALSE;
+	}
+	for (index = 0; index < HOST_EXTI_PORT_NUMBER; index ++)
+	{
+		if (m_host_exti_port[index].vector == vector)
+		{
+			return ((m_host_exti_port_pending & m_host_exti_port[index].it) != 0) ? TRUE : FALSE;
+		}
+	}
+	if (vector == HOST_VECTOR_TIM1)
+	{
+		return ((TIM1->SR1 & TIM1->IER & TIM1_SR1_UIF) != 0) ? TRUE : FALSE;
+	}
+	if ((vector == HOST_VECTOR_TIM2) || (vector == HOST_VECTOR_TIM3))
+	{
+		tim = (vector == HOST_VECTOR_TIM2) ? TIM2 : TIM3;
+		return ((tim->SR1 & tim->IER & TIM_SR1_UIF) != 0) ? TRUE : FALSE;
+	}
+	if (vector == HOST_VECTOR_TIM4)
+	{
+		return ((TIM4->SR1 & TIM4->IER & TIM4_SR1_UIF) != 0) ? TRUE : FALSE;
+	}
+	if (vector == HOST_VECTOR_RTC)
+	{
+		return (((RTC->ISR2 & RTC_ISR2_WUTF) != 0) && ((RTC->CR2 & RTC_CR2_WUTIE) != 0)) ? TRUE : FALSE;
+	}
+	return FALSE;
+}
+
+void host_irq_deliver(void)
+{
+	u8 vector = 0;
+
+	while ((m_host_is_enabled == TRUE) && (m_host_is_in_isr == FALSE) && (vector < HOST_VECTOR_NUMBER))
+	{
+		if ((host_irq_is_pending(vector) == FALSE) || (host_vector[vector] == NULL))
+		{
+			vector ++;
+			continue;
+		}
+		if (++ m_host_storm > HOST_STORM_LIMIT)
+		{
+			host_fatal("interrupt storm, a routine does not clear its flag");
+		}
+		// The pin lines clear as they are delivered, the port lines stay
+		// pending until the routine clears them.
+		if ((vector >= HOST_VECTOR_EXTI0) && (vector < HOST_VECTOR_EXTI0 + 8))
+		{
+			m_host_exti_pending &= (u8)~(1 << (vector - HOST_VECTOR_EXTI0));
+		}
+		// The routine runs with interrupts masked, and does not nest.
+		m_host_is_halted = FALSE;
+		m_host_is_in_isr = TRUE;
+		m_host_is_enabled = FALSE;
+		host_vector[vector]();
+		m_host_is_enabled = TRUE;
+		m_host_is_in_isr = FALSE;
+		EXTI->SR1 = m_host_exti_pending;
+		vector = 0;
+	}
+}
+
+void host_enable_interrupts(void)
+{
+	host_matrix_settle();
+	if (m_host_is_in_isr == FALSE)
+	{
+		m_host_is_enabled = TRUE;
+		host_irq_deliver();
+	}
+}
+
+void host_disable_interrupts(void)
+{
+	host_matrix_settle();
+	if (m_host_is_in_isr == FALSE)
+	{
+		m_host_is_enabled = FALSE;
+	}
+}
+
+/* Time --------------------------------------------------------------------*/
+
+static unsigned long long host_next_ps(void)
+{
+	unsigned long long next_ps = host_tim4_next_ps();
+	unsigned long long source_ps = host_tim1_next_ps();
+	u8 index;
+
+	if (source_ps < next_ps)
+	{
+		next_ps = source_ps;
+	}
+	for (index = 0; index < HOST_TIM_NUMBER; index ++)
+	{
+		source_ps = host_tim_next_ps(&m_host_tim[index]);
+		if (source_ps < next_ps)
+		{
+			next_ps = source_ps;
+		}
+	}
+	source_ps = host_rtc_next_ps();
+	if (source_ps < next_ps)
+	{
+		next_ps = source_ps;
+	}
+	source_ps = host_edge_next_ps();
+	return (source_ps < next_ps) ? source_ps : next_ps;
+}
+
+static void host_advance_ps(unsigned long long ps)
+{
+	unsigned long long step_ps;
+	u8 index;
+
+	do
+	{
+		step_ps = host_next_ps();
+		if (step_ps > ps)
+		{
+			step_ps = ps;
+		}
+		// The outputs change at the end of the step.
+		m_host_now_ps += step_ps;
+		host_tim4_step(step_ps);
+		host_tim1_step(step_ps);
+		for (index = 0; index < HOST_TIM_NUMBER; index ++)
+		{
+			host_tim_step(&m_host_tim[index], step_ps);
+		}
+		ps -= step_ps;
+		if (step_ps != 0)
+		{
+			m_host_storm = 0;
+		}
+		host_rtc_step();
+		host_edge_step();
+		host_matrix_settle();
+		host_irq_deliver();
+	} while (ps != 0);
+}
+
+u32 host_now_us(void)
+{
+	return (u32)(m_host_now_ps / 1000000ULL);
+}
+
+unsigned long long host_now_ps(void)
+{
+	return m_host_now_ps;
+}
+
+unsigned long long host_tim4_dropped_ps(void)
+{
+	return m_host_tim4_dropped_ps;
+}
+
+void host_advance_us(u32 us)
+{
+	host_advance_ps((unsigned long long)us * 1000000ULL);
+}
+
+/* wfi and wfe enable the interrupts and wait for one */
+void host_wfi(void)
+{
+	unsigned long long next_ps;
+
+	if (host_wfi_hook != NULL)
+	{
+		host_wfi_hook();
+	}
+	m_host_is_enabled = TRUE;
+	host_irq_deliver();
+	next_ps = host_next_ps();
+	if (next_ps == HOST_NEVER)
+	{
+		host_fatal("wfi with nothing to wake it");
+	}
+	host_advance_ps(next_ps);
+}
+
+/* halt stops SYSCLK, only an interrupt of the RTC or an EXTI line ends it */
+void host_halt(void)
+{
+	unsigned long long next_ps;
+
+	if (host_wfi_hook != NULL)
+	{
+		host_wfi_hook();
+	}
+	m_host_is_halted = TRUE;
+	m_host_is_enabled = TRUE;
+	host_irq_deliver();
+	while (m_host_is_halted == TRUE)
+	{
+		next_ps = host_next_ps();
+		if (next_ps == HOST_NEVER)
+		{
+			host_fatal("halt with nothing to wake it");
+		}
+		host_advance_ps(next_ps);
+	}
+}
+
+void host_run_us(u32 us)
+{
+	unsigned long long end_ps = m_host_now_ps + (unsigned long long)us * 1000000ULL;
+	unsigned long long next_ps;
+
+	for (;;)
+	{
+		event_dispatch();
+		if (m_host_now_ps >= end_ps)
+		{
+			break;
+		}
+		if (event_is_empty() == FALSE)
+		{
+			continue;
+		}
+		next_ps = host_next_ps();
+		if (next_ps > end_ps - m_host_now_ps)
+		{
+			next_ps = end_ps - m_host_now_ps;
+		}
+		host_advance_ps(next_ps);
+	}
+}
+
+void host_run_ms(u32 ms)
+{
+	host_run_us(ms * 1000UL);
+}
+
+void host_reset(void)
+{
+	u16 port;
+	u8 index;
+
+	memset(host_register, 0, sizeof(host_register));
+	memset(host_vector, 0, sizeof(host_vector));
+	host_wfi_hook = NULL;
+	host_tim4_read_hook = NULL;
+	host_oc1_hook = NULL;
+
+	// The clocks are ready as soon as they are asked for.
+	CLK->ICKCR = CLK_ICKCR_RESET_VALUE | CLK_ICKCR_HSIRDY | CLK_ICKCR_LSIRDY;
+	CLK->ECKCR = CLK_ECKCR_RESET_VALUE | CLK_ECKCR_LSERDY | CLK_ECKCR_HSERDY;
+	CLK->CKDIVR = CLK_CKDIVR_RESET_VALUE;
+	CLK->SCSR = CLK_SCSR_RESET_VALUE;
+	CLK->SWR = CLK_SWR_RESET_VALUE;
+	CLK->PCKENR2 = CLK_PCKENR2_RESET_VALUE;
+	CLK->REGCSR = CLK_REGCSR_RESET_VALUE;
+	// Inputs pulled up and released.
+	for (port = 0x5000; port <= 0x5028; port += 5)
+	{
+		((GPIO_TypeDef *)HOST_REGISTER(port))->IDR = 0xFF;
+	}
+	TIM4_DeInit();
+	TIM1_DeInit();
+	for (index = 0; index < HOST_TIM_NUMBER; index ++)
+	{
+		m_host_tim[index].is_high = FALSE;
+		host_tim_deinit(&m_host_tim[index]);
+	}
+
+	m_host_now_ps = 0;
+	m_host_tim4_dropped_ps = 0;
+	m_host_is_enabled = TRUE;
+	m_host_is_in_isr = FALSE;
+	m_host_is_halted = FALSE;
+	host_lsi_hz = HOST_LSI_NOMINAL_HZ;
+	m_host_rtc_is_running = FALSE;
+	m_host_edge_count = 0;
+	m_host_storm = 0;
+	m_host_exti_pending = 0;
+	m_host_exti_port_pending = 0;
+	m_host_matrix_row_port = NULL;
+	m_host_eeprom_operations = 0;
+	m_host_eeprom_fail_at = 0;
+	m_host_eeprom_env = NULL;
+}
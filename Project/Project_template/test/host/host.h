@@ -0,0 +1,124 @@
+#ifndef HOST_H_
+#define HOST_H_
+
+#include <setjmp.h>
+
+#include "stm8l15x.h"
+#include "stm8l15x_flash.h"
+#include "stm8l15x_gpio.h"
+
+/*
+	A model of the parts of the STM8L152 the firmware relies on, for the
+	host tests. Time is virtual and only moves when the model is told to,
+	or when the firmware polls a running TIM1. TIM1 to TIM4 count with the
+	CLK divider and their prescaler and stop in halt, the channel 1 outputs
+	of TIM2 and TIM3 drive PB0 and PB1, the RTC counts LSI clocks of
+	host_lsi_hz, the EXTI pin lines and the port lines of B, D and E fire
+	on the GPIO edges of host_pin_write and of a key matrix, and the data
+	EEPROM sits in host_eeprom. Everything else is a plain register file
+	for the real drivers.
+*/
+
+/* Vector numbers, as in stm8_interrupt_vector.c */
+#define HOST_VECTOR_RTC       4
+#define HOST_VECTOR_EXTIE     5
+#define HOST_VECTOR_EXTIB     6
+#define HOST_VECTOR_EXTID     7
+#define HOST_VECTOR_EXTI0     8
+#define HOST_VECTOR_TIM2      19
+#define HOST_VECTOR_TIM3      21
+#define HOST_VECTOR_TIM1      23
+#define HOST_VECTOR_TIM4      25
+#define HOST_VECTOR_NUMBER    30
+
+typedef void (*host_vector_t)(void);
+
+/* Routines of the delivered interrupts, lower numbers are delivered first.
+   Cleared by host_reset() */
+extern host_vector_t host_vector[HOST_VECTOR_NUMBER];
+
+/* Runs before wfi, wfe and halt wait for the next interrupt, NULL if none */
+extern void (*host_wfi_hook)(void);
+
+/* Runs on every TIM4_GetCounter(), the test may move the time from it */
+extern void (*host_tim4_read_hook)(void);
+
+/* Runs when the channel 1 output of TIM2 or TIM3 changes level, at the
+   time of the change */
+extern void (*host_oc1_hook)(TIM_TypeDef *tim, bool is_high);
+
+/* LSI frequency, the part's own between 26 and 56 kHz. Set to 38 kHz by
+   host_reset(), a test changes it before the RTC is started */
+extern u32 host_lsi_hz;
+
+#define HOST_EEPROM_SIZE    (FLASH_DATA_EEPROM_END_PHYSICAL_ADDRESS - FLASH_DATA_EEPROM_START_PHYSICAL_ADDRESS + 1)
+
+extern u8  host_eeprom[HOST_EEPROM_SIZE];
+extern u32 host_eeprom_writes[HOST_EEPROM_SIZE];   // Programming cycles per byte.
+
+/* Registers at their reset values, the clocks ready, interrupts enabled,
+   time 0, no vectors and no hooks. Leaves host_eeprom alone, as a reset
+   does */
+void host_reset(void);
+
+/* Fills every vector the firmware has with its routine of stm8l15x_it.c,
+   in host_vectors.c */
+void host_vectors_install(void);
+
+/* Virtual time since host_reset(), wraps after 71 minutes as
+   sys_time_now_us() does */
+u32 host_now_us(void);
+
+/* The same in ps, for the tests that run longer */
+unsigned long long host_now_ps(void);
+
+/* Time TIM4 lost since host_reset(), the part of a count that had passed
+   whenever an immediate prescaler load restarted the count */
+unsigned long long host_tim4_dropped_ps(void);
+
+/* Moves the time, delivering the interrupts on the way as long as they
+   are enabled */
+void host_advance_us(u32 us);
+
+/* Runs as the main loop does: dispatches the events and waits for the
+   next interrupt until the time has passed */
+void host_run_us(u32 us);
+void host_run_ms(u32 ms);
+
+/* Sets the input level of pins, EXTI pin lines fire on the edges their
+   sensitivity selects */
+void host_pin_write(GPIO_TypeDef *port, u8 pins, bool is_high);
+
+/* The same after_us from now. The time runs to scheduled edges in halt
+   too, so they can wake the core */
+void host_pin_schedule(GPIO_TypeDef *port, u8 pins, bool is_high, u32 after_us);
+
+/* A key matrix between the open drain rows on the pins rows of row_port and
+   the pulled up columns on the pins cols of col_port. A key down joins its
+   row and column both ways, so three corners of a rectangle pull the
+   fourth column down too, as a matrix without diodes does. The firmware
+   writes the rows to ODR unseen, the columns settle whenever it calls into
+   the model: a time step, an interrupt mask or an EXTI call. Detached by
+   host_reset() */
+void host_matrix_attach(GPIO_TypeDef *row_port, u8 rows, GPIO_TypeDef *col_port, u8 cols);
+
+/* Puts the key of row and col, from 0, down or lets it up. Now, or
+   after_us from now as the pin edges are */
+void host_matrix_key(u8 row, u8 col, bool is_down);
+void host_matrix_schedule(u8 row, u8 col, bool is_down, u32 after_us);
+
+/* Delivers the pending interrupts, if enabled and not in an interrupt */
+void host_irq_deliver(void);
+
+/* Erases host_eeprom to 0 and clears the write counters */
+void host_eeprom_erase(void);
+
+/* Power fails during the EEPROM programming operation count operations
+   from now, 0 to disable. The word or block being programmed is left with
+   random bytes and the model jumps to p_env. seed picks the bytes */
+void host_eeprom_fail_at(u32 count, jmp_buf *p_env, u32 seed);
+
+/* EEPROM programming operations since host_reset() */
+u32 host_eeprom_operations(void);
+
+#endif // HOST_H_
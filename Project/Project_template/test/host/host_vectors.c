@@ -0,0 +1,29 @@
+#include "stm8l15x.h"
+
+#include "host.h"
+
+/*
+	The routines of stm8l15x_it.c, for the tests that link the whole
+	firmware. stm8l15x_it.h only declares them for Cosmic.
+*/
+#define HOST_VECTOR_LIST(HOST_VECTOR) \
+	HOST_VECTOR(2,  DMA1_CHANNEL0_1_IRQHandler)      \
+	HOST_VECTOR(4,  RTC_IRQHandler)                  \
+	HOST_VECTOR(5,  EXTIE_F_PVD_IRQHandler)          \
+	HOST_VECTOR(6,  EXTIB_IRQHandler)                \
+	HOST_VECTOR(7,  EXTID_IRQHandler)                \
+	HOST_VECTOR(14, EXTI6_IRQHandler)                \
+	HOST_VECTOR(15, EXTI7_IRQHandler)                \
+	HOST_VECTOR(19, TIM2_UPD_OVF_TRG_BRK_IRQHandler) \
+	HOST_VECTOR(21, TIM3_UPD_OVF_TRG_BRK_IRQHandler) \
+	HOST_VECTOR(23, TIM1_UPD_OVF_TRG_COM_IRQHandler) \
+	HOST_VECTOR(25, TIM4_UPD_OVF_TRG_IRQHandler)
+
+#define HOST_VECTOR_PROTOTYPE(vector, routine)    void routine(void);
+HOST_VECTOR_LIST(HOST_VECTOR_PROTOTYPE)
+
+void host_vectors_install(void)
+{
+#define HOST_VECTOR_INSTALL(vector, routine)    host_vector[vector] = routine;
+	HOST_VECTOR_LIST(HOST_VECTOR_INSTALL)
+}
@@ -0,0 +1,11 @@
+#ifndef INTRINSICS_H_
+#define INTRINSICS_H_
+
+/* The IAR memory and interrupt keywords the StdPeriph headers use, empty for gcc */
+#define __far
+#define __near
+#define __tiny
+#define __eeprom
+#define __interrupt
+
+#endif // INTRINSICS_H_
@@ -0,0 +1,148 @@
+#ifndef STM8L15X_HOST_H_
+#define STM8L15X_HOST_H_
+
+/*
+	Included ahead of every source by the host Makefile, so gcc builds the
+	firmware and the StdPeriph drivers against the IAR headers. long is 32
+	bit as on the STM8, the interrupt instructions call into the model of
+	host.c and every peripheral points into a register file in RAM.
+
+	int is not: it stays 32 bit, where IAR's is 16 bit. An expression of
+	u8, u16 or int operands that passes 0xFFFF or 0x7FFF wraps on the part
+	and not here, so the tests cannot catch a missing u32 cast. gcc has no
+	16 bit int on the host, so such products are left to review.
+*/
+#define long int
+#include <stm8l15x.h>
+#undef long
+
+typedef char host_u32_check_t[(sizeof(u32) == 4) ? 1 : -1];
+
+/* Indexed by STM8 address, so the register structs keep their layout */
+extern u8 host_register[0x8000];
+
+#define HOST_REGISTER(address)    (&host_register[address])
+
+#undef enableInterrupts
+#undef disableInterrupts
+#undef rim
+#undef sim
+#undef nop
+#undef trap
+#undef wfi
+#undef wfe
+#undef halt
+
+void host_enable_interrupts(void);
+void host_disable_interrupts(void);
+void host_wfi(void);
+void host_halt(void);
+
+#define enableInterrupts()     host_enable_interrupts()
+#define disableInterrupts()    host_disable_interrupts()
+#define rim()                  host_enable_interrupts()
+#define sim()                  host_disable_interrupts()
+#define nop()
+#define wfi()                  host_wfi()
+#define wfe()                  host_wfi()
+#define halt()                 host_halt()
+
+#undef OPT_BASE
+#undef GPIOA_BASE
+#undef GPIOB_BASE
+#undef GPIOC_BASE
+#undef GPIOD_BASE
+#undef GPIOE_BASE
+#undef GPIOF_BASE
+#undef GPIOG_BASE
+#undef GPIOH_BASE
+#undef GPIOI_BASE
+#undef FLASH_BASE
+#undef DMA1_BASE
+#undef DMA1_Channel0_BASE
+#undef DMA1_Channel1_BASE
+#undef DMA1_Channel2_BASE
+#undef DMA1_Channel3_BASE
+#undef SYSCFG_BASE
+#undef EXTI_BASE
+#undef WFE_BASE
+#undef RST_BASE
+#undef PWR_BASE
+#undef CLK_BASE
+#undef WWDG_BASE
+#undef IWDG_BASE
+#undef BEEP_BASE
+#undef RTC_BASE
+#undef CSSLSE_BASE
+#undef SPI1_BASE
+#undef SPI2_BASE
+#undef I2C1_BASE
+#undef USART1_BASE
+#undef USART2_BASE
+#undef USART3_BASE
+#undef TIM2_BASE
+#undef TIM3_BASE
+#undef TIM1_BASE
+#undef TIM4_BASE
+#undef IRTIM_BASE
+#undef TIM5_BASE
+#undef ADC1_BASE
+#undef DAC_BASE
+#undef AES_BASE
+#undef LCD_BASE
+#undef RI_BASE
+#undef COMP_BASE
+#undef CFG_BASE
+#undef ITC_BASE
+#undef DM_BASE
+
+#define OPT_BASE              HOST_REGISTER(0x4800)
+#define GPIOA_BASE            HOST_REGISTER(0x5000)
+#define GPIOB_BASE            HOST_REGISTER(0x5005)
+#define GPIOC_BASE            HOST_REGISTER(0x500A)
+#define GPIOD_BASE            HOST_REGISTER(0x500F)
+#define GPIOE_BASE            HOST_REGISTER(0x5014)
+#define GPIOF_BASE            HOST_REGISTER(0x5019)
+#define GPIOG_BASE            HOST_REGISTER(0x501E)
+#define GPIOH_BASE            HOST_REGISTER(0x5023)
+#define GPIOI_BASE            HOST_REGISTER(0x5028)
+#define FLASH_BASE            HOST_REGISTER(0x5050)
+#define DMA1_BASE             HOST_REGISTER(0x5070)
+#define DMA1_Channel0_BASE    HOST_REGISTER(0x5075)
+#define DMA1_Channel1_BASE    HOST_REGISTER(0x507F)
+#define DMA1_Channel2_BASE    HOST_REGISTER(0x5089)
+#define DMA1_Channel3_BASE    HOST_REGISTER(0x5093)
+#define SYSCFG_BASE           HOST_REGISTER(0x509D)
+#define EXTI_BASE             HOST_REGISTER(0x50A0)
+#define WFE_BASE              HOST_REGISTER(0x50A6)
+#define RST_BASE              HOST_REGISTER(0x50B0)
+#define PWR_BASE              HOST_REGISTER(0x50B2)
+#define CLK_BASE              HOST_REGISTER(0x50C0)
+#define WWDG_BASE             HOST_REGISTER(0x50D3)
+#define IWDG_BASE             HOST_REGISTER(0x50E0)
+#define BEEP_BASE             HOST_REGISTER(0x50F0)
+#define RTC_BASE              HOST_REGISTER(0x5140)
+#define CSSLSE_BASE           HOST_REGISTER(0x5190)
+#define SPI1_BASE             HOST_REGISTER(0x5200)
+#define SPI2_BASE             HOST_REGISTER(0x53C0)
+#define I2C1_BASE             HOST_REGISTER(0x5210)
+#define USART1_BASE           HOST_REGISTER(0x5230)
+#define USART2_BASE           HOST_REGISTER(0x53E0)
+#define USART3_BASE           HOST_REGISTER(0x53F0)
+#define TIM2_BASE             HOST_REGISTER(0x5250)
+#define TIM3_BASE             HOST_REGISTER(0x5280)
+#define TIM1_BASE             HOST_REGISTER(0x52B0)
+#define TIM4_BASE             HOST_REGISTER(0x52E0)
+#define IRTIM_BASE            HOST_REGISTER(0x52FF)
+#define TIM5_BASE             HOST_REGISTER(0x5300)
+#define ADC1_BASE             HOST_REGISTER(0x5340)
+#define DAC_BASE              HOST_REGISTER(0x5380)
+#define AES_BASE              HOST_REGISTER(0x53D0)
+#define LCD_BASE              HOST_REGISTER(0x5400)
+#define RI_BASE               HOST_REGISTER(0x5430)
+#define COMP_BASE             HOST_REGISTER(0x5440)
+#define CFG_BASE              HOST_REGISTER(0x7F60)
+#define ITC_BASE              HOST_REGISTER(0x7F70)
+#define DM_BASE               HOST_REGISTER(0x7F90)
+
+#endif // STM8L15X_HOST_H_
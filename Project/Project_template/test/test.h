@@ -0,0 +1,82 @@
+#ifndef TEST_H_
+#define TEST_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+	Checks count the failures and go on, so one run shows every broken
+	case. Every case runs with TEST_RUN in a child process, so it finds the
+	firmware variables as a reset leaves them. main() returns TEST_RESULT().
+*/
+extern unsigned int test_failures;
+extern unsigned int test_checks;
+
+#define TEST_CHECK(condition) \
+	do \
+	{ \
+		test_checks ++; \
+		if (!(condition)) \
+		{ \
+			test_failures ++; \
+			printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+		} \
+	} while (0)
+
+/* Also prints the two values */
+#define TEST_CHECK_EQUAL(actual, expected) \
+	do \
+	{ \
+		long long test_actual = (long long)(actual); \
+		long long test_expected = (long long)(expected); \
+		test_checks ++; \
+		if (test_actual != test_expected) \
+		{ \
+			test_failures ++; \
+			printf("%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__, #actual, test_actual, test_expected); \
+		} \
+	} while (0)
+
+#define TEST_DEFINE \
+	unsigned int test_failures = 0; \
+	unsigned int test_checks = 0; \
+	unsigned int test_cases = 0; \
+	unsigned int test_cases_failed = 0;
+
+extern unsigned int test_cases;
+extern unsigned int test_cases_failed;
+
+static inline void test_run(void (*p_case)(void), const char *p_name)
+{
+	pid_t pid;
+	int status = 0;
+
+	fflush(stdout);
+	pid = fork();
+	if (pid == 0)
+	{
+		p_case();
+		printf("  %s: %u checks, %u failed\n", p_name, test_checks, test_failures);
+		fflush(stdout);
+		_exit((test_failures == 0) ? 0 : 1);
+	}
+	test_cases ++;
+	// A crash or an abort of the model fails the case too.
+	if ((pid < 0) || (waitpid(pid, &status, 0) != pid) || !WIFEXITED(status) || (WEXITSTATUS(status) != 0))
+	{
+		test_cases_failed ++;
+		if ((pid > 0) && WIFSIGNALED(status))
+		{
+			printf("  %s: killed by signal %d\n", p_name, WTERMSIG(status));
+		}
+	}
+}
+
+#define TEST_RUN(function)    test_run((function), #function)
+
+#define TEST_RESULT(name) \
+	(printf("%s: %u cases, %u failed\n", (name), test_cases, test_cases_failed), (test_cases_failed == 0) ? 0 : 1)
+
+#endif // TEST_H_
@@ -0,0 +1,320 @@
+#include <math.h>
+#include <time.h>
+
+#include "stm8l15x.h"
+
+#include "clock.h"
+#include "event.h"
+#include "settings.h"
+#include "timer.h"
+
+#include "host/host.h"
+#include "test.h"
+
+/*
+	battery.c is built into the test, so the model can fill its DMA buffer:
+	the wfi hook plays the ADC and the DMA, it writes the window of VREFINT
+	samples and raises the transfer complete interrupt. The PVD is modelled
+	here too, it trips when the supply crosses the level the firmware armed.
+
+	The mV conversion is checked against a float reference over every
+	VREFINT data it can be given, and the monitor over the way down to
+	critical and back, with the hysteresis above the low threshold.
+
+	Then the cost of the conversion, the integer division against the float
+	one it replaced. The host has no STM8 core to count cycles on, and its
+	TIM1 model only moves with the model's time, so host ns per conversion
+	are shown as the proxy. On the part, battery_mv_max_cycles() of
+	EVENT_ISR_PROFILE gives the SYSCLK cycles.
+*/
+#include "../src/battery.c"
+
+TEST_DEFINE
+
+#define TEST_VREF_MV            1224.0
+#define TEST_DATA_SCALE         (4096.0 * 16.0)   // 12 bit and 1/16 LSB.
+#define TEST_EVENTS_MAX         16
+#define TEST_PVD_VECTOR         5
+#define TEST_POLL_MS            10000             // BATTERY_POLL_PERIOD.
+#define TEST_SETTLE_MS          100
+#define TEST_COST_ROUNDS        200               // Over every VREFINT data each.
+
+/* PVD levels in mV, in the order of PWR_CSR1_PLS */
+static const u16 m_test_pvd_mv[] = {1850, 2050, 2260, 2450, 2650, 2850, 3050};
+
+static u32 m_sample_sum = 0;     // Sum of the samples of one measurement, as battery.c adds them.
+static u32 m_sample_index = 0;
+static u32 m_windows = 0;
+static u32 m_reads = 0;
+static u16 m_supply_mv = 0;
+
+static battery_event_t m_event[TEST_EVENTS_MAX];
+static u8 m_event_count = 0;
+
+static void test_battery_handler(battery_event_t battery_event)
+{
+	if (m_event_count < TEST_EVENTS_MAX)
+	{
+		m_event[m_event_count] = battery_event;
+	}
+	m_event_count ++;
+}
+
+// The samples of a measurement are spread so they add up to m_sample_sum exactly.
+static void test_adc_dma(void)
+{
+	u32 samples = (u32)1 << m_oversample;
+	u8 count;
+	u8 i;
+
+	if ((DMA1_Channel0->CCR & DMA_CCR_CE) == 0)
+	{
+		return;
+	}
+	TEST_CHECK((ADC1->CR1 & ADC_CR1_ADON) != 0);
+	if (m_sample_index == 0)
+	{
+		m_reads ++;
+	}
+	count = DMA1_Channel0->CNBTR;
+	for (i = 0; i < count; i ++)
+	{
+		m_adc_buffer[i] = (u16)((m_sample_sum + m_sample_index) / samples);
+		m_sample_index ++;
+	}
+	if (m_sample_index >= samples)
+	{
+		m_sample_index = 0;
+	}
+	m_windows ++;
+
+	// Transfer complete, as the interrupt would run it.
+	DMA1_Channel0->CSPR |= DMA_CSPR_TCIF;
+	battery_dma_handler();
+}
+
+// VREFINT data in 1/16 LSB, as get_ref_voltage_data() returns it.
+static void test_data(u16 data)
+{
+	m_sample_sum = (u32)data << (m_oversample - REF_DATA_FRACTION_SHIFT);
+	m_sample_index = 0;
+}
+
+static u16 test_pvd_level_mv(void)
+{
+	return m_test_pvd_mv[(PWR->CSR1 & PWR_CSR1_PLS) >> 1];
+}
+
+// Moves the supply, the PVD trips if it crosses the armed level either way.
+static void test_supply(u16 mv)
+{
+	u16 level_mv = test_pvd_level_mv();
+	bool is_crossed = ((m_supply_mv < level_mv) != (mv < level_mv)) ? TRUE : FALSE;
+
+	m_supply_mv = mv;
+	test_data((u16)lround(TEST_VREF_MV * TEST_DATA_SCALE / mv));
+	if ((is_crossed == TRUE) && ((PWR->CSR1 & PWR_CSR1_PVDE) != 0) && ((PWR->CSR1 & PWR_CSR1_PVDIEN) != 0))
+	{
+		PWR->CSR1 |= PWR_CSR1_PVDIF;
+		host_vector[TEST_PVD_VECTOR]();
+	}
+	host_run_ms(TEST_SETTLE_MS);
+}
+
+static void test_boot(void)
+{
+	host_reset();
+	host_vectors_install();
+	clock_init();
+	settings_init();
+	event_init();
+	timer_init();
+	host_wfi_hook = test_adc_dma;
+	m_event_count = 0;
+}
+
+static void test_mv_math(void)
+{
+	u32 data;
+	u16 mv;
+	double reference;
+	double error_max = 0;
+	u32 checked = 0;
+
+	test_boot();
+	battery_set_oversample(BATTERY_OVERSAMPLE_16);
+	test_data(0);
+	TEST_CHECK_EQUAL(read_battery_voltage_mv(), 0);
+	m_reads = 0;
+
+	// Below about 77 LSB the supply would be over 65 V and out of the u16.
+	for (data = 1; data <= 0xFFFF; data ++)
+	{
+		reference = TEST_VREF_MV * TEST_DATA_SCALE / data;
+		if (reference >= 0xFFFF)
+		{
+			continue;
+		}
+		test_data((u16)data);
+		mv = read_battery_voltage_mv();
+		if (fabs(mv - reference) > error_max)
+		{
+			error_max = fabs(mv - reference);
+		}
+		checked ++;
+	}
+	TEST_CHECK_EQUAL(checked, 65535 - 1224);
+	TEST_CHECK_EQUAL(m_reads, checked);
+	// Rounded to the nearest mV.
+	TEST_CHECK(error_max <= 0.5);
+	printf("  test_mv_math: %lu data values, error up to %.3f mV\n", (unsigned long)checked, error_max);
+}
+
+static double test_elapsed_ns(const struct timespec *p_start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (double)(end.tv_sec - p_start->tv_sec) * 1e9 + (double)(end.tv_nsec - p_start->tv_nsec);
+}
+
+static void test_mv_cost(void)
+{
+	struct timespec start;
+	volatile u32 sink = 0;   // Keeps the loops from being optimized away.
+	double integer_ns;
+	double float_ns;
+	u32 round;
+	u32 data;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (round = 0; round < TEST_COST_ROUNDS; round ++)
+	{
+		for (data = VREF_MV; data <= 0xFFFF; data ++)
+		{
+			sink += battery_data_to_mv((u16)data);
+		}
+	}
+	integer_ns = test_elapsed_ns(&start) / (TEST_COST_ROUNDS * (0x10000 - VREF_MV));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (round = 0; round < TEST_COST_ROUNDS; round ++)
+	{
+		for (data = VREF_MV; data <= 0xFFFF; data ++)
+		{
+			sink += (u16)((float)VREF_MV * (float)ADC_CONV / ((float)data / (1 << REF_DATA_FRACTION_SHIFT)) + 0.5f);
+		}
+	}
+	float_ns = test_elapsed_ns(&start) / (TEST_COST_ROUNDS * (0x10000 - VREF_MV));
+
+	printf("  mV conversion: integer %.2f ns, float %.2f ns on the host\n", integer_ns, float_ns);
+	TEST_CHECK(sink != 0);
+	TEST_CHECK_EQUAL(battery_data_to_mv(VREF_MV << REF_DATA_FRACTION_SHIFT), ADC_CONV);
+}
+
+static void test_oversample(void)
+{
+	static const battery_oversample_t oversample[] = {BATTERY_OVERSAMPLE_16, BATTERY_OVERSAMPLE_64, BATTERY_OVERSAMPLE_256};
+	static const u32 windows[] = {1, 1, 4};
+	u8 i;
+	u16 mv;
+
+	test_boot();
+	for (i = 0; i < sizeof(oversample) / sizeof(oversample[0]); i ++)
+	{
+		battery_set_oversample(oversample[i]);
+		test_supply(2700);
+		m_windows = 0;
+		mv = read_battery_voltage_mv();
+		TEST_CHECK(mv >= 2699);
+		TEST_CHECK(mv <= 2701);
+		TEST_CHECK_EQUAL(m_windows, windows[i]);
+		TEST_CHECK_EQUAL(m_sample_index, 0);
+		// Off as soon as the last window is in.
+		TEST_CHECK((ADC1->CR1 & ADC_CR1_ADON) == 0);
+		TEST_CHECK((DMA1_Channel0->CCR & DMA_CCR_CE) == 0);
+	}
+}
+
+static void test_hysteresis(void)
+{
+	u32 reads;
+
+	test_boot();
+	test_supply(3000);
+	battery_monitor_init(BATTERY_LOW_MV, BATTERY_CRITICAL_MV, test_battery_handler);
+	TEST_CHECK_EQUAL(m_event_count, 0);
+	TEST_CHECK_EQUAL(test_pvd_level_mv(), BATTERY_LOW_MV);
+
+	// Nothing is measured while the supply stays above the PVD level.
+	reads = m_reads;
+	host_run_ms(3 * TEST_POLL_MS);
+	TEST_CHECK_EQUAL(m_reads, reads);
+
+	test_supply(2400);
+	TEST_CHECK_EQUAL(m_event_count, 1);
+	TEST_CHECK_EQUAL(m_event[0], BATTERY_EVENT_LOW);
+	TEST_CHECK_EQUAL(test_pvd_level_mv(), BATTERY_CRITICAL_MV);
+
+	// Back over the low threshold, but not over the hysteresis: stays low.
+	test_supply(2480);
+	reads = m_reads;
+	host_run_ms(3 * TEST_POLL_MS);
+	TEST_CHECK_EQUAL(m_reads, reads + 3);
+	TEST_CHECK_EQUAL(m_event_count, 1);
+
+	test_supply(2520);
+	host_run_ms(TEST_POLL_MS);
+	TEST_CHECK_EQUAL(m_event_count, 2);
+	TEST_CHECK_EQUAL(m_event[1], BATTERY_EVENT_NORMAL);
+	TEST_CHECK_EQUAL(test_pvd_level_mv(), BATTERY_LOW_MV);
+	reads = m_reads;
+	host_run_ms(3 * TEST_POLL_MS);
+	TEST_CHECK_EQUAL(m_reads, reads);
+
+	test_supply(2440);
+	test_supply(2000);
+	TEST_CHECK_EQUAL(m_event_count, 4);
+	TEST_CHECK_EQUAL(m_event[2], BATTERY_EVENT_LOW);
+	TEST_CHECK_EQUAL(m_event[3], BATTERY_EVENT_CRITICAL);
+	TEST_CHECK_EQUAL(test_pvd_level_mv(), BATTERY_CRITICAL_MV);
+
+	// Up over the critical PVD level, still under the low one.
+	test_supply(2100);
+	TEST_CHECK_EQUAL(m_event_count, 5);
+	TEST_CHECK_EQUAL(m_event[4], BATTERY_EVENT_LOW);
+
+	test_supply(2600);
+	host_run_ms(TEST_POLL_MS);
+	TEST_CHECK_EQUAL(m_event_count, 6);
+	TEST_CHECK_EQUAL(m_event[5], BATTERY_EVENT_NORMAL);
+}
+
+static void test_low_at_init(void)
+{
+	test_boot();
+	test_supply(2300);
+	battery_monitor_init(BATTERY_LOW_MV, BATTERY_CRITICAL_MV, test_battery_handler);
+	TEST_CHECK_EQUAL(m_event_count, 1);
+	TEST_CHECK_EQUAL(m_event[0], BATTERY_EVENT_LOW);
+	TEST_CHECK_EQUAL(test_pvd_level_mv(), BATTERY_CRITICAL_MV);
+
+	test_supply(2000);
+	TEST_CHECK_EQUAL(m_event_count, 2);
+	TEST_CHECK_EQUAL(m_event[1], BATTERY_EVENT_CRITICAL);
+
+	test_supply(2700);
+	host_run_ms(TEST_POLL_MS);
+	TEST_CHECK_EQUAL(m_event_count, 3);
+	TEST_CHECK_EQUAL(m_event[2], BATTERY_EVENT_NORMAL);
+}
+
+int main(int argc, char **argv)
+{
+	TEST_RUN(test_mv_math);
+	TEST_RUN(test_mv_cost);
+	TEST_RUN(test_oversample);
+	TEST_RUN(test_hysteresis);
+	TEST_RUN(test_low_at_init);
+	return TEST_RESULT(argv[0]);
+}
@@ -0,0 +1,1264 @@
+#include <glob.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "stm8l15x.h"
+#include "stm8l15x_gpio.h"
+
+#include "clock.h"
+#include "event.h"
+#include "settings.h"
+#include "timer.h"
+#include "button.h"
+
+#include "host/host.h"
+#include "test.h"
+
+/*
+	Replays timestamped pin edges into the EXTI model and checks the button
+	events that come out. A trace is a text file of lines
+
+		time_us button level
+
+	with button 1 or 2 and level 0 for pushed, 1 for released, in time
+	order. Lines starting with # are comments, but for
+
+		# expect EVENT CLICKS
+
+	which give the events the trace must produce, in order. The traces in
+	traces/ are replayed and checked with the fixed cases.
+
+	  test_button                    fixed cases and the fuzzer
+	  test_button fuzz SEED COUNT    COUNT random traces from SEED
+	  test_button replay FILE        prints the events of a trace
+
+	The fuzzer makes bouncy traces where the buttons click, hold and
+	overlap, and checks that both buttons held for 3 s give one
+	DOUBLE_BTN_TRACK, that a shorter overlap gives none, and that no state
+	is left behind once the buttons are released. A failing trace is
+	written to build/test_button_fail.trace for replay.
+
+	It is guided by coverage: button.c is built into the test, and every
+	edge of a replay marks the pair of the timer_status it finds and its
+	level, along with the other button's timer_status and the double hold
+	tracked or not. A trace that marks a pair no trace marked before joins
+	the corpus, and every other trace is a corpus trace mutated at the
+	level of its holds: one made longer or shorter, moved, dropped, a new
+	one, or the other button held along to about the 3 s of the double
+	hold.
+*/
+#include "../src/button.c"
+
+TEST_DEFINE
+
+#define TRACE_EDGES_MAX         4096
+#define TRACE_HOLDS_MAX         512
+#define TRACE_EVENTS_MAX        1024
+#define TRACE_DURATION_US       60000000UL
+#define TRACE_BOUNCE_US         8000       // Bounces settle well inside the 30 ms debounce.
+#define TRACE_LEVEL_MIN_US      60000      // Shortest level, sampled at least once.
+#define TRACE_DOUBLE_US         3000000UL  // BUTTON_DOUBLE_BTN_TRACK_DURATION.
+#define TRACE_MARGIN_US         100000     // Debounce and tick rounding either way.
+#define TRACE_IDLE_MS           10000
+#define TRACE_FAIL_FILE         "build/test_button_fail.trace"
+#define TRACE_FILES             "traces/*.trace"
+#define TEST_EVENT_LATE_MS      50         // Debounce and tick rounding on top of a duration.
+#define TEST_TICK_US            10000
+#define TEST_SAMPLES            20000
+#define TEST_DEBOUNCE_EDGES     20000
+#define TEST_BENCH_RUNS         1000000
+#define BUTTON_DEBOUNCE_TICKS   3          // BUTTON_DEBONCE_DURATION.
+#define FUZZ_CORPUS_MAX         32
+#define FUZZ_STATUSES           (BUTTON_STATUS_DOUBLE_TRACK + 1)
+#define FUZZ_PAIRS              (2 * FUZZ_STATUSES * FUZZ_STATUSES * 2 * 2)
+
+typedef struct trace_edge_s
+{
+	u32 time_us;
+	u8  button;    // 0 or 1.
+	u8  level;     // 0 pushed.
+} trace_edge_t;
+
+typedef struct trace_hold_s
+{
+	u32 press_us;     // First edge of the push bounce.
+	u32 push_us;      // Last edge of the push bounce.
+	u32 release_us;   // First edge of the release bounce.
+} trace_hold_t;
+
+typedef struct trace_s
+{
+	trace_edge_t edge[TRACE_EDGES_MAX];
+	u16          edge_count;
+	trace_hold_t hold[2][TRACE_HOLDS_MAX];
+	u16          hold_count[2];
+} trace_t;
+
+typedef struct trace_event_s
+{
+	u32 time_us;
+	button_event_info_t info;
+} trace_event_t;
+
+/* An event a gesture case expects, the times are from the edges plus the
+   nominal durations */
+typedef struct test_expect_s
+{
+	button_event_t event;
+	u32 time_ms;
+	u8  click_count;
+	u16 hold_ms;
+} test_expect_t;
+
+/* Totals of the fuzzer, shared with the child that runs each trace */
+typedef struct fuzz_stats_s
+{
+	u32 edges;
+	u32 events;
+	u32 doubles;
+	u32 virtual_ms;
+	u8  pair[FUZZ_PAIRS];   // Edge pairs met, see trace_replay().
+} fuzz_stats_t;
+
+static const u8 m_trace_pin[2] = {GPIO_Pin_6, GPIO_Pin_7};
+
+static trace_t m_trace;
+static trace_event_t m_event[TRACE_EVENTS_MAX];
+static u16 m_event_count = 0;
+static u32 m_random = 1;
+static u8 *m_p_pair = NULL;       // The fuzzer's pairs, NULL out of it.
+
+static trace_t m_corpus[FUZZ_CORPUS_MAX];
+
+static const char *test_event_name(button_event_t event)
+{
+	static const char *const p_name[] =
+	{
+		"INVALID",
+		"BUTTON1_SHORT_PRESS", "BUTTON1_DOUBLE_PRESS", "BUTTON1_LONG_HOLD", "BUTTON1_LONG_PRESS",
+		"BUTTON1_VERY_LONG_HOLD", "BUTTON1_VERY_LONG_PRESS", "BUTTON1_MULTI_PRESS",
+		"BUTTON2_SHORT_PRESS", "BUTTON2_DOUBLE_PRESS", "BUTTON2_LONG_HOLD", "BUTTON2_LONG_PRESS",
+		"BUTTON2_VERY_LONG_HOLD", "BUTTON2_VERY_LONG_PRESS", "BUTTON2_MULTI_PRESS",
+		"DOUBLE_BTN_TRACK"
+	};
+
+	return ((u8)event <= DOUBLE_BTN_TRACK) ? p_name[event] : "?";
+}
+
+static void test_button_handler(const button_event_info_t *p_event)
+{
+	if (m_event_count < TRACE_EVENTS_MAX)
+	{
+		m_event[m_event_count].time_us = host_now_us();
+		m_event[m_event_count].info = *p_event;
+		m_event_count ++;
+	}
+}
+
+static void test_boot(void)
+{
+	host_reset();
+	host_vectors_install();
+	host_eeprom_erase();
+	clock_init();
+	settings_init();
+	event_init();
+	timer_init();
+	button_init(test_button_handler);
+	m_event_count = 0;
+}
+
+static void test_press(u8 button, u32 hold_ms)
+{
+	host_pin_write(GPIOB, m_trace_pin[button], FALSE);
+	host_run_ms(hold_ms);
+	host_pin_write(GPIOB, m_trace_pin[button], TRUE);
+}
+
+static u16 test_count(button_event_t event, u32 from_us, u32 to_us)
+{
+	u16 index;
+	u16 count = 0;
+
+	for (index = 0; index < m_event_count; index ++)
+	{
+		if ((m_event[index].info.event == event) &&
+		    (m_event[index].time_us >= from_us) && (m_event[index].time_us <= to_us))
+		{
+			count ++;
+		}
+	}
+	return count;
+}
+
+/* Trace generation -------------------------------------------------------*/
+
+static u32 test_random(u32 low, u32 high)
+{
+	m_random = m_random * 1103515245UL + 12345UL;
+	return low + ((m_random >> 8) % (high - low + 1));
+}
+
+static void trace_add_edge(trace_t *p_trace, u32 time_us, u8 button, u8 level)
+{
+	if (p_trace->edge_count < TRACE_EDGES_MAX)
+	{
+		p_trace->edge[p_trace->edge_count].time_us = time_us;
+		p_trace->edge[p_trace->edge_count].button = button;
+		p_trace->edge[p_trace->edge_count].level = level;
+		p_trace->edge_count ++;
+	}
+}
+
+/* An edge to level with a few bounces after it, returns the time of the last */
+static u32 trace_add_bouncy_edge(trace_t *p_trace, u32 time_us, u8 button, u8 level)
+{
+	u8 bounces = (u8)test_random(0, 3) * 2;
+
+	trace_add_edge(p_trace, time_us, button, level);
+	while (bounces > 0)
+	{
+		time_us += test_random(50, TRACE_BOUNCE_US / 6);
+		trace_add_edge(p_trace, time_us, button, (u8)(level ^ (~bounces & 1)));
+		bounces --;
+	}
+	return time_us;
+}
+
+static void trace_add_press(trace_t *p_trace, u8 button, u32 push_us, u32 release_us)
+{
+	trace_hold_t *p_hold = &p_trace->hold[button][p_trace->hold_count[button]];
+
+	if (p_trace->hold_count[button] >= TRACE_HOLDS_MAX)
+	{
+		return;
+	}
+	p_hold->press_us = push_us;
+	p_hold->push_us = trace_add_bouncy_edge(p_trace, push_us, button, 0);
+	p_hold->release_us = release_us;
+	trace_add_bouncy_edge(p_trace, release_us, button, 1);
+	p_trace->hold_count[button] ++;
+}
+
+static u32 trace_hold_us(void)
+{
+	switch (test_random(0, 9))
+	{
+		case 0: case 1: case 2: case 3: case 4:
+		{
+			return test_random(TRACE_LEVEL_MIN_US, 400000);
+		}
+		case 5: case 6:
+		{
+			return test_random(500000, 2500000);
+		}
+		default:
+		{
+			return test_random(2500000, 6000000);
+		}
+	}
+}
+
+/* Clicks and holds of one button from time_us, returns the end */
+static u32 trace_add_presses(trace_t *p_trace, u8 button, u32 time_us)
+{
+	u8 presses = (u8)test_random(1, 5);
+	u32 hold_us;
+
+	while (presses > 0)
+	{
+		hold_us = trace_hold_us();
+		trace_add_press(p_trace, button, time_us, time_us + hold_us);
+		time_us += hold_us + TRACE_BOUNCE_US + test_random(TRACE_LEVEL_MIN_US, 450000);
+		presses --;
+	}
+	return time_us;
+}
+
+static int trace_edge_compare(const void *p_a, const void *p_b)
+{
+	const trace_edge_t *p_edge_a = p_a;
+	const trace_edge_t *p_edge_b = p_b;
+
+	if (p_edge_a->time_us != p_edge_b->time_us)
+	{
+		return (p_edge_a->time_us < p_edge_b->time_us) ? -1 : 1;
+	}
+	return (int)p_edge_a->button - (int)p_edge_b->button;
+}
+
+static void trace_generate(trace_t *p_trace, u32 seed)
+{
+	u32 time_us;
+	u32 end_us[2];
+	u32 offset_us;
+	u32 overlap_us;
+	u8  first;
+
+	memset(p_trace, 0, sizeof(*p_trace));
+	m_random = seed;
+	time_us = test_random(100000, 1000000);
+	while (time_us < TRACE_DURATION_US)
+	{
+		switch (test_random(0, 2))
+		{
+			case 0:
+			{
+				// Both held, around the 3 s of the double hold.
+				first = (u8)test_random(0, 1);
+				offset_us = test_random(TRACE_BOUNCE_US, 600000);
+				overlap_us = test_random(1000000, 5000000);
+				end_us[first] = time_us + offset_us + overlap_us + test_random(0, 600000);
+				end_us[first ^ 1] = time_us + offset_us + overlap_us;
+				if (test_random(0, 1) == 0)
+				{
+					u32 swap_us = end_us[0];
+
+					end_us[0] = end_us[1];
+					end_us[1] = swap_us;
+				}
+				trace_add_press(p_trace, first, time_us, end_us[first]);
+				trace_add_press(p_trace, (u8)(first ^ 1), time_us + offset_us, end_us[first ^ 1]);
+				time_us = (end_us[0] > end_us[1]) ? end_us[0] : end_us[1];
+				break;
+			}
+			case 1:
+			{
+				time_us = trace_add_presses(p_trace, (u8)test_random(0, 1), time_us);
+				break;
+			}
+			default:
+			{
+				// Both at will, the presses may overlap anyhow.
+				end_us[0] = trace_add_presses(p_trace, 0, time_us + test_random(0, 500000));
+				end_us[1] = trace_add_presses(p_trace, 1, time_us + test_random(0, 500000));
+				time_us = (end_us[0] > end_us[1]) ? end_us[0] : end_us[1];
+				break;
+			}
+		}
+		time_us += TRACE_BOUNCE_US + test_random(TRACE_LEVEL_MIN_US, 3000000);
+	}
+	qsort(p_trace->edge, p_trace->edge_count, sizeof(p_trace->edge[0]), trace_edge_compare);
+}
+
+static int trace_hold_compare(const void *p_a, const void *p_b)
+{
+	const trace_hold_t *p_hold_a = p_a;
+	const trace_hold_t *p_hold_b = p_b;
+
+	if (p_hold_a->press_us != p_hold_b->press_us)
+	{
+		return (p_hold_a->press_us < p_hold_b->press_us) ? -1 : 1;
+	}
+	return 0;
+}
+
+/* Makes the edges again from the holds, with new bounces. A hold too short,
+   or too close after the one before of its button, is dropped */
+static void trace_rebuild(trace_t *p_trace)
+{
+	trace_hold_t hold[TRACE_HOLDS_MAX];
+	u16 count;
+	u16 index;
+	u32 free_us;
+	u8  button;
+
+	p_trace->edge_count = 0;
+	for (button = 0; button < 2; button ++)
+	{
+		count = p_trace->hold_count[button];
+		memcpy(hold, p_trace->hold[button], count * sizeof(hold[0]));
+		qsort(hold, count, sizeof(hold[0]), trace_hold_compare);
+		p_trace->hold_count[button] = 0;
+		free_us = TRACE_LEVEL_MIN_US;
+		for (index = 0; index < count; index ++)
+		{
+			if ((hold[index].press_us < free_us) ||
+			    (hold[index].release_us < hold[index].press_us + TRACE_LEVEL_MIN_US))
+			{
+				continue;
+			}
+			trace_add_press(p_trace, button, hold[index].press_us, hold[index].release_us);
+			free_us = hold[index].release_us + TRACE_BOUNCE_US + TRACE_LEVEL_MIN_US;
+		}
+	}
+	qsort(p_trace->edge, p_trace->edge_count, sizeof(p_trace->edge[0]), trace_edge_compare);
+}
+
+/* A few changes to the holds of a corpus trace */
+static void trace_mutate(trace_t *p_trace, u32 seed)
+{
+	trace_hold_t *p_hold;
+	trace_hold_t *p_other;
+	u8  mutations;
+	u8  button;
+	u16 count;
+	u32 shift_us;
+
+	m_random = seed;
+	for (mutations = (u8)test_random(1, 4); mutations > 0; mutations --)
+	{
+		button = (u8)test_random(0, 1);
+		count = p_trace->hold_count[button];
+		p_hold = (count > 0) ? &p_trace->hold[button][test_random(0, count - 1)] : NULL;
+		switch ((p_hold != NULL) ? test_random(0, 4) : 4)
+		{
+			case 0:
+			{
+				// Another length, maybe past the 2 s or 5 s of a hold.
+				p_hold->release_us = p_hold->press_us + trace_hold_us();
+				break;
+			}
+			case 1:
+			{
+				// Up to a second earlier or later.
+				shift_us = test_random(0, 2000000);
+				if ((shift_us < 1000000) && (p_hold->press_us > 1000000))
+				{
+					p_hold->press_us -= shift_us;
+					p_hold->release_us -= shift_us;
+				}
+				else
+				{
+					p_hold->press_us += shift_us - 1000000;
+					p_hold->release_us += shift_us - 1000000;
+				}
+				break;
+			}
+			case 2:
+			{
+				// The other button held along, for about the 3 s of the double hold.
+				if (p_trace->hold_count[button ^ 1] >= TRACE_HOLDS_MAX)
+				{
+					break;
+				}
+				p_other = &p_trace->hold[button ^ 1][p_trace->hold_count[button ^ 1]];
+				p_other->press_us = p_hold->press_us + test_random(TRACE_BOUNCE_US, 600000);
+				p_other->release_us = p_other->press_us + test_random(TRACE_DOUBLE_US - 3 * TRACE_MARGIN_US,
+				                                                      TRACE_DOUBLE_US + 3 * TRACE_MARGIN_US);
+				if (p_hold->release_us < p_other->release_us)
+				{
+					p_hold->release_us = p_other->release_us + test_random(0, 600000);
+				}
+				p_trace->hold_count[button ^ 1] ++;
+				break;
+			}
+			case 3:
+			{
+				// Dropped.
+				*p_hold = p_trace->hold[button][count - 1];
+				p_trace->hold_count[button] --;
+				break;
+			}
+			default:
+			{
+				// A new press anywhere.
+				if (count >= TRACE_HOLDS_MAX)
+				{
+					break;
+				}
+				p_hold = &p_trace->hold[button][count];
+				p_hold->press_us = test_random(TRACE_LEVEL_MIN_US, TRACE_DURATION_US);
+				p_hold->release_us = p_hold->press_us + trace_hold_us();
+				p_trace->hold_count[button] ++;
+				break;
+			}
+		}
+	}
+	trace_rebuild(p_trace);
+}
+
+static void trace_write(const trace_t *p_trace, const char *p_file, const char *p_comment)
+{
+	FILE *p_out = fopen(p_file, "w");
+	u16 index;
+
+	if (p_out == NULL)
+	{
+		return;
+	}
+	fprintf(p_out, "# %s\n# time_us button level\n", p_comment);
+	for (index = 0; index < p_trace->edge_count; index ++)
+	{
+		fprintf(p_out, "%lu %u %u\n", (unsigned long)p_trace->edge[index].time_us,
+		        p_trace->edge[index].button + 1, p_trace->edge[index].level);
+	}
+	fclose(p_out);
+}
+
+/* Reads the edges of a trace file, the holds are not needed to replay */
+static bool trace_read(trace_t *p_trace, const char *p_file)
+{
+	FILE *p_in = fopen(p_file, "r");
+	char line[128];
+	unsigned long time_us;
+	unsigned int button;
+	unsigned int level;
+
+	if (p_in == NULL)
+	{
+		return FALSE;
+	}
+	memset(p_trace, 0, sizeof(*p_trace));
+	while (fgets(line, sizeof(line), p_in) != NULL)
+	{
+		if ((line[0] != '#') && (sscanf(line, "%lu %u %u", &time_us, &button, &level) == 3) &&
+		    (button >= 1) && (button <= 2))
+		{
+			trace_add_edge(p_trace, (u32)time_us, (u8)(button - 1), (u8)(level != 0));
+		}
+	}
+	fclose(p_in);
+	return TRUE;
+}
+
+/* Reads the # expect lines of a trace file, returns how many there are */
+static u16 trace_read_expect(const char *p_file, test_expect_t *p_expect, u16 expect_max)
+{
+	FILE *p_in = fopen(p_file, "r");
+	char line[128];
+	char name[64];
+	unsigned int clicks;
+	u16 count = 0;
+	u8  event;
+
+	if (p_in == NULL)
+	{
+		return 0;
+	}
+	while ((fgets(line, sizeof(line), p_in) != NULL) && (count < expect_max))
+	{
+		if (sscanf(line, "# expect %63s %u", name, &clicks) == 2)
+		{
+			memset(&p_expect[count], 0, sizeof(p_expect[count]));
+			for (event = 0; event <= DOUBLE_BTN_TRACK; event ++)
+			{
+				if (strcmp(name, test_event_name((button_event_t)event)) == 0)
+				{
+					p_expect[count].event = (button_event_t)event;
+				}
+			}
+			p_expect[count].click_count = (u8)clicks;
+			count ++;
+		}
+	}
+	fclose(p_in);
+	return count;
+}
+
+/* Replay and checks ------------------------------------------------------*/
+
+static void trace_replay(const trace_t *p_trace)
+{
+	u16 index;
+	u32 now_us;
+	u8  button;
+
+	for (index = 0; index < p_trace->edge_count; index ++)
+	{
+		now_us = host_now_us();
+		if (p_trace->edge[index].time_us > now_us)
+		{
+			host_run_us(p_trace->edge[index].time_us - now_us);
+		}
+		if (m_p_pair != NULL)
+		{
+			button = p_trace->edge[index].button;
+			m_p_pair[(((button * FUZZ_STATUSES + m_button[button].timer_status) * FUZZ_STATUSES +
+			           m_button[button ^ 1].timer_status) * 2 + p_trace->edge[index].level) * 2 +
+			         ((double_button_track == TRUE) ? 1 : 0)] = 1;
+		}
+		host_pin_write(GPIOB, m_trace_pin[p_trace->edge[index].button],
+		               (p_trace->edge[index].level != 0) ? TRUE : FALSE);
+	}
+	host_run_ms(TRACE_IDLE_MS);
+}
+
+/* Failures of the checks against the holds of the trace */
+static u32 trace_check(const trace_t *p_trace)
+{
+	u32 failures = test_failures;
+	u16 first;
+	u16 second;
+	u16 index;
+	u16 doubles = 0;
+	u32 from_us;
+	u32 to_us;
+
+	// Every overlap of a hold of each button.
+	for (first = 0; first < p_trace->hold_count[0]; first ++)
+	{
+		for (second = 0; second < p_trace->hold_count[1]; second ++)
+		{
+			const trace_hold_t *p_first = &p_trace->hold[0][first];
+			const trace_hold_t *p_second = &p_trace->hold[1][second];
+
+			from_us = (p_first->push_us > p_second->push_us) ? p_first->push_us : p_second->push_us;
+			to_us = (p_first->release_us < p_second->release_us) ? p_first->release_us : p_second->release_us;
+			if (to_us <= from_us)
+			{
+				continue;
+			}
+			if (to_us - from_us >= TRACE_DOUBLE_US + TRACE_MARGIN_US)
+			{
+				TEST_CHECK_EQUAL(test_count(DOUBLE_BTN_TRACK, from_us, to_us + TRACE_MARGIN_US), 1);
+				doubles ++;
+			}
+			else if (to_us - from_us <= TRACE_DOUBLE_US - TRACE_MARGIN_US)
+			{
+				TEST_CHECK_EQUAL(test_count(DOUBLE_BTN_TRACK, from_us, to_us + TRACE_MARGIN_US), 0);
+			}
+			else
+			{
+				doubles += test_count(DOUBLE_BTN_TRACK, from_us, to_us + TRACE_MARGIN_US);
+			}
+		}
+	}
+	// None outside the overlaps.
+	TEST_CHECK_EQUAL(test_count(DOUBLE_BTN_TRACK, 0, 0xFFFFFFFF), doubles);
+
+	// Released for a while, nothing may be left masked, timed or queued.
+	TEST_CHECK(GPIO_ReadInputDataBit(GPIOB, GPIO_Pin_6) != RESET);
+	TEST_CHECK(GPIO_ReadInputDataBit(GPIOB, GPIO_Pin_7) != RESET);
+#ifndef BUTTON_SAMPLED_DEBOUNCE
+	TEST_CHECK((GPIOB->CR2 & (GPIO_Pin_6 | GPIO_Pin_7)) == (GPIO_Pin_6 | GPIO_Pin_7));
+	TEST_CHECK_EQUAL(timer_next_expiry(), TIMER_NO_EXPIRY);
+#endif
+	TEST_CHECK(event_is_empty() == TRUE);
+
+	// And a click still comes out as one.
+	for (index = 0; index < 2; index ++)
+	{
+		from_us = host_now_us();
+		test_press((u8)index, 150);
+		host_run_ms(1000);
+		TEST_CHECK_EQUAL(test_count((index == 0) ? BUTTON1_SHORT_PRESS : BUTTON2_SHORT_PRESS, from_us, host_now_us()), 1);
+	}
+	return test_failures - failures;
+}
+
+/* Fixed cases ------------------------------------------------------------*/
+
+/* Replays the edges and checks the events, in order and in time */
+static void test_gesture(const trace_edge_t *p_edge, u16 edge_count, const test_expect_t *p_expect, u16 expect_count)
+{
+	const trace_event_t *p_event;
+	u16 index;
+
+	test_boot();
+	memset(&m_trace, 0, sizeof(m_trace));
+	for (index = 0; index < edge_count; index ++)
+	{
+		trace_add_edge(&m_trace, p_edge[index].time_us, p_edge[index].button, p_edge[index].level);
+	}
+	trace_replay(&m_trace);
+	TEST_CHECK_EQUAL(m_event_count, expect_count);
+	for (index = 0; (index < m_event_count) && (index < expect_count); index ++)
+	{
+		p_event = &m_event[index];
+		TEST_CHECK_EQUAL(p_event->info.event, p_expect[index].event);
+		TEST_CHECK(p_event->time_us / 1000 >= p_expect[index].time_ms);
+		TEST_CHECK(p_event->time_us / 1000 <= p_expect[index].time_ms + TEST_EVENT_LATE_MS);
+		TEST_CHECK_EQUAL(p_event->info.click_count, p_expect[index].click_count);
+		TEST_CHECK(p_event->info.hold_ms >= p_expect[index].hold_ms);
+		TEST_CHECK(p_event->info.hold_ms <= p_expect[index].hold_ms + TEST_EVENT_LATE_MS);
+	}
+}
+
+#define TEST_GESTURE(edge, expect) \
+	test_gesture((edge), sizeof(edge) / sizeof((edge)[0]), (expect), sizeof(expect) / sizeof((expect)[0]))
+
+/* Released under 2 s, reported once the window for a next click is over */
+static void test_short_press(void)
+{
+	static const trace_edge_t edge[] = {{100000, 0, 0}, {250000, 0, 1}};
+	static const test_expect_t expect[] = {{BUTTON1_SHORT_PRESS, 750, 1, 150}};
+
+	TEST_GESTURE(edge, expect);
+}
+
+/* The bounces of both edges are one click */
+static void test_bouncy_press(void)
+{
+	static const trace_edge_t edge[] =
+	{
+		{100000, 1, 0}, {100400, 1, 1}, {101300, 1, 0}, {102000, 1, 1}, {104500, 1, 0},
+		{230000, 1, 1}, {231200, 1, 0}, {231900, 1, 1}, {236000, 1, 0}, {237500, 1, 1}
+	};
+	static const test_expect_t expect[] = {{BUTTON2_SHORT_PRESS, 730, 1, 130}};
+
+	TEST_GESTURE(edge, expect);
+	// Stamped at the first edge, or at the first sample after the last bounce.
+#ifdef BUTTON_SAMPLED_DEBOUNCE
+	TEST_CHECK(m_event[0].info.press_ms > 104);
+	TEST_CHECK(m_event[0].info.press_ms <= 104 + TEST_TICK_US / 1000);
+#else
+	TEST_CHECK_EQUAL(m_event[0].info.press_ms, 100);
+#endif
+}
+
+static void test_long_press(void)
+{
+	static const trace_edge_t edge[] = {{100000, 0, 0}, {3100000, 0, 1}};
+	static const test_expect_t expect[] =
+	{
+		{BUTTON1_LONG_HOLD, 2100, 1, 2000},
+		{BUTTON1_LONG_PRESS, 3100, 1, 3000}
+	};
+
+	TEST_GESTURE(edge, expect);
+}
+
+static void test_very_long_press(void)
+{
+	static const trace_edge_t edge[] = {{100000, 1, 0}, {6500000, 1, 1}};
+	static const test_expect_t expect[] =
+	{
+		{BUTTON2_LONG_HOLD, 2100, 1, 2000},
+		{BUTTON2_VERY_LONG_HOLD, 5100, 1, 5000},
+		{BUTTON2_VERY_LONG_PRESS, 6500, 1, 6400}
+	};
+
+	TEST_GESTURE(edge, expect);
+}
+
+/* Each button goes through its own gesture, in its own events */
+static void test_two_buttons(void)
+{
+	static const trace_edge_t edge[] =
+	{
+		{100000, 1, 0}, {200000, 1, 1},
+		{1000000, 0, 0}, {3500000, 0, 1},
+		{4000000, 1, 0}, {4150000, 1, 1}
+	};
+	static const test_expect_t expect[] =
+	{
+		{BUTTON2_SHORT_PRESS, 700, 1, 100},
+		{BUTTON1_LONG_HOLD, 3000, 1, 2000},
+		{BUTTON1_LONG_PRESS, 3500, 1, 2500},
+		{BUTTON2_SHORT_PRESS, 4650, 1, 150}
+	};
+
+	TEST_GESTURE(edge, expect);
+}
+
+/* A click of one button while the other is held starts the double hold
+   tracking, which drops the gestures of both */
+static void test_overlap_drops_gestures(void)
+{
+	static const trace_edge_t edge[] =
+	{
+		{100000, 1, 0}, {200000, 1, 1},
+		{1000000, 0, 0}, {1100000, 1, 0}, {1250000, 1, 1}, {3500000, 0, 1}
+	};
+	static const test_expect_t expect[] = {{BUTTON2_SHORT_PRESS, 700, 1, 100}};
+
+	TEST_GESTURE(edge, expect);
+}
+
+/* The click count goes on while each click comes within the window of the
+   last one, a sequence is reported once the window is over */
+static void test_double_press(void)
+{
+	static const trace_edge_t edge[] = {{100000, 0, 0}, {220000, 0, 1}, {400000, 0, 0}, {520000, 0, 1}};
+	static const test_expect_t expect[] = {{BUTTON1_DOUBLE_PRESS, 1020, 2, 120}};
+
+	TEST_GESTURE(edge, expect);
+}
+
+static void test_triple_press(void)
+{
+	static const trace_edge_t edge[] =
+	{
+		{100000, 1, 0}, {200000, 1, 1}, {350000, 1, 0}, {450000, 1, 1}, {600000, 1, 0}, {700000, 1, 1}
+	};
+	static const test_expect_t expect[] = {{BUTTON2_MULTI_PRESS, 1200, 3, 100}};
+
+	TEST_GESTURE(edge, expect);
+}
+
+/* BUTTON_CLICK_MAX clicks are reported at the release, without the wait,
+   and the next click starts over */
+static void test_click_max(void)
+{
+	static const trace_edge_t edge[] =
+	{
+		{100000, 0, 0}, {200000, 0, 1}, {350000, 0, 0}, {450000, 0, 1},
+		{600000, 0, 0}, {700000, 0, 1}, {850000, 0, 0}, {950000, 0, 1},
+		{1100000, 0, 0}, {1200000, 0, 1}
+	};
+	static const test_expect_t expect[] =
+	{
+		{BUTTON1_MULTI_PRESS, 950, 4, 100},
+		{BUTTON1_SHORT_PRESS, 1700, 1, 100}
+	};
+
+	TEST_GESTURE(edge, expect);
+}
+
+/* A click after the window is a sequence of its own */
+static void test_click_after_window(void)
+{
+	static const trace_edge_t edge[] = {{100000, 0, 0}, {200000, 0, 1}, {800000, 0, 0}, {900000, 0, 1}};
+	static const test_expect_t expect[] =
+	{
+		{BUTTON1_SHORT_PRESS, 700, 1, 100},
+		{BUTTON1_SHORT_PRESS, 1400, 1, 100}
+	};
+
+	TEST_GESTURE(edge, expect);
+}
+
+/* Clicks of the other button in between do not break a sequence */
+static void test_click_interleaved(void)
+{
+	static const trace_edge_t edge[] =
+	{
+		{100000, 0, 0}, {200000, 0, 1}, {300000, 1, 0}, {400000, 1, 1}, {500000, 0, 0}, {600000, 0, 1}
+	};
+	static const test_expect_t expect[] =
+	{
+		{BUTTON2_SHORT_PRESS, 900, 1, 100},
+		{BUTTON1_DOUBLE_PRESS, 1100, 2, 100}
+	};
+
+	TEST_GESTURE(edge, expect);
+}
+
+/* Replays a trace file and checks the events of its # expect lines */
+static void test_trace_file(const char *p_file)
+{
+	test_expect_t expect[16];
+	u16 expect_count;
+	u16 index;
+
+	expect_count = trace_read_expect(p_file, expect, sizeof(expect) / sizeof(expect[0]));
+	TEST_CHECK(expect_count != 0);
+	TEST_CHECK(trace_read(&m_trace, p_file) == TRUE);
+	test_boot();
+	trace_replay(&m_trace);
+	TEST_CHECK_EQUAL(m_event_count, expect_count);
+	for (index = 0; (index < m_event_count) && (index < expect_count); index ++)
+	{
+		TEST_CHECK_EQUAL(m_event[index].info.event, expect[index].event);
+		TEST_CHECK_EQUAL(m_event[index].info.click_count, expect[index].click_count);
+	}
+}
+
+/* Every trace of traces/, each from reset RAM */
+static void test_traces(void)
+{
+	glob_t files;
+	size_t file;
+	pid_t pid;
+	int status;
+
+	TEST_CHECK(glob(TRACE_FILES, 0, NULL, &files) == 0);
+	for (file = 0; file < files.gl_pathc; file ++)
+	{
+		fflush(stdout);
+		pid = fork();
+		if (pid == 0)
+		{
+			test_trace_file(files.gl_pathv[file]);
+			fflush(stdout);
+			_exit((test_failures == 0) ? 0 : 1);
+		}
+		test_checks ++;
+		if ((waitpid(pid, &status, 0) != pid) || !WIFEXITED(status) || (WEXITSTATUS(status) != 0))
+		{
+			printf("  %s failed\n", files.gl_pathv[file]);
+			test_failures ++;
+		}
+	}
+	printf("  %u traces\n", (unsigned int)files.gl_pathc);
+	globfree(&files);
+}
+
+static void test_double_hold(u8 first)
+{
+	u8 second = (u8)(first ^ 1);
+
+	test_boot();
+	host_pin_write(GPIOB, m_trace_pin[first], FALSE);
+	host_run_ms(500);
+	host_pin_write(GPIOB, m_trace_pin[second], FALSE);
+	host_run_ms(2900);
+	TEST_CHECK_EQUAL(test_count(DOUBLE_BTN_TRACK, 0, host_now_us()), 0);
+	host_run_ms(200);
+	TEST_CHECK_EQUAL(test_count(DOUBLE_BTN_TRACK, 0, host_now_us()), 1);
+	host_pin_write(GPIOB, m_trace_pin[first] | m_trace_pin[second], TRUE);
+	host_run_ms(TRACE_IDLE_MS);
+	TEST_CHECK_EQUAL(test_count(DOUBLE_BTN_TRACK, 0, host_now_us()), 1);
+	// The double hold takes over both buttons, neither reports a hold.
+	TEST_CHECK_EQUAL(test_count(BUTTON1_LONG_PRESS, 0, host_now_us()), 0);
+	TEST_CHECK_EQUAL(test_count(BUTTON2_LONG_PRESS, 0, host_now_us()), 0);
+}
+
+static void test_double_hold_button1_first(void)
+{
+	test_double_hold(0);
+}
+
+static void test_double_hold_button2_first(void)
+{
+	test_double_hold(1);
+}
+
+static void test_double_hold_short(void)
+{
+	test_boot();
+	host_pin_write(GPIOB, GPIO_Pin_6 | GPIO_Pin_7, FALSE);
+	host_run_ms(2500);
+	host_pin_write(GPIOB, GPIO_Pin_7, TRUE);
+	host_run_ms(3000);
+	host_pin_write(GPIOB, GPIO_Pin_6, TRUE);
+	host_run_ms(TRACE_IDLE_MS);
+	TEST_CHECK_EQUAL(test_count(DOUBLE_BTN_TRACK, 0, host_now_us()), 0);
+}
+
+/* Debouncers -------------------------------------------------------------*/
+
+static double test_elapsed_ns(const struct timespec *p_start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (double)(end.tv_sec - p_start->tv_sec) * 1e9 + (double)(end.tv_nsec - p_start->tv_nsec);
+}
+
+#ifdef BUTTON_SAMPLED_DEBOUNCE
+/*
+	The vertical counter against a counter per pin: a level flips after 4
+	samples in a row that differ from it. The pins are set between the
+	ticks, so every sample sees them, with stretches of noise of any
+	density. Pins of BUTTON_PORT that are no button toggle at random.
+*/
+static void test_vertical_counter(void)
+{
+	u8  level[2] = {1, 1};
+	u8  state[2] = {1, 1};
+	u8  count[2] = {0, 0};
+	u16 changes[2] = {0, 0};
+	u32 sample;
+	u32 flip_tenths = 0;
+	u8  button;
+	button_stats_t stats;
+
+	test_boot();
+	host_run_us(TEST_TICK_US / 2);
+	for (sample = 0; sample < TEST_SAMPLES; sample ++)
+	{
+		if ((sample % 50) == 0)
+		{
+			flip_tenths = test_random(0, 5);
+		}
+		for (button = 0; button < 2; button ++)
+		{
+			if (test_random(0, 9) < flip_tenths)
+			{
+				level[button] ^= 1;
+				host_pin_write(GPIOB, m_trace_pin[button], (level[button] != 0) ? TRUE : FALSE);
+			}
+			count[button] = (level[button] != state[button]) ? (u8)(count[button] + 1) : 0;
+			if (count[button] == 4)
+			{
+				state[button] = level[button];
+				count[button] = 0;
+				changes[button] ++;
+			}
+		}
+		host_pin_write(GPIOB, GPIO_Pin_2 | GPIO_Pin_3, (test_random(0, 1) == 0) ? TRUE : FALSE);
+		host_run_us(TEST_TICK_US);
+	}
+	for (button = 0; button < 2; button ++)
+	{
+		button_get_stats(button, &stats);
+		TEST_CHECK_EQUAL(stats.change_count, changes[button]);
+		TEST_CHECK_EQUAL(stats.irq_count, 0);
+	}
+	printf("  %u and %u level changes in %lu samples\n", changes[0], changes[1], (unsigned long)TEST_SAMPLES);
+}
+
+/* Host time of a sample with the pins at rest, the cost of every tick */
+static void test_debounce_cost(void)
+{
+	struct timespec start;
+	u32 run;
+
+	test_boot();
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (run = 0; run < TEST_BENCH_RUNS; run ++)
+	{
+		btn_sample_timeout_handler(TIMER_ID_BUTTON_SAMPLE);
+	}
+	printf("  sampled: %.1f ns per tick on the host, every tick\n", test_elapsed_ns(&start) / TEST_BENCH_RUNS);
+}
+#else
+static u32 test_away_from_tick(u32 boot_us, u32 time_us)
+{
+	u32 phase_us = (time_us - boot_us) % TEST_TICK_US;
+
+	if (phase_us < 300)
+	{
+		return time_us + 300;
+	}
+	if (phase_us > TEST_TICK_US - 300)
+	{
+		return time_us + 600;
+	}
+	return time_us;
+}
+
+/*
+	The EXTI debouncer against a model of it: an edge on an unmasked pin
+	takes an interrupt and masks the pin, the debounce timer started on that
+	tick expires 3 ticks later and the level then is the new one if it
+	differs. Edges come in bursts of bounces and quiet stretches, on both
+	buttons at once, away from the tick edges so the model knows the tick.
+*/
+static void test_exti_debounce(void)
+{
+	trace_edge_t edge;
+	u8  level[2] = {1, 1};
+	u8  state[2] = {1, 1};
+	bool masked[2] = {FALSE, FALSE};
+	u32 expiry_us[2] = {0, 0};
+	u32 next_us[2] = {0, 0};
+	u16 changes[2] = {0, 0};
+	u16 irqs[2] = {0, 0};
+	u32 boot_us;
+	u32 count;
+	u8  button;
+	button_stats_t stats;
+
+	test_boot();
+	boot_us = host_now_us();
+	next_us[0] = test_away_from_tick(boot_us, boot_us + test_random(1000, 50000));
+	next_us[1] = test_away_from_tick(boot_us, boot_us + test_random(1000, 50000));
+	for (count = 0; count < TEST_DEBOUNCE_EDGES; count ++)
+	{
+		edge.button = (next_us[0] <= next_us[1]) ? 0 : 1;
+		edge.time_us = next_us[edge.button];
+		next_us[edge.button] = test_away_from_tick(boot_us, edge.time_us +
+		                       ((test_random(0, 3) == 0) ? test_random(5000, 100000) : test_random(50, 3000)));
+
+		// Expiries before the edge sample the level before it.
+		for (button = 0; button < 2; button ++)
+		{
+			if ((masked[button] == TRUE) && (expiry_us[button] <= edge.time_us))
+			{
+				masked[button] = FALSE;
+				if (level[button] != state[button])
+				{
+					state[button] = level[button];
+					changes[button] ++;
+				}
+			}
+		}
+		button = edge.button;
+		level[button] ^= 1;
+		if (masked[button] == FALSE)
+		{
+			masked[button] = TRUE;
+			irqs[button] ++;
+			expiry_us[button] = boot_us + ((edge.time_us - boot_us) / TEST_TICK_US + BUTTON_DEBOUNCE_TICKS) * TEST_TICK_US;
+		}
+		host_run_us(edge.time_us - host_now_us());
+		host_pin_write(GPIOB, m_trace_pin[button], (level[button] != 0) ? TRUE : FALSE);
+	}
+	host_run_ms(TRACE_IDLE_MS);
+	for (button = 0; button < 2; button ++)
+	{
+		if ((masked[button] == TRUE) && (level[button] != state[button]))
+		{
+			changes[button] ++;
+		}
+		button_get_stats(button, &stats);
+		TEST_CHECK_EQUAL(stats.irq_count, irqs[button]);
+		TEST_CHECK_EQUAL(stats.change_count, changes[button]);
+	}
+	printf("  %lu edges, %u and %u interrupts, %u and %u level changes\n", (unsigned long)TEST_DEBOUNCE_EDGES,
+	       irqs[0], irqs[1], changes[0], changes[1]);
+}
+
+/* Host time of an edge through the interrupt, the debounce start and the
+   expiry. A tick without edges costs nothing */
+static void test_debounce_cost(void)
+{
+	struct timespec start;
+	u32 run;
+
+	test_boot();
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (run = 0; run < TEST_BENCH_RUNS; run ++)
+	{
+		button_event_handler(EXTI_IT_Pin6);
+		event_dispatch();
+		btn_debonce_timeout_handler(TIMER_ID_BUTTON1_DEBOUNCE);
+	}
+	printf("  EXTI: %.1f ns per edge on the host, nothing on a tick without edges\n",
+	       test_elapsed_ns(&start) / TEST_BENCH_RUNS);
+}
+#endif
+
+/* Fuzzer -----------------------------------------------------------------*/
+
+static u16 test_fuzz_pairs(const fuzz_stats_t *p_stats)
+{
+	u16 index;
+	u16 pairs = 0;
+
+	for (index = 0; index < FUZZ_PAIRS; index ++)
+	{
+		pairs += p_stats->pair[index];
+	}
+	return pairs;
+}
+
+static void test_fuzz_run(u32 seed, u32 count)
+{
+	fuzz_stats_t *p_stats = mmap(NULL, sizeof(fuzz_stats_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	struct timespec start;
+	struct timespec end;
+	double wall_s;
+	u32 trial;
+	u32 failed = 0;
+	u32 corpus_count = 0;
+	u32 mutant_pairs = 0;
+	u16 pairs = 0;
+	bool is_mutant;
+	pid_t pid;
+	int status;
+	char comment[96];
+
+	memset(p_stats, 0, sizeof(*p_stats));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (trial = 0; trial < count; trial ++)
+	{
+		// Every other trace is a mutant of the corpus, once there is one.
+		is_mutant = ((corpus_count > 0) && ((trial & 1) != 0)) ? TRUE : FALSE;
+		if (is_mutant == TRUE)
+		{
+			m_trace = m_corpus[(seed + trial) % ((corpus_count < FUZZ_CORPUS_MAX) ? corpus_count : FUZZ_CORPUS_MAX)];
+			trace_mutate(&m_trace, seed + trial);
+		}
+		else
+		{
+			trace_generate(&m_trace, seed + trial);
+		}
+		fflush(stdout);
+		pid = fork();
+		if (pid == 0)
+		{
+			// Each trace from reset RAM.
+			test_boot();
+			m_p_pair = p_stats->pair;
+			trace_replay(&m_trace);
+			m_p_pair = NULL;
+			status = (trace_check(&m_trace) == 0) ? 0 : 1;
+			p_stats->edges += m_trace.edge_count;
+			p_stats->events += m_event_count;
+			p_stats->doubles += test_count(DOUBLE_BTN_TRACK, 0, 0xFFFFFFFF);
+			p_stats->virtual_ms += host_now_us() / 1000;
+			fflush(stdout);
+			_exit(status);
+		}
+		if ((waitpid(pid, &status, 0) != pid) || !WIFEXITED(status) || (WEXITSTATUS(status) != 0))
+		{
+			if (failed == 0)
+			{
+				snprintf(comment, sizeof(comment), "test_button fuzz %lu %lu, trace %lu%s", (unsigned long)seed,
+				         (unsigned long)count, (unsigned long)trial, (is_mutant == TRUE) ? " mutated" : "");
+				trace_write(&m_trace, TRACE_FAIL_FILE, comment);
+				printf("  %s failed, trace in %s\n", comment, TRACE_FAIL_FILE);
+			}
+			failed ++;
+		}
+		if (test_fuzz_pairs(p_stats) > pairs)
+		{
+			// New pairs, the oldest trace gives way once the corpus is full.
+			if (is_mutant == TRUE)
+			{
+				mutant_pairs += test_fuzz_pairs(p_stats) - pairs;
+			}
+			pairs = test_fuzz_pairs(p_stats);
+			m_corpus[corpus_count % FUZZ_CORPUS_MAX] = m_trace;
+			corpus_count ++;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	wall_s = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("  %lu traces, %lu failed, %lu edges, %lu events, %lu double holds, %lu s simulated in %.2f s\n",
+	       (unsigned long)count, (unsigned long)failed, (unsigned long)p_stats->edges,
+	       (unsigned long)p_stats->events, (unsigned long)p_stats->doubles,
+	       (unsigned long)(p_stats->virtual_ms / 1000), wall_s);
+	printf("  %.0f edges/s, %.0f events/s\n", p_stats->edges / wall_s, p_stats->events / wall_s);
+	printf("  %u of %u (status, edge) pairs, %lu first met by mutants, %lu corpus traces\n",
+	       pairs, (unsigned)FUZZ_PAIRS, (unsigned long)mutant_pairs, (unsigned long)corpus_count);
+	test_checks ++;
+	test_failures += failed;
+	munmap(p_stats, sizeof(*p_stats));
+}
+
+static void test_fuzz(void)
+{
+	test_fuzz_run(1, 200);
+}
+
+static int test_replay(const char *p_file)
+{
+	u16 index;
+
+	if (trace_read(&m_trace, p_file) == FALSE)
+	{
+		printf("cannot read %s\n", p_file);
+		return 1;
+	}
+	test_boot();
+	trace_replay(&m_trace);
+	for (index = 0; index < m_event_count; index ++)
+	{
+		printf("%8lu ms  %-24s clicks %u hold %u ms\n", (unsigned long)(m_event[index].time_us / 1000),
+		       test_event_name(m_event[index].info.event), m_event[index].info.click_count,
+		       m_event[index].info.hold_ms);
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if ((argc == 3) && (strcmp(argv[1], "replay") == 0))
+	{
+		return test_replay(argv[2]);
+	}
+	if ((argc == 4) && (strcmp(argv[1], "fuzz") == 0))
+	{
+		test_fuzz_run((u32)strtoul(argv[2], NULL, 0), (u32)strtoul(argv[3], NULL, 0));
+		return (test_failures == 0) ? 0 : 1;
+	}
+	TEST_RUN(test_short_press);
+	TEST_RUN(test_bouncy_press);
+	TEST_RUN(test_long_press);
+	TEST_RUN(test_very_long_press);
+	TEST_RUN(test_two_buttons);
+	TEST_RUN(test_overlap_drops_gestures);
+	TEST_RUN(test_double_press);
+	TEST_RUN(test_triple_press);
+	TEST_RUN(test_click_max);
+	TEST_RUN(test_click_after_window);
+	TEST_RUN(test_click_interleaved);
+	TEST_RUN(test_traces);
+#ifdef BUTTON_SAMPLED_DEBOUNCE
+	TEST_RUN(test_vertical_counter);
+#else
+	TEST_RUN(test_exti_debounce);
+#endif
+	TEST_RUN(test_debounce_cost);
+	TEST_RUN(test_double_hold_button1_first);
+	TEST_RUN(test_double_hold_button2_first);
+	TEST_RUN(test_double_hold_short);
+	TEST_RUN(test_fuzz);
+	return TEST_RESULT(argv[0]);
+}
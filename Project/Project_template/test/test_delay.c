@@ -0,0 +1,230 @@
+#include "stm8l15x.h"
+#include "stm8l15x_clk.h"
+
+#include "delay.h"
+#include "event.h"
+
+#include "host/host.h"
+#include "test.h"
+
+/*
+	The delay math of delay.c at every SYSCLK divider of the HSI, and at a
+	few clocks of other sources, against the same math in 64 bits: the
+	prescaler brings TIM1 to at most 1 MHz with the smallest division, and
+	the counts of a delay are those of the exact product rounded up, or
+	one count short. Then delay_us() itself on the TIM1 model, which must
+	take the time asked for at every divider.
+
+	Built polled, with TIM1 started for each delay, and as
+	test_delay_profile with EVENT_ISR_PROFILE, where TIM1 free runs at
+	SYSCLK and the delay only reads it.
+*/
+TEST_DEFINE
+
+#define TEST_HSI_HZ         16000000UL
+#define TEST_MAX_RATE_HZ    1000000UL
+#define TEST_US_PER_S       1000000ULL
+#define TEST_RANDOM_TIMES   200000
+
+/* The longest window delay_us() times in one go */
+#ifdef EVENT_ISR_PROFILE
+#define TEST_WINDOW         0x8000
+#else
+#define TEST_WINDOW         0xFFFF
+#endif
+
+/* HSE crystals, LSE and the LSI, besides the HSI */
+static const u32 m_other_hz[] = {12000000UL, 8000000UL, 3686400UL, 32768UL, 38000UL};
+
+/* Delays of delay_us() on the model, over one and several windows */
+static const u32 m_delay_us[] = {0, 1, 2, 10, 99, 1000, 12345, 65535, 65536, 70000, 250000, 1000000};
+
+static u32 m_random = 1;
+
+static u32 test_random(u32 low, u32 high)
+{
+	m_random = m_random * 1103515245UL + 12345UL;
+	return low + ((m_random >> 8) % (high - low + 1));
+}
+
+#ifdef EVENT_ISR_PROFILE
+static void test_tim1_isr(void)
+{
+	event_cycle_wrap_handler();
+}
+#endif
+
+static void test_boot(void)
+{
+	host_reset();
+#ifdef EVENT_ISR_PROFILE
+	host_vector[HOST_VECTOR_TIM1] = test_tim1_isr;
+#endif
+	CLK_SYSCLKDivConfig(CLK_SYSCLKDiv_1);
+	event_init();
+}
+
+static u32 test_sysclk_hz(u8 div)
+{
+	return TEST_HSI_HZ >> div;
+}
+
+static void test_check_prescaler(u32 sysclk_hz)
+{
+	u16 prescaler = delay_prescaler(sysclk_hz);
+
+#ifdef EVENT_ISR_PROFILE
+	TEST_CHECK_EQUAL(prescaler, 0);
+#else
+	// The smallest division that brings the rate to 1 MHz or below.
+	TEST_CHECK((unsigned long long)sysclk_hz <= (unsigned long long)TEST_MAX_RATE_HZ * (prescaler + 1));
+	TEST_CHECK((prescaler == 0) || ((unsigned long long)sysclk_hz > (unsigned long long)TEST_MAX_RATE_HZ * prescaler));
+#endif
+}
+
+// One count short of the exact product rounded up at most, and never over.
+static void test_check_counts(u32 time_us, u32 rate_hz)
+{
+	unsigned long long exact = ((unsigned long long)time_us * rate_hz + TEST_US_PER_S - 1) / TEST_US_PER_S;
+	u32 counts;
+
+	if (exact > 0xFFFFFFFFULL)
+	{
+		// Past 268 s at 16 MHz, the u32 result is documented to wrap.
+		return;
+	}
+	counts = delay_us_to_counts(time_us, rate_hz);
+	TEST_CHECK(counts <= exact);
+	TEST_CHECK((unsigned long long)counts + 1 >= exact);
+	if ((counts > exact) || ((unsigned long long)counts + 1 < exact))
+	{
+		printf("  %lu us at %lu Hz: %lu counts, %llu exact\n", (unsigned long)time_us,
+		       (unsigned long)rate_hz, (unsigned long)counts, exact);
+	}
+}
+
+static void test_check_rate(u32 rate_hz)
+{
+	u32 time_us;
+	u32 index;
+	u32 failures = test_failures;
+
+	for (time_us = 0; time_us <= 3000; time_us ++)
+	{
+		test_check_counts(time_us, rate_hz);
+	}
+	// Around every boundary of the us, ms and s split, and the end of the u32.
+	for (time_us = 1000; time_us != 0; time_us = (time_us < 1000000000UL) ? time_us * 10 : 0)
+	{
+		for (index = 0; index < 3; index ++)
+		{
+			test_check_counts(time_us - 1 + index, rate_hz);
+		}
+	}
+	test_check_counts(0xFFFFFFFFUL, rate_hz);
+	test_check_counts(0xFFFFFFFFUL / 16, rate_hz);
+	for (index = 0; index < TEST_RANDOM_TIMES; index ++)
+	{
+		time_us = (index & 1) ? test_random(0, 0xFFFFFFFEUL) : test_random(0, 300000000UL);
+		test_check_counts(time_us, rate_hz);
+		if (test_failures - failures > 10)
+		{
+			return;
+		}
+	}
+}
+
+static void test_prescaler(void)
+{
+	u8 div;
+	u8 index;
+
+	for (div = CLK_SYSCLKDiv_1; div <= CLK_SYSCLKDiv_128; div ++)
+	{
+		test_check_prescaler(test_sysclk_hz(div));
+	}
+	for (index = 0; index < sizeof(m_other_hz) / sizeof(m_other_hz[0]); index ++)
+	{
+		test_check_prescaler(m_other_hz[index]);
+	}
+}
+
+// At the rate delay_us() counts with for each clock.
+static void test_counts(void)
+{
+	u32 sysclk_hz;
+	u8 div;
+	u8 index;
+
+	m_random = 3;
+	for (div = CLK_SYSCLKDiv_1; div <= CLK_SYSCLKDiv_128; div ++)
+	{
+		sysclk_hz = test_sysclk_hz(div);
+		test_check_rate(sysclk_hz / ((u32)delay_prescaler(sysclk_hz) + 1));
+	}
+	for (index = 0; index < sizeof(m_other_hz) / sizeof(m_other_hz[0]); index ++)
+	{
+		sysclk_hz = m_other_hz[index];
+		test_check_rate(sysclk_hz / ((u32)delay_prescaler(sysclk_hz) + 1));
+	}
+	// And every rate a prescaler can give from the HSI.
+	for (index = 1; index <= 64; index ++)
+	{
+		test_check_rate(TEST_HSI_HZ / index);
+	}
+}
+
+static void test_delay(void)
+{
+	unsigned long long start_ps;
+	unsigned long long elapsed_ps;
+	unsigned long long count_ps;
+	unsigned long long want_ps;
+	u32 counts;
+	u32 windows;
+	u32 sysclk_hz;
+	u32 rate_hz;
+	u8 div;
+	u8 index;
+#ifdef EVENT_ISR_PROFILE
+	u32 cycles;
+#endif
+
+	test_boot();
+	for (div = CLK_SYSCLKDiv_1; div <= CLK_SYSCLKDiv_128; div ++)
+	{
+		CLK_SYSCLKDivConfig((CLK_SYSCLKDiv_TypeDef)div);
+		sysclk_hz = test_sysclk_hz(div);
+		rate_hz = sysclk_hz / ((u32)delay_prescaler(sysclk_hz) + 1);
+		count_ps = 1000000000000ULL / rate_hz;
+		for (index = 0; index < sizeof(m_delay_us) / sizeof(m_delay_us[0]); index ++)
+		{
+			counts = delay_us_to_counts(m_delay_us[index], rate_hz);
+			windows = (counts + TEST_WINDOW - 1) / TEST_WINDOW;
+			want_ps = (unsigned long long)m_delay_us[index] * 1000000ULL;
+			start_ps = host_now_ps();
+#ifdef EVENT_ISR_PROFILE
+			cycles = event_cycles();
+#endif
+			delay_us(m_delay_us[index]);
+			elapsed_ps = host_now_ps() - start_ps;
+			// Never short by more than a count. A window of one count is
+			// skipped by the polled delay, and a read of the counter under
+			// the profiler takes a count of its own.
+			TEST_CHECK(elapsed_ps + count_ps >= want_ps);
+			TEST_CHECK(elapsed_ps <= want_ps + (2 * windows + 1) * count_ps);
+#ifdef EVENT_ISR_PROFILE
+			// The cycle counter ran on through the delay.
+			TEST_CHECK(event_cycles() - cycles >= counts);
+#endif
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	TEST_RUN(test_prescaler);
+	TEST_RUN(test_counts);
+	TEST_RUN(test_delay);
+	return TEST_RESULT(argv[0]);
+}
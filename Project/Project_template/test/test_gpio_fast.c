@@ -0,0 +1,142 @@
+#include <time.h>
+
+#include "stm8l15x.h"
+#include "stm8l15x_gpio.h"
+
+#include "gpio_fast.h"
+
+#include "host/host.h"
+#include "test.h"
+
+/*
+	The macros of gpio_fast.h against the StdPeriph calls they replace.
+	Each must leave ODR as the driver does, from random register contents
+	and over every mask, and GPIO_FAST_WRITE must match GPIO_WriteBit
+	called pin by pin.
+
+	Then the cost of writing the keypad row pattern both ways: a call,
+	assert_param and branch per pin against one read-modify-write of ODR.
+	The host has no STM8 core to count cycles on, so host ns per write are
+	shown as the proxy.
+*/
+TEST_DEFINE
+
+#define TEST_RANDOM_TIMES   2000
+#define TEST_COST_WRITES    2000000
+#define TEST_ROW_MASK       0x0F   // KEYPAD_ROW_MASK of keypad.c.
+
+static u32 m_random = 1;
+
+static u32 test_random(u32 low, u32 high)
+{
+	m_random = m_random * 1103515245UL + 12345UL;
+	return low + ((m_random >> 8) % (high - low + 1));
+}
+
+static double test_elapsed_ns(const struct timespec *p_start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (double)(end.tv_sec - p_start->tv_sec) * 1e9 + (double)(end.tv_nsec - p_start->tv_nsec);
+}
+
+// The same register contents on both ports.
+static void test_fill(u8 odr, u8 idr)
+{
+	GPIOA->ODR = odr;
+	GPIOA->IDR = idr;
+	GPIOC->ODR = odr;
+	GPIOC->IDR = idr;
+}
+
+// GPIOA is the driver's, GPIOC the macros'.
+static void test_check_ports(void)
+{
+	TEST_CHECK_EQUAL(GPIOC->ODR, GPIOA->ODR);
+}
+
+static void test_write_bits(GPIO_TypeDef *port, u8 mask, u8 value)
+{
+	u8 pin;
+
+	for (pin = 0; pin < 8; pin ++)
+	{
+		if ((mask & (u8)(1 << pin)) != 0)
+		{
+			GPIO_WriteBit(port, (GPIO_Pin_TypeDef)(1 << pin), ((value & (u8)(1 << pin)) != 0) ? SET : RESET);
+		}
+	}
+}
+
+static void test_same(void)
+{
+	u32 times;
+	u16 mask;
+	u8 value;
+
+	host_reset();
+	for (times = 0; times < TEST_RANDOM_TIMES; times ++)
+	{
+		for (mask = 0; mask <= 0xFF; mask ++)
+		{
+			value = (u8)test_random(0, 0xFF);
+			test_fill((u8)test_random(0, 0xFF), (u8)test_random(0, 0xFF));
+
+			test_write_bits(GPIOA, (u8)mask, value);
+			GPIO_FAST_WRITE(GPIOC, (u8)mask, value);
+			test_check_ports();
+
+			GPIO_SetBits(GPIOA, (u8)mask);
+			GPIO_FAST_SET(GPIOC, (u8)mask);
+			test_check_ports();
+
+			GPIO_ResetBits(GPIOA, (u8)~mask);
+			GPIO_FAST_RESET(GPIOC, (u8)~mask);
+			test_check_ports();
+
+			GPIO_ToggleBits(GPIOA, (u8)mask);
+			GPIO_FAST_TOGGLE(GPIOC, (u8)mask);
+			test_check_ports();
+
+			TEST_CHECK_EQUAL(GPIO_FAST_READ(GPIOC, mask), GPIO_ReadInputData(GPIOA) & mask);
+		}
+	}
+}
+
+static void test_cost(void)
+{
+	struct timespec start;
+	double driver_ns;
+	double fast_ns;
+	u32 times;
+	u8 row;
+
+	host_reset();
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (times = 0; times < TEST_COST_WRITES; times ++)
+	{
+		row = (u8)(times & 0x03);
+		test_write_bits(GPIOB, TEST_ROW_MASK, (u8)~(1 << row));
+	}
+	driver_ns = test_elapsed_ns(&start) / TEST_COST_WRITES;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (times = 0; times < TEST_COST_WRITES; times ++)
+	{
+		row = (u8)(times & 0x03);
+		GPIO_FAST_WRITE(GPIOB, TEST_ROW_MASK, ~(1 << row));
+	}
+	fast_ns = test_elapsed_ns(&start) / TEST_COST_WRITES;
+
+	printf("  row pattern of 4 pins: GPIO_WriteBit %.2f ns, GPIO_FAST_WRITE %.2f ns on the host\n",
+	       driver_ns, fast_ns);
+	TEST_CHECK_EQUAL(GPIOB->ODR & TEST_ROW_MASK, (u8)~(1 << 3) & TEST_ROW_MASK);
+}
+
+int main(int argc, char **argv)
+{
+	TEST_RUN(test_same);
+	TEST_RUN(test_cost);
+	return TEST_RESULT(argv[0]);
+}
@@ -0,0 +1,78 @@
+#include "stm8l15x.h"
+#include "stm8l15x_gpio.h"
+
+#include "clock.h"
+#include "event.h"
+#include "settings.h"
+#include "sys_time.h"
+#include "timer.h"
+#include "app.h"
+
+#include "host/host.h"
+#include "test.h"
+
+/*
+	The host build itself: the model keeps time with the tick interrupt,
+	a GPIO edge reaches its EXTI routine and the settings live in the
+	EEPROM model across a reset.
+*/
+TEST_DEFINE
+
+static void test_boot(void)
+{
+	host_reset();
+	host_vectors_install();
+	clock_init();
+	settings_init();
+	event_init();
+	timer_init();
+}
+
+static void test_time(void)
+{
+	test_boot();
+	TEST_CHECK_EQUAL(sys_time_now_ms(), 0);
+	host_run_ms(1234);
+	TEST_CHECK_EQUAL(host_now_us(), 1234000);
+	TEST_CHECK(sys_time_now_ms() >= 1232);
+	TEST_CHECK(sys_time_now_ms() <= 1234);
+	host_run_ms(60000);
+	TEST_CHECK(sys_time_now_ms() >= 61232);
+	TEST_CHECK(sys_time_now_ms() <= 61234);
+}
+
+static void test_edge(void)
+{
+	test_boot();
+	button_init(app_button_event_handler);
+	TEST_CHECK(GPIO_ReadInputDataBit(GPIOB, GPIO_Pin_6) != RESET);
+	TEST_CHECK((GPIOB->CR2 & GPIO_Pin_6) != 0);
+
+	// The EXTI routine masks the pin until the debounce timer is over.
+	host_pin_write(GPIOB, GPIO_Pin_6, FALSE);
+	TEST_CHECK((GPIOB->CR2 & GPIO_Pin_6) == 0);
+	TEST_CHECK((GPIOB->CR2 & GPIO_Pin_7) != 0);
+	host_run_ms(100);
+	TEST_CHECK((GPIOB->CR2 & GPIO_Pin_6) != 0);
+	host_pin_write(GPIOB, GPIO_Pin_6, TRUE);
+	host_run_ms(100);
+	TEST_CHECK((GPIOB->CR2 & GPIO_Pin_6) != 0);
+}
+
+static void test_eeprom(void)
+{
+	host_eeprom_erase();
+	test_boot();
+	TEST_CHECK_EQUAL(settings_get(SETTINGS_KEY_BUTTON_HOLD, 7), 7);
+	TEST_CHECK(settings_set(SETTINGS_KEY_BUTTON_HOLD, 250) == TRUE);
+	test_boot();
+	TEST_CHECK_EQUAL(settings_get(SETTINGS_KEY_BUTTON_HOLD, 7), 250);
+}
+
+int main(int argc, char **argv)
+{
+	TEST_RUN(test_time);
+	TEST_RUN(test_edge);
+	TEST_RUN(test_eeprom);
+	return TEST_RESULT(argv[0]);
+}
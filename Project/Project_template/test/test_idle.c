@@ -0,0 +1,205 @@
+#include "stm8l15x.h"
+#include "stm8l15x_gpio.h"
+
+#include "clock.h"
+#include "event.h"
+#include "settings.h"
+#include "sys_time.h"
+#include "timer.h"
+#include "button.h"
+#include "idle.h"
+
+#include "host/host.h"
+#include "test.h"
+
+/*
+	The main loop of main.c with idle_enter(), on parts whose LSI is off the
+	nominal 38 kHz. The gestures are timed by the RTC wakeup while the core
+	halts, so their events must still come at the HSI time of the edges
+	plus the nominal durations, and sys_time must follow HSI time over the
+	halts. The pin edges are scheduled ahead, they wake the core from halt
+	as the EXTI lines do.
+
+	An EXTI0 edge of the test ends the last halt of every run, it has no
+	routine of the firmware.
+*/
+TEST_DEFINE
+
+#define TEST_EVENTS_MAX         16
+#define TEST_WAKE_PORT          GPIOA
+#define TEST_WAKE_PIN           GPIO_Pin_0
+#define TEST_EVENT_LATE_MS      50       // Debounce and tick rounding on top of a duration.
+#define TEST_TIME_ERROR_MS      10       // An RTC count either way per halt.
+
+typedef struct test_event_s
+{
+	u32 time_ms;
+	button_event_info_t info;
+} test_event_t;
+
+static test_event_t m_event[TEST_EVENTS_MAX];
+static u8 m_event_count = 0;
+static u32 m_init_ms = 0;    // Host time idle_init() returned at.
+
+static void test_button_handler(const button_event_info_t *p_event)
+{
+	if (m_event_count < TEST_EVENTS_MAX)
+	{
+		m_event[m_event_count].time_ms = host_now_us() / 1000;
+		m_event[m_event_count].info = *p_event;
+	}
+	m_event_count ++;
+}
+
+static void test_wake_handler(void)
+{
+}
+
+static void test_boot(u32 lsi_hz)
+{
+	host_reset();
+	host_vectors_install();
+	host_vector[HOST_VECTOR_EXTI0] = test_wake_handler;
+	TEST_WAKE_PORT->CR2 |= TEST_WAKE_PIN;
+	host_lsi_hz = lsi_hz;
+
+	clock_init();
+	// CLK_DeInit() cleared the ready flag, and the register file has no
+	// oscillator to set it again.
+	CLK->ICKCR |= CLK_ICKCR_LSIRDY;
+	settings_init();
+	event_init();
+	timer_init();
+	button_init(test_button_handler);
+	idle_init();
+	clock_release(CLOCK_USER_INIT);
+	m_init_ms = host_now_us() / 1000;
+	m_event_count = 0;
+}
+
+// Edges of button 1 at ms of host time.
+static void test_button_at(bool is_pushed, u32 at_ms)
+{
+	host_pin_schedule(GPIOB, GPIO_Pin_6, (is_pushed == TRUE) ? FALSE : TRUE, at_ms * 1000 - host_now_us());
+}
+
+// The loop of main() up to at_ms of host time.
+static void test_main_until(u32 at_ms)
+{
+	host_pin_schedule(TEST_WAKE_PORT, TEST_WAKE_PIN, FALSE, at_ms * 1000 - host_now_us());
+	host_pin_schedule(TEST_WAKE_PORT, TEST_WAKE_PIN, TRUE, at_ms * 1000 - host_now_us());
+	while (host_now_us() < at_ms * 1000)
+	{
+		event_dispatch();
+		idle_enter();
+	}
+	event_dispatch();
+}
+
+static void test_check_event(u8 index, button_event_t event, u32 time_ms, u32 press_ms, u16 hold_ms)
+{
+	TEST_CHECK(index < m_event_count);
+	if (index >= m_event_count)
+	{
+		return;
+	}
+	TEST_CHECK_EQUAL(m_event[index].info.event, event);
+	TEST_CHECK(m_event[index].time_ms >= time_ms);
+	TEST_CHECK(m_event[index].time_ms <= time_ms + TEST_EVENT_LATE_MS);
+	// sys_time and host time start together at the reset.
+	TEST_CHECK(m_event[index].info.press_ms + TEST_TIME_ERROR_MS >= press_ms);
+	TEST_CHECK(m_event[index].info.press_ms <= press_ms + TEST_TIME_ERROR_MS);
+	TEST_CHECK(m_event[index].info.hold_ms + TEST_TIME_ERROR_MS >= hold_ms);
+	TEST_CHECK(m_event[index].info.hold_ms <= hold_ms + TEST_EVENT_LATE_MS);
+}
+
+static void test_gestures_at(u32 lsi_hz)
+{
+	idle_stats_t stats;
+	u32 now_ms;
+	u32 total_ms;
+
+	test_boot(lsi_hz);
+	idle_get_stats(&stats);
+	TEST_CHECK(stats.lsi_hz + lsi_hz / 1000 >= lsi_hz);
+	TEST_CHECK(stats.lsi_hz <= lsi_hz + lsi_hz / 1000);
+
+	// Held for 2.5 s from a halt without a timer, the edge wakes the core.
+	test_button_at(TRUE, 1000);
+	test_button_at(FALSE, 3500);
+	// A double press, the second push lands in the halt of the click window,
+	// and the event waits for the window after the second click.
+	test_button_at(TRUE, 5000);
+	test_button_at(FALSE, 5100);
+	test_button_at(TRUE, 5300);
+	test_button_at(FALSE, 5400);
+	test_main_until(10000);
+
+	TEST_CHECK_EQUAL(m_event_count, 3);
+	test_check_event(0, BUTTON1_LONG_HOLD, 3000, 1000, 2000);
+	test_check_event(1, BUTTON1_LONG_PRESS, 3500, 1000, 2500);
+	test_check_event(2, BUTTON1_DOUBLE_PRESS, 5900, 5300, 100);
+	if (m_event_count >= 3)
+	{
+		TEST_CHECK_EQUAL(m_event[2].info.click_count, 2);
+	}
+
+	now_ms = host_now_us() / 1000;
+	TEST_CHECK(sys_time_now_ms() + TEST_TIME_ERROR_MS >= now_ms);
+	TEST_CHECK(sys_time_now_ms() <= now_ms + TEST_TIME_ERROR_MS);
+
+	// The counters add up to the time since idle_init(), and the core
+	// spent nearly all of it in halt.
+	idle_get_stats(&stats);
+	total_ms = stats.run_ms + stats.wait_ms + stats.halt_ms;
+	TEST_CHECK(total_ms + TEST_TIME_ERROR_MS >= now_ms - m_init_ms);
+	TEST_CHECK(total_ms <= now_ms - m_init_ms + TEST_TIME_ERROR_MS);
+	TEST_CHECK(stats.halt_ms > total_ms / 100 * 95);
+	TEST_CHECK(stats.wait_ms > 0);
+	printf("  lsi %lu Hz, measured %lu Hz: run %lu ms, wait %lu ms, halt %lu ms\n",
+	       (unsigned long)lsi_hz, (unsigned long)stats.lsi_hz, (unsigned long)stats.run_ms,
+	       (unsigned long)stats.wait_ms, (unsigned long)stats.halt_ms);
+}
+
+static void test_lsi_slow(void)
+{
+	test_gestures_at(26000);
+}
+
+static void test_lsi_nominal(void)
+{
+	test_gestures_at(38000);
+}
+
+static void test_lsi_fast(void)
+{
+	test_gestures_at(56000);
+}
+
+// The longest halt the wakeup counter allows, and sys_time over many of them.
+static void test_long_halt(void)
+{
+	u32 now_ms;
+
+	test_boot(56000);
+	test_button_at(TRUE, 1000);
+	test_button_at(FALSE, 61000);
+	test_main_until(70000);
+
+	TEST_CHECK_EQUAL(m_event_count, 3);
+	test_check_event(0, BUTTON1_LONG_HOLD, 3000, 1000, 2000);
+	test_check_event(1, BUTTON1_VERY_LONG_HOLD, 6000, 1000, 5000);
+	test_check_event(2, BUTTON1_VERY_LONG_PRESS, 61000, 1000, 60000);
+	now_ms = host_now_us() / 1000;
+	TEST_CHECK(sys_time_now_ms() + TEST_TIME_ERROR_MS >= now_ms);
+	TEST_CHECK(sys_time_now_ms() <= now_ms + TEST_TIME_ERROR_MS);
+}
+
+int main(int argc, char **argv)
+{
+	TEST_RUN(test_lsi_slow);
+	TEST_RUN(test_lsi_nominal);
+	TEST_RUN(test_lsi_fast);
+	TEST_RUN(test_long_halt);
+	return TEST_RESULT(argv[0]);
+}
@@ -0,0 +1,435 @@
+#include <string.h>
+
+#include "stm8l15x.h"
+
+#include "clock.h"
+#include "event.h"
+#include "keypad.h"
+#include "timer.h"
+
+#include "host/host.h"
+#include "test.h"
+
+/*
+	keypad.c on the key matrix of the model, the rows on GPIOE and the
+	columns on GPIOD as keypad.h has them. Every event is logged with its
+	time and checked against the scans: a level is taken on the fourth
+	scan that sees it, by each key's own counter in the planes of its row,
+	and a scan that shows three corners of a rectangle changes nothing,
+	so neither the fourth key nor the ghost of it is ever reported. A key
+	held counts the scans to LONG_HOLD and to its release.
+
+	Built as test_keypad_wakeup with KEYPAD_WAKEUP, where the matrix sleeps
+	with the rows low once every key is up and wakes on the port D line.
+	There a key that goes down while the last scan reads the other rows
+	pulls its column down before the interrupt is unmasked, and only the
+	read after the unmask finds it.
+*/
+TEST_DEFINE
+
+#define TEST_EVENTS_MAX     64
+#define TEST_SCAN_MS        (KEYPAD_SCAN_PERIOD * 10)
+#define TEST_SCAN_US        (TEST_SCAN_MS * 1000UL)
+#define TEST_DEBOUNCE_MS    (4 * TEST_SCAN_MS)
+#define TEST_ROWS_MASK      ((u8)((1 << KEYPAD_ROWS) - 1))
+#define TEST_COLS_MASK      ((u8)((1 << KEYPAD_COLS) - 1))
+#define TEST_RACE_BEFORE_US 30   // Sweep of the race, from ahead of the sleep to after it.
+#define TEST_RACE_AFTER_US  10
+
+typedef struct test_event_s
+{
+	keypad_event_info_t info;
+	u32 at_us;
+} test_event_t;
+
+static test_event_t m_event[TEST_EVENTS_MAX];
+static u8 m_event_count = 0;
+static u32 m_wakeup_count = 0;
+static host_vector_t m_extid_vector = NULL;
+
+static void test_event_handler(const keypad_event_info_t *p_event)
+{
+	TEST_CHECK(m_event_count < TEST_EVENTS_MAX);
+	if (m_event_count < TEST_EVENTS_MAX)
+	{
+		m_event[m_event_count].info = *p_event;
+		m_event[m_event_count].at_us = host_now_us();
+		m_event_count ++;
+	}
+}
+
+static void test_extid_vector(void)
+{
+	m_wakeup_count ++;
+	m_extid_vector();
+}
+
+static void test_boot(void)
+{
+	host_reset();
+	host_vectors_install();
+	m_extid_vector = host_vector[HOST_VECTOR_EXTID];
+	host_vector[HOST_VECTOR_EXTID] = test_extid_vector;
+	host_matrix_attach(KEYPAD_ROW_PORT, TEST_ROWS_MASK, KEYPAD_COL_PORT, TEST_COLS_MASK);
+	clock_init();
+	event_init();
+	timer_init();
+	clock_release(CLOCK_USER_INIT);
+	m_event_count = 0;
+	m_wakeup_count = 0;
+	keypad_init(test_event_handler);
+}
+
+static void test_check_event(u8 index, keypad_event_t event, u8 row, u8 col)
+{
+	TEST_CHECK(index < m_event_count);
+	if (index < m_event_count)
+	{
+		TEST_CHECK_EQUAL(m_event[index].info.event, event);
+		TEST_CHECK_EQUAL(m_event[index].info.key, KEYPAD_KEY(row, col));
+	}
+}
+
+// The event index came at the scan ms after start_us, the scan taking a few us.
+static void test_check_at(u8 index, u32 start_us, u32 ms)
+{
+	if (index < m_event_count)
+	{
+		TEST_CHECK(m_event[index].at_us >= start_us + ms * 1000UL);
+		TEST_CHECK(m_event[index].at_us < start_us + ms * 1000UL + 1000UL);
+	}
+}
+
+// Runs to the next event, returns its time.
+static u32 test_run_to_event(void)
+{
+	u8 count = m_event_count;
+	u32 start_us = host_now_us();
+
+	while ((m_event_count == count) && (host_now_us() - start_us < 2 * TEST_DEBOUNCE_MS * 1000UL))
+	{
+		host_run_us(100);
+	}
+	TEST_CHECK(m_event_count > count);
+	return (m_event_count > count) ? m_event[count].at_us : 0;
+}
+
+// Puts key down and runs to its press, returns the time of the scan.
+static u32 test_press(u8 row, u8 col)
+{
+	u8 count = m_event_count;
+
+	host_matrix_key(row, col, TRUE);
+	host_run_ms(TEST_DEBOUNCE_MS + TEST_SCAN_MS + 1);
+	TEST_CHECK_EQUAL(m_event_count, count + 1);
+	test_check_event(count, KEYPAD_EVENT_PRESS, row, col);
+	return (m_event_count > count) ? m_event[count].at_us : 0;
+}
+
+static void test_release(u8 row, u8 col)
+{
+	u8 count = m_event_count;
+
+	host_matrix_key(row, col, FALSE);
+	host_run_ms(TEST_DEBOUNCE_MS + TEST_SCAN_MS + 1);
+	TEST_CHECK_EQUAL(m_event_count, count + 1);
+	test_check_event(count, KEYPAD_EVENT_RELEASE, row, col);
+}
+
+static void test_schedule(u8 row, u8 col, bool is_down, u32 at_us)
+{
+	host_matrix_schedule(row, col, is_down, at_us - host_now_us());
+}
+
+/*
+	In each row one key is down to set the scans, then the other three
+	change between scans: two are taken on their own fourth scan, the
+	third bounces up after three scans and starts over.
+*/
+static void test_vertical_counter(void)
+{
+	u32 start_us;
+	u8 row;
+
+	test_boot();
+	for (row = 0; row < KEYPAD_ROWS; row ++)
+	{
+		m_event_count = 0;
+		host_matrix_key(row, 0, TRUE);
+		start_us = test_run_to_event();
+		test_check_event(0, KEYPAD_EVENT_PRESS, row, 0);
+		m_event_count = 0;
+		// Scan n runs n * 10 ms after start_us, the keys change halfway.
+		test_schedule(row, 1, TRUE, start_us + 5000);
+		test_schedule(row, 2, TRUE, start_us + 15000);
+		test_schedule(row, 3, TRUE, start_us + 5000);
+		test_schedule(row, 3, FALSE, start_us + 35000);
+		test_schedule(row, 3, TRUE, start_us + 45000);
+		test_schedule(row, 1, FALSE, start_us + 65000);
+		host_run_us(start_us + 150000UL - host_now_us());
+
+		TEST_CHECK_EQUAL(m_event_count, 4);
+		test_check_event(0, KEYPAD_EVENT_PRESS, row, 1);
+		test_check_at(0, start_us, 40);
+		test_check_event(1, KEYPAD_EVENT_PRESS, row, 2);
+		test_check_at(1, start_us, 50);
+		test_check_event(2, KEYPAD_EVENT_PRESS, row, 3);
+		test_check_at(2, start_us, 80);
+		test_check_event(3, KEYPAD_EVENT_RELEASE, row, 1);
+		test_check_at(3, start_us, 100);
+
+		m_event_count = 0;
+		host_matrix_key(row, 0, FALSE);
+		host_matrix_key(row, 2, FALSE);
+		host_matrix_key(row, 3, FALSE);
+		host_run_ms(TEST_DEBOUNCE_MS + TEST_SCAN_MS + 1);
+		TEST_CHECK_EQUAL(m_event_count, 3);
+	}
+}
+
+static void test_ghost(void)
+{
+	test_boot();
+	test_press(0, 0);
+	test_press(1, 0);
+	// (0, 1) reads down through (0, 0), (1, 0) and (1, 1).
+	m_event_count = 0;
+	host_matrix_key(1, 1, TRUE);
+	host_run_ms(500);
+	TEST_CHECK_EQUAL(m_event_count, 0);
+
+	// With a corner up the rectangle is gone, the scan that takes its
+	// release takes (1, 1) too.
+	host_matrix_key(1, 0, FALSE);
+	host_run_ms(TEST_DEBOUNCE_MS + TEST_SCAN_MS + 1);
+	TEST_CHECK_EQUAL(m_event_count, 2);
+	test_check_event(0, KEYPAD_EVENT_RELEASE, 1, 0);
+	test_check_event(1, KEYPAD_EVENT_PRESS, 1, 1);
+	test_check_at(1, m_event[0].at_us, 0);
+
+	// Down again, it waits as a corner of the next rectangle.
+	m_event_count = 0;
+	host_matrix_key(1, 0, TRUE);
+	host_run_ms(500);
+	TEST_CHECK_EQUAL(m_event_count, 0);
+	host_matrix_key(0, 0, FALSE);
+	host_run_ms(TEST_DEBOUNCE_MS + TEST_SCAN_MS + 1);
+	TEST_CHECK_EQUAL(m_event_count, 2);
+	test_check_event(0, KEYPAD_EVENT_RELEASE, 0, 0);
+	test_check_event(1, KEYPAD_EVENT_PRESS, 1, 0);
+	test_check_at(1, m_event[0].at_us, 0);
+	test_release(1, 0);
+	test_release(1, 1);
+
+	// A diagonal, a whole row and a whole column share no two columns
+	// between two rows, every key is its own.
+	m_event_count = 0;
+	test_press(0, 0);
+	test_press(1, 1);
+	test_press(2, 2);
+	test_press(3, 3);
+	test_release(1, 1);
+	test_release(2, 2);
+	test_release(3, 3);
+	test_press(0, 1);
+	test_press(0, 2);
+	test_press(0, 3);
+	test_release(0, 1);
+	test_release(0, 2);
+	test_release(0, 3);
+	test_press(1, 0);
+	test_press(2, 0);
+	test_press(3, 0);
+	TEST_CHECK_EQUAL(m_event_count, 16);
+	test_release(1, 0);
+	test_release(2, 0);
+	test_release(3, 0);
+
+	// Nor can all four corners be told from three and a ghost.
+	test_press(0, 1);
+	m_event_count = 0;
+	host_matrix_key(1, 0, TRUE);
+	host_matrix_key(1, 1, TRUE);
+	host_run_ms(500);
+	TEST_CHECK_EQUAL(m_event_count, 0);
+	host_matrix_key(0, 0, FALSE);
+	host_matrix_key(0, 1, FALSE);
+	host_matrix_key(1, 0, FALSE);
+	host_matrix_key(1, 1, FALSE);
+	host_run_ms(TEST_DEBOUNCE_MS + TEST_SCAN_MS + 1);
+	TEST_CHECK_EQUAL(m_event_count, 2);
+	test_check_event(0, KEYPAD_EVENT_RELEASE, 0, 0);
+	test_check_event(1, KEYPAD_EVENT_RELEASE, 0, 1);
+}
+
+static void test_hold(void)
+{
+	u32 press_us;
+	u8 count;
+
+	test_boot();
+	press_us = test_press(2, 3);
+	// The second key 500 ms on, each counts its own scans.
+	host_run_us(press_us + 500000UL - host_now_us());
+	count = m_event_count;
+	host_matrix_key(1, 2, TRUE);
+	host_run_ms(3000);
+	TEST_CHECK_EQUAL(m_event_count, count + 3);
+	test_check_event(count, KEYPAD_EVENT_PRESS, 1, 2);
+	test_check_event((u8)(count + 1), KEYPAD_EVENT_LONG_HOLD, 2, 3);
+	test_check_at((u8)(count + 1), press_us, KEYPAD_HOLD_DURATION * 10);
+	TEST_CHECK_EQUAL(m_event[count + 1].info.hold_ms, KEYPAD_HOLD_DURATION * 10);
+	test_check_event((u8)(count + 2), KEYPAD_EVENT_LONG_HOLD, 1, 2);
+	test_check_at((u8)(count + 2), m_event[count].at_us, KEYPAD_HOLD_DURATION * 10);
+
+	// The hold of the release counts its own debounce too.
+	count = m_event_count;
+	host_matrix_key(2, 3, FALSE);
+	host_run_ms(TEST_DEBOUNCE_MS + TEST_SCAN_MS + 1);
+	TEST_CHECK_EQUAL(m_event_count, count + 1);
+	test_check_event(count, KEYPAD_EVENT_RELEASE, 2, 3);
+	TEST_CHECK_EQUAL(m_event[count].info.hold_ms, (m_event[count].at_us - press_us + 500) / 1000);
+
+	// Past 65.5 s the hold_ms saturates, and LONG_HOLD came only once.
+	count = m_event_count;
+	host_run_ms(70000);
+	TEST_CHECK_EQUAL(m_event_count, count);
+	host_matrix_key(1, 2, FALSE);
+	host_run_ms(TEST_DEBOUNCE_MS + TEST_SCAN_MS + 1);
+	TEST_CHECK_EQUAL(m_event_count, count + 1);
+	test_check_event(count, KEYPAD_EVENT_RELEASE, 1, 2);
+	TEST_CHECK_EQUAL(m_event[count].info.hold_ms, 0xFFFF);
+}
+
+#ifdef KEYPAD_WAKEUP
+static void test_dummy_handler(void)
+{
+}
+
+// Rows low and the columns unmasked, as keypad_sleep() leaves them.
+static bool test_is_asleep(void)
+{
+	return (((KEYPAD_ROW_PORT->ODR & TEST_ROWS_MASK) == 0) &&
+	        ((KEYPAD_COL_PORT->CR2 & TEST_COLS_MASK) == TEST_COLS_MASK)) ? TRUE : FALSE;
+}
+
+// Asleep with every key up, and awake as long as one is down.
+static void test_sleep(void)
+{
+	u32 press_us;
+
+	test_boot();
+	host_run_ms(TEST_SCAN_MS + 1);
+	TEST_CHECK(test_is_asleep() == TRUE);
+	host_run_ms(1000);
+	TEST_CHECK_EQUAL(m_wakeup_count, 0);
+
+	press_us = host_now_us();
+	host_matrix_key(3, 1, TRUE);
+	TEST_CHECK_EQUAL(m_wakeup_count, 1);
+	TEST_CHECK(test_is_asleep() == FALSE);
+	host_run_ms(TEST_DEBOUNCE_MS + 1);
+	TEST_CHECK_EQUAL(m_event_count, 1);
+	test_check_event(0, KEYPAD_EVENT_PRESS, 3, 1);
+	// The first scan within a period of the wakeup, the press three on.
+	TEST_CHECK(m_event[0].at_us - press_us > (TEST_DEBOUNCE_MS - TEST_SCAN_MS) * 1000UL);
+	TEST_CHECK(m_event[0].at_us - press_us <= TEST_DEBOUNCE_MS * 1000UL + 1000UL);
+	host_run_ms(1000);
+	TEST_CHECK(test_is_asleep() == FALSE);
+	test_release(3, 1);
+	// The scan that takes the release puts it to sleep.
+	TEST_CHECK(test_is_asleep() == TRUE);
+	TEST_CHECK_EQUAL(m_wakeup_count, 1);
+
+	// A wakeup that finds the event queue full leaves the matrix asleep,
+	// the next edge tries again.
+	m_event_count = 0;
+	while (event_put(test_dummy_handler) == TRUE)
+	{
+	}
+	host_matrix_key(0, 2, TRUE);
+	TEST_CHECK_EQUAL(m_wakeup_count, 2);
+	TEST_CHECK(test_is_asleep() == TRUE);
+	host_run_ms(1000);
+	TEST_CHECK_EQUAL(m_event_count, 0);
+	host_matrix_key(0, 2, FALSE);
+	host_run_ms(TEST_SCAN_MS);
+	TEST_CHECK_EQUAL(m_wakeup_count, 2);
+	test_press(0, 2);
+	TEST_CHECK_EQUAL(m_wakeup_count, 3);
+	test_release(0, 2);
+	TEST_CHECK(test_is_asleep() == TRUE);
+}
+
+/*
+	The key goes down at every us around the scan that puts the matrix to
+	sleep. Ahead of the row 0 read the scan sees it, after the unmask the
+	edge wakes the matrix, and in between its column is down before the
+	interrupt can see the edge. Every time it must be pressed once.
+*/
+static void test_sleep_race(void)
+{
+	u32 sleep_us;
+	u32 at_us;
+	u32 scanned = 0;
+	u32 rechecked = 0;
+	u32 woken = 0;
+
+	// The time the first scan leaves the matrix asleep.
+	test_boot();
+	while (test_is_asleep() == FALSE)
+	{
+		host_run_us(1);
+	}
+	sleep_us = host_now_us();
+
+	for (at_us = sleep_us - TEST_RACE_BEFORE_US; at_us <= sleep_us + TEST_RACE_AFTER_US; at_us ++)
+	{
+		test_boot();
+		test_schedule(0, 0, TRUE, at_us);
+		host_run_ms(2 * TEST_DEBOUNCE_MS);
+		TEST_CHECK_EQUAL(m_event_count, 1);
+		test_check_event(0, KEYPAD_EVENT_PRESS, 0, 0);
+		if (m_event_count != 1)
+		{
+			printf("  key down at %lu us, the scan put it to sleep at %lu us\n",
+			       (unsigned long)at_us, (unsigned long)sleep_us);
+			continue;
+		}
+		// Taken by the first four scans, or a period later after a wakeup.
+		if (m_event[0].at_us < sleep_us + TEST_DEBOUNCE_MS * 1000UL - TEST_SCAN_US / 2)
+		{
+			scanned ++;
+		}
+		else if (m_wakeup_count == 0)
+		{
+			rechecked ++;
+		}
+		else
+		{
+			woken ++;
+		}
+		// Back to sleep with the scan timer stopped, as the next boot expects.
+		host_matrix_key(0, 0, FALSE);
+		host_run_ms(TEST_DEBOUNCE_MS + TEST_SCAN_MS + 1);
+		TEST_CHECK(test_is_asleep() == TRUE);
+	}
+	printf("  key down around the sleep: %lu seen by the scan, %lu by the read after the unmask, %lu woke it\n",
+	       (unsigned long)scanned, (unsigned long)rechecked, (unsigned long)woken);
+	TEST_CHECK(scanned > 0);
+	TEST_CHECK(rechecked > 0);
+	TEST_CHECK(woken > 0);
+}
+#endif
+
+int main(int argc, char **argv)
+{
+	TEST_RUN(test_vertical_counter);
+	TEST_RUN(test_ghost);
+	TEST_RUN(test_hold);
+#ifdef KEYPAD_WAKEUP
+	TEST_RUN(test_sleep);
+	TEST_RUN(test_sleep_race);
+#endif
+	return TEST_RESULT(argv[0]);
+}
@@ -0,0 +1,271 @@
+#include <string.h>
+
+#include "stm8l15x.h"
+#include "stm8l15x_clk.h"
+
+#include "clock.h"
+#include "event.h"
+#include "pulse.h"
+#include "settings.h"
+#include "timer.h"
+#include "app.h"
+
+#include "host/host.h"
+#include "test.h"
+
+/*
+	The pulse trains on the TIM2 and TIM3 models. The hook logs every edge
+	of the channel 1 outputs, which are checked against the train each
+	command stands for: every pulse off_ms low then on_ms high, to the
+	count of SYSCLK/128, and the line low after the last one. Once the
+	trains are over the done events must have run, SYSCLK must be back at
+	its idle divider, the timer clocks off and the command kept in the
+	settings. A full event queue at the end of a train costs one more
+	period with the line low.
+*/
+TEST_DEFINE
+
+#define TEST_EDGES_MAX      32
+#define TEST_PS_PER_MS      1000000000ULL
+#define TEST_DEFAULT        0xBEEF   // Not a command.
+#define TEST_CMD_PULSE      120      // CMD_PULSE_DURATION of app.c.
+#define TEST_SETTLE_MS      10
+
+typedef struct test_edge_s
+{
+	unsigned long long at_ps;
+	bool is_high;
+} test_edge_t;
+
+typedef struct test_line_s
+{
+	test_edge_t edge[TEST_EDGES_MAX];
+	u8 count;
+} test_line_t;
+
+/* Pulses of a command on each headset line */
+typedef struct test_command_s
+{
+	cmd_to_8670_t cmd;
+	u8 pulse_num[PULSE_CHANNEL_NUMBER];
+} test_command_t;
+
+static const test_command_t m_command[] =
+{
+	{HEADSET1_PAIRING,    {1, 0}},
+	{HEADSET1_POWEROFF,   {2, 0}},
+	{HEADSET2_PAIRING,    {0, 1}},
+	{HEADSET2_POWEROFF,   {0, 2}},
+	{HEADSET_COMBINATION, {3, 4}}
+};
+
+/* Periods set for SETTINGS_KEY_CMD_PULSE, odd ones lose their last ms */
+static const u16 m_cmd_pulse[] = {2, 3, 121, 300, 524};
+
+static test_line_t m_line[PULSE_CHANNEL_NUMBER];
+static unsigned long long m_done_ps[2];
+static u8  m_done_count = 0;
+static u32 m_dummy_count = 0;
+
+static void test_oc1_hook(TIM_TypeDef *tim, bool is_high)
+{
+	test_line_t *p_line = &m_line[(tim == TIM2) ? PULSE_CHANNEL_1 : PULSE_CHANNEL_2];
+
+	TEST_CHECK(p_line->count < TEST_EDGES_MAX);
+	if (p_line->count < TEST_EDGES_MAX)
+	{
+		p_line->edge[p_line->count].at_ps = host_now_ps();
+		p_line->edge[p_line->count].is_high = is_high;
+		p_line->count ++;
+	}
+}
+
+static void test_done_handler(void)
+{
+	if (m_done_count < sizeof(m_done_ps) / sizeof(m_done_ps[0]))
+	{
+		m_done_ps[m_done_count] = host_now_ps();
+	}
+	m_done_count ++;
+}
+
+static void test_dummy_handler(void)
+{
+	m_dummy_count ++;
+}
+
+static void test_boot(void)
+{
+	host_eeprom_erase();
+	host_reset();
+	host_vectors_install();
+	clock_init();
+	settings_init();
+	event_init();
+	timer_init();
+	clock_release(CLOCK_USER_INIT);
+	memset(m_line, 0, sizeof(m_line));
+	m_done_count = 0;
+	host_oc1_hook = test_oc1_hook;
+}
+
+// The pulses of a train from edge index on, returns the index past them.
+static u8 test_check_train(pulse_channel_t channel, u8 index, unsigned long long start_ps,
+                           u8 pulse_num, u16 off_ms, u16 on_ms)
+{
+	const test_line_t *p_line = &m_line[channel];
+	unsigned long long period_ps = (unsigned long long)(off_ms + on_ms) * TEST_PS_PER_MS;
+	u8 pulse;
+
+	for (pulse = 0; pulse < pulse_num; pulse ++)
+	{
+		TEST_CHECK(index + 2 <= p_line->count);
+		if (index + 2 > p_line->count)
+		{
+			return index;
+		}
+		TEST_CHECK_EQUAL(p_line->edge[index].is_high, TRUE);
+		TEST_CHECK_EQUAL(p_line->edge[index].at_ps - start_ps, pulse * period_ps + off_ms * TEST_PS_PER_MS);
+		TEST_CHECK_EQUAL(p_line->edge[index + 1].is_high, FALSE);
+		TEST_CHECK_EQUAL(p_line->edge[index + 1].at_ps - start_ps, (pulse + 1) * period_ps);
+		index += 2;
+	}
+	return index;
+}
+
+// Both lines low and the timers back to how pulse.c found them.
+static void test_check_idle(void)
+{
+	TEST_CHECK(pulse_is_busy() == FALSE);
+	TEST_CHECK_EQUAL(CLK->CKDIVR, CLOCK_IDLE_DIV);
+	TEST_CHECK_EQUAL(CLK->PCKENR1 & (CLK_PCKENR1_TIM2 | CLK_PCKENR1_TIM3), 0);
+	TEST_CHECK_EQUAL(TIM2->CR1 & TIM_CR1_CEN, 0);
+	TEST_CHECK_EQUAL(TIM3->CR1 & TIM_CR1_CEN, 0);
+	TEST_CHECK_EQUAL(TIM2->IER, 0);
+	TEST_CHECK_EQUAL(TIM3->IER, 0);
+}
+
+static void test_send(const test_command_t *p_command, u16 cmd_pulse)
+{
+	u16 half_ms = cmd_pulse / 2;
+	unsigned long long start_ps = host_now_ps();
+	u8 channel;
+	u8 longest = 0;
+	u16 stored;
+
+	send_8670_cmd(p_command->cmd);
+	TEST_CHECK(pulse_is_busy() == TRUE);
+	TEST_CHECK_EQUAL(CLK->CKDIVR, CLK_SYSCLKDiv_1);
+	for (channel = 0; channel < PULSE_CHANNEL_NUMBER; channel ++)
+	{
+		if (p_command->pulse_num[channel] > longest)
+		{
+			longest = p_command->pulse_num[channel];
+		}
+	}
+	host_run_ms((u32)longest * 2 * half_ms + TEST_SETTLE_MS);
+
+	for (channel = 0; channel < PULSE_CHANNEL_NUMBER; channel ++)
+	{
+		TEST_CHECK_EQUAL(test_check_train((pulse_channel_t)channel, 0, start_ps,
+		                                  p_command->pulse_num[channel], half_ms, half_ms),
+		                 2 * p_command->pulse_num[channel]);
+		TEST_CHECK_EQUAL(m_line[channel].count, 2 * p_command->pulse_num[channel]);
+		stored = settings_get((channel == PULSE_CHANNEL_1) ? SETTINGS_KEY_HEADSET1_CMD : SETTINGS_KEY_HEADSET2_CMD,
+		                      TEST_DEFAULT);
+		TEST_CHECK_EQUAL(stored, (p_command->pulse_num[channel] != 0) ? (u16)p_command->cmd : TEST_DEFAULT);
+	}
+	test_check_idle();
+}
+
+static void test_commands(void)
+{
+	u8 index;
+
+	for (index = 0; index < sizeof(m_command) / sizeof(m_command[0]); index ++)
+	{
+		test_boot();
+		test_send(&m_command[index], TEST_CMD_PULSE);
+	}
+}
+
+static void test_cmd_pulse(void)
+{
+	u8 index;
+
+	for (index = 0; index < sizeof(m_cmd_pulse) / sizeof(m_cmd_pulse[0]); index ++)
+	{
+		test_boot();
+		TEST_CHECK(settings_set(SETTINGS_KEY_CMD_PULSE, m_cmd_pulse[index]) == TRUE);
+		test_send(&m_command[sizeof(m_command) / sizeof(m_command[0]) - 1], m_cmd_pulse[index]);
+	}
+}
+
+// A second train waits in the queue and starts as the first one is done.
+static void test_queue(void)
+{
+	pulse_cmd_t first = {PULSE_CHANNEL_1, 1, 20, 10, test_done_handler};
+	pulse_cmd_t second = {PULSE_CHANNEL_1, 2, 40, 30, test_done_handler};
+	unsigned long long start_ps;
+	u8 index;
+
+	test_boot();
+	start_ps = host_now_ps();
+	TEST_CHECK(pulse_send(&first) == TRUE);
+	TEST_CHECK(pulse_send(&second) == TRUE);
+	TEST_CHECK(pulse_send(&second) == TRUE);
+	// The queue holds three trains.
+	TEST_CHECK(pulse_send(&second) == FALSE);
+	host_run_ms(30 + 2 * 70 + 2 * 70 + TEST_SETTLE_MS);
+
+	index = test_check_train(PULSE_CHANNEL_1, 0, start_ps, 1, 10, 20);
+	index = test_check_train(PULSE_CHANNEL_1, index, start_ps + 30 * TEST_PS_PER_MS, 2, 30, 40);
+	index = test_check_train(PULSE_CHANNEL_1, index, start_ps + 170 * TEST_PS_PER_MS, 2, 30, 40);
+	TEST_CHECK_EQUAL(index, 10);
+	TEST_CHECK_EQUAL(m_line[PULSE_CHANNEL_1].count, 10);
+	TEST_CHECK_EQUAL(m_line[PULSE_CHANNEL_2].count, 0);
+	TEST_CHECK_EQUAL(m_done_count, 3);
+	TEST_CHECK_EQUAL(m_done_ps[0] - start_ps, 30 * TEST_PS_PER_MS);
+	TEST_CHECK_EQUAL(m_done_ps[1] - start_ps, 170 * TEST_PS_PER_MS);
+	test_check_idle();
+}
+
+// The done event finds the queue full and is posted a period later.
+static void test_event_full(void)
+{
+	pulse_cmd_t cmd = {PULSE_CHANNEL_2, 1, 10, 10, test_done_handler};
+	unsigned long long start_ps;
+
+	test_boot();
+	start_ps = host_now_ps();
+	TEST_CHECK(pulse_send(&cmd) == TRUE);
+	host_advance_us(19000);
+	while (event_put(test_dummy_handler) == TRUE)
+	{
+	}
+	TEST_CHECK_EQUAL(event_dropped_count(), 1);
+	host_advance_us(2000);
+	// The done event was lost once.
+	TEST_CHECK_EQUAL(event_dropped_count(), 2);
+	TEST_CHECK(pulse_is_busy() == TRUE);
+	TEST_CHECK_EQUAL(TIM3->CR1 & TIM_CR1_CEN, TIM_CR1_CEN);
+	event_dispatch();
+	TEST_CHECK(m_dummy_count > 0);
+	TEST_CHECK_EQUAL(m_done_count, 0);
+	host_run_ms(20 + TEST_SETTLE_MS);
+
+	TEST_CHECK_EQUAL(test_check_train(PULSE_CHANNEL_2, 0, start_ps, 1, 10, 10), 2);
+	TEST_CHECK_EQUAL(m_line[PULSE_CHANNEL_2].count, 2);
+	TEST_CHECK_EQUAL(m_done_count, 1);
+	TEST_CHECK_EQUAL(m_done_ps[0] - start_ps, 40 * TEST_PS_PER_MS);
+	test_check_idle();
+}
+
+int main(int argc, char **argv)
+{
+	TEST_RUN(test_commands);
+	TEST_RUN(test_cmd_pulse);
+	TEST_RUN(test_queue);
+	TEST_RUN(test_event_full);
+	return TEST_RESULT(argv[0]);
+}
@@ -0,0 +1,323 @@
+#include <setjmp.h>
+#include <string.h>
+
+#include "stm8l15x.h"
+#include "stm8l15x_flash.h"
+
+#include "settings.h"
+
+#include "host/host.h"
+#include "test.h"
+
+/*
+	The settings log on the EEPROM model. A reference keeps the values the
+	firmware was given, and the EEPROM is decoded here as well, from the
+	format settings.c describes, so a record that only lives in RAM shows.
+
+	The power fail cases run a script of writes and cut the power at every
+	EEPROM programming operation in turn, with random bytes left in the
+	word or block being programmed. After the reset every key must read as
+	it was, but for the one being written, which may read either way, and
+	the log must go on working.
+*/
+TEST_DEFINE
+
+#define TEST_BLOCKS             FLASH_DATA_EEPROM_BLOCKS_NUMBER
+#define TEST_WORDS              (FLASH_BLOCK_SIZE / 4)
+#define TEST_TAG_HEADER         0xFF
+#define TEST_CHECK_SEED         0xA5
+#define TEST_DEFAULT            0xBEEF   // Not a value the scripts write.
+#define TEST_SETS               20000
+#define TEST_SCRIPT_SETS        100      // Over three compactions.
+#define TEST_SCRIPT_AFTER       40
+#define TEST_FAIL_SEEDS         20
+
+static u16  m_value[SETTINGS_KEY_NUMBER];
+static bool m_is_stored[SETTINGS_KEY_NUMBER];
+static u32  m_random = 1;
+
+/* Set in flight when the power fails, kept across the longjmp */
+static volatile u8  m_pending_key = SETTINGS_KEY_NONE;
+static volatile u16 m_pending_value = 0;
+
+static u32 test_random(u32 low, u32 high)
+{
+	m_random = m_random * 1103515245UL + 12345UL;
+	return low + ((m_random >> 8) % (high - low + 1));
+}
+
+static void test_boot(void)
+{
+	host_reset();
+	settings_init();
+}
+
+static void test_model_clear(void)
+{
+	memset(m_value, 0, sizeof(m_value));
+	memset(m_is_stored, 0, sizeof(m_is_stored));
+}
+
+static void test_set(u8 key, u16 value)
+{
+	m_pending_key = key;
+	m_pending_value = value;
+	TEST_CHECK(settings_set((settings_key_t)key, value) == TRUE);
+	m_value[key] = value;
+	m_is_stored[key] = TRUE;
+	m_pending_key = SETTINGS_KEY_NONE;
+}
+
+// Few values, so some sets find theirs already stored.
+static void test_set_random(void)
+{
+	test_set((u8)test_random(SETTINGS_KEY_NONE + 1, SETTINGS_KEY_NUMBER - 1), (u16)test_random(0, 15) * 0x1111);
+}
+
+static u8 test_check_byte(u8 tag, u16 value)
+{
+	return (u8)(tag ^ (u8)(value >> 8) ^ (u8)value ^ TEST_CHECK_SEED);
+}
+
+static const u8 *test_word(u8 block, u8 word)
+{
+	return &host_eeprom[(u16)block * FLASH_BLOCK_SIZE + (u16)word * 4];
+}
+
+static bool test_word_is_valid(const u8 *p_word)
+{
+	return (p_word[3] == test_check_byte(p_word[0], (u16)((p_word[1] << 8) | p_word[2]))) ? TRUE : FALSE;
+}
+
+// Replays the log of the newest block into p_value, FALSE if there is none.
+static bool test_replay(u16 *p_value, bool *p_is_stored)
+{
+	const u8 *p_word;
+	u8 block;
+	u8 word;
+	u16 sequence = 0;
+	int live = -1;
+
+	for (block = 0; block < TEST_BLOCKS; block ++)
+	{
+		p_word = test_word(block, 0);
+		if ((test_word_is_valid(p_word) == TRUE) && (p_word[0] == TEST_TAG_HEADER) &&
+		    ((live < 0) || ((s16)(((p_word[1] << 8) | p_word[2]) - sequence) > 0)))
+		{
+			live = block;
+			sequence = (u16)((p_word[1] << 8) | p_word[2]);
+		}
+	}
+	memset(p_is_stored, 0, SETTINGS_KEY_NUMBER * sizeof(bool));
+	if (live < 0)
+	{
+		return FALSE;
+	}
+	for (word = 1; word < TEST_WORDS; word ++)
+	{
+		p_word = test_word((u8)live, word);
+		if ((p_word[0] | p_word[1] | p_word[2] | p_word[3]) == 0)
+		{
+			break;
+		}
+		if ((test_word_is_valid(p_word) == TRUE) && (p_word[0] > SETTINGS_KEY_NONE) && (p_word[0] < SETTINGS_KEY_NUMBER))
+		{
+			p_value[p_word[0]] = (u16)((p_word[1] << 8) | p_word[2]);
+			p_is_stored[p_word[0]] = TRUE;
+		}
+	}
+	return TRUE;
+}
+
+// The firmware and the EEPROM agree with the reference on every key.
+static void test_check_all(void)
+{
+	u16 value[SETTINGS_KEY_NUMBER];
+	bool is_stored[SETTINGS_KEY_NUMBER];
+	u8 key;
+
+	TEST_CHECK(test_replay(value, is_stored) == TRUE);
+	for (key = SETTINGS_KEY_NONE + 1; key < SETTINGS_KEY_NUMBER; key ++)
+	{
+		TEST_CHECK_EQUAL(is_stored[key], m_is_stored[key]);
+		TEST_CHECK_EQUAL(settings_get((settings_key_t)key, TEST_DEFAULT), (m_is_stored[key] == TRUE) ? m_value[key] : TEST_DEFAULT);
+		if (m_is_stored[key] == TRUE)
+		{
+			TEST_CHECK_EQUAL(value[key], m_value[key]);
+		}
+	}
+}
+
+static void test_erased(void)
+{
+	host_eeprom_erase();
+	test_model_clear();
+	test_boot();
+	// Formats block 0, with its header only.
+	TEST_CHECK_EQUAL(host_eeprom_operations(), 2);
+	TEST_CHECK(test_word_is_valid(test_word(0, 0)) == TRUE);
+	test_check_all();
+
+	TEST_CHECK(settings_set(SETTINGS_KEY_NONE, 1) == FALSE);
+	TEST_CHECK(settings_set(SETTINGS_KEY_NUMBER, 1) == FALSE);
+	TEST_CHECK_EQUAL(settings_get(SETTINGS_KEY_NUMBER, TEST_DEFAULT), TEST_DEFAULT);
+
+	// A second boot finds the block and writes nothing.
+	test_boot();
+	TEST_CHECK_EQUAL(host_eeprom_operations(), 0);
+	test_check_all();
+}
+
+static void test_same_value(void)
+{
+	u32 operations;
+
+	host_eeprom_erase();
+	test_model_clear();
+	test_boot();
+	test_set(SETTINGS_KEY_CMD_PULSE, 0);
+	operations = host_eeprom_operations();
+	test_set(SETTINGS_KEY_CMD_PULSE, 0);
+	TEST_CHECK_EQUAL(host_eeprom_operations(), operations);
+	test_set(SETTINGS_KEY_CMD_PULSE, 1);
+	TEST_CHECK_EQUAL(host_eeprom_operations(), operations + 1);
+	test_boot();
+	test_check_all();
+}
+
+static void test_log_replay(void)
+{
+	u32 index;
+	u32 header_min = 0xFFFFFFFFUL;
+	u32 header_max = 0;
+	u8 block;
+
+	host_eeprom_erase();
+	test_model_clear();
+	test_boot();
+	m_random = 7;
+	for (index = 0; index < TEST_SETS; index ++)
+	{
+		test_set_random();
+		test_check_all();
+		// Now and then a reset, which must find the same values.
+		if (test_random(0, 99) == 0)
+		{
+			test_boot();
+			test_check_all();
+		}
+	}
+
+	// Compaction goes round robin, so the blocks wear alike.
+	for (block = 0; block < TEST_BLOCKS; block ++)
+	{
+		if (host_eeprom_writes[(u16)block * FLASH_BLOCK_SIZE] < header_min)
+		{
+			header_min = host_eeprom_writes[(u16)block * FLASH_BLOCK_SIZE];
+		}
+		if (host_eeprom_writes[(u16)block * FLASH_BLOCK_SIZE] > header_max)
+		{
+			header_max = host_eeprom_writes[(u16)block * FLASH_BLOCK_SIZE];
+		}
+	}
+	TEST_CHECK(header_min > 0);
+	TEST_CHECK(header_max - header_min <= 2);   // A block program and a header per round.
+}
+
+// Reads after the power fail, the key in flight may have either value.
+static void test_check_after_fail(u8 key, u16 old_value, bool was_stored)
+{
+	u16 value = settings_get((settings_key_t)key, TEST_DEFAULT);
+
+	if (value == m_pending_value)
+	{
+		m_value[key] = value;
+		m_is_stored[key] = TRUE;
+	}
+	else
+	{
+		TEST_CHECK_EQUAL(value, (was_stored == TRUE) ? old_value : TEST_DEFAULT);
+	}
+}
+
+// The script from seed, with the power cut at operation fail_at.
+static bool test_power_fail_run(u32 seed, u32 fail_at, u32 fail_seed)
+{
+	static jmp_buf env;
+	static volatile u32 index;
+	u8 key;
+	u16 old_value;
+	bool was_stored;
+
+	host_eeprom_erase();
+	test_model_clear();
+	host_reset();
+	m_random = seed;
+	index = 0;
+	m_pending_key = SETTINGS_KEY_NONE;
+	if (setjmp(env) == 0)
+	{
+		host_eeprom_fail_at(fail_at, &env, fail_seed);
+		settings_init();
+		for (index = 0; index < TEST_SCRIPT_SETS; index ++)
+		{
+			test_set_random();
+		}
+		host_eeprom_fail_at(0, NULL, 0);
+		return FALSE;
+	}
+
+	// The reset after the power fail.
+	key = m_pending_key;
+	old_value = m_value[key];
+	was_stored = m_is_stored[key];
+	test_boot();
+	if (key != SETTINGS_KEY_NONE)
+	{
+		test_check_after_fail(key, old_value, was_stored);
+	}
+	test_check_all();
+
+	// The log goes on, over the next compaction too.
+	for (index = 0; index < TEST_SCRIPT_AFTER; index ++)
+	{
+		test_set_random();
+	}
+	test_check_all();
+	test_boot();
+	test_check_all();
+	return TRUE;
+}
+
+static void test_power_fail(void)
+{
+	u32 fail_at;
+	u32 fail_seed;
+	u32 runs = 0;
+	u32 failures = test_failures;
+
+	for (fail_seed = 1; fail_seed <= TEST_FAIL_SEEDS; fail_seed ++)
+	{
+		for (fail_at = 1; test_power_fail_run(11, fail_at, fail_seed) == TRUE; fail_at ++)
+		{
+			runs ++;
+			if (test_failures != failures)
+			{
+				printf("  test_power_fail: failed at operation %lu, seed %lu\n", (unsigned long)fail_at, (unsigned long)fail_seed);
+				return;
+			}
+		}
+	}
+	// Every set programs once at most, and compaction twice.
+	TEST_CHECK(runs >= TEST_FAIL_SEEDS * TEST_SCRIPT_SETS / 2);
+	printf("  test_power_fail: %lu power fails\n", (unsigned long)runs);
+}
+
+int main(int argc, char **argv)
+{
+	TEST_RUN(test_erased);
+	TEST_RUN(test_same_value);
+	TEST_RUN(test_log_replay);
+	TEST_RUN(test_power_fail);
+	return TEST_RESULT(argv[0]);
+}
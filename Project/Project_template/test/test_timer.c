@@ -0,0 +1,632 @@
+#include "stm8l15x.h"
+#include "stm8l15x_clk.h"
+#include "stm8l15x_tim4.h"
+
+#include "clock.h"
+#include "event.h"
+#include "sys_time.h"
+#include "timer.h"
+
+#include "host/host.h"
+#include "test.h"
+
+/*
+	timer.c against a reference model, on the timers of
+	test_timer_config.h. The model keeps the absolute deadline tick of every
+	started timer, and each handler checks that it runs for a started timer
+	at the time of its deadline tick. The TIM4 routine is the one of
+	stm8l15x_it.c, for the tick and the tickless build. A SYSCLK divider
+	switch loses the part of the TIM4 count that had passed, so the ticks of
+	the model are shifted by what host_tim4_dropped_ps() reports.
+
+	Built with TIMER_STATS and EVENT_ISR_PROFILE as test_timer_stats, the
+	same cases run with the cycle counter going, and the stats are checked
+	against what the test counts itself.
+*/
+TEST_DEFINE
+
+#define TEST_STEPS      20000
+#define TEST_PERIODS    1000000
+#define TEST_HOOK_LOG   64
+#define TEST_TICK_US    10000
+#define TEST_SYSCLK_MHZ 16
+
+/* A TIM4 count. How late a handler may run: the tickless interrupt lands on
+   a whole count, one more when the deadline is the next count, as
+   timer_hw_program() keeps the autoreload two counts ahead */
+#ifdef TIMER_TICKLESS
+#define TEST_COUNT_US    2048
+#define TEST_LATE_US     (2 * TEST_COUNT_US + TEST_READS_US)
+#else
+#define TEST_COUNT_US    8
+#define TEST_LATE_US     TEST_READS_US
+#endif
+
+/* The model spends a SYSCLK cycle on every read of the cycle counter, 8 us
+   at CLK_SYSCLKDiv_128, and the interrupt and the dispatch read it a few
+   times before a handler runs */
+#ifdef EVENT_ISR_PROFILE
+#define TEST_READS_US    (16 * 8)
+#else
+#define TEST_READS_US    0
+#endif
+
+/* The host time in us, it does not wrap in a test */
+typedef unsigned long long test_us_t;
+
+typedef struct test_reference_s
+{
+	bool is_started;
+	u32  deadline;   // Tick of the next expiry.
+	u32  interval;   // 0 for a one shot timer.
+	u32  fire_count;
+	u32  handler_us; // Time the handler takes, up to.
+} test_reference_t;
+
+static test_reference_t m_reference[TIMER_NUMBER];
+#ifndef TIMER_TICKLESS
+static u8  m_tick_divider = 0;
+#endif
+static test_us_t m_boot_us = 0;
+static unsigned long long m_boot_ps = 0;
+static u32 m_late_max_us = 0;
+static u32 m_fire_count = 0;
+static u32 m_handler_max_us = 0;
+static u32 m_tim4_isr_count = 0;
+static u32 m_random = 1;
+static bool m_hook_busy = FALSE;
+static bool m_hook_wraps = FALSE;
+static bool m_start_read = FALSE;   // The first TIM4 read of a start is to come.
+static unsigned long long m_start_ps = 0;
+static test_us_t m_hook_start_us[TEST_HOOK_LOG];   // The last time moves of the read hook.
+static test_us_t m_hook_end_us[TEST_HOOK_LOG];
+static u8  m_hook_count = 0;
+
+
+static test_us_t test_now_us(void)
+{
+	return host_now_ps() / 1000000ULL;
+}
+
+static u32 test_random(u32 low, u32 high)
+{
+	m_random = m_random * 1103515245UL + 12345UL;
+	return low + ((m_random >> 8) % (high - low + 1));
+}
+
+static void test_tim4_isr(void)
+{
+	m_tim4_isr_count ++;
+	TIMER_ISR_ENTER();
+	EVENT_ISR_ENTER();
+#ifdef TIMER_TICKLESS
+	TIM4_ClearITPendingBit(TIM4_IT_Update);
+	tick_timeout_handler();
+#else
+	sys_time_update_handler();
+	m_tick_divider ++;
+	if ((m_tick_divider % 5) == 0)
+	{
+		m_tick_divider = 0;
+		tick_timeout_handler();
+	}
+	TIM4_ClearITPendingBit(TIM4_IT_Update);
+#endif
+	EVENT_ISR_EXIT();
+	TIMER_ISR_EXIT();
+}
+
+#ifdef EVENT_ISR_PROFILE
+static void test_tim1_isr(void)
+{
+	event_cycle_wrap_handler();
+}
+#endif
+
+/* The tick timer.c counts at a time in ps. TIM4 falls behind by what the
+   SYSCLK divider switches drop */
+static u32 test_tick_at(unsigned long long time_ps)
+{
+	u32 counts = (u32)((time_ps - m_boot_ps - host_tim4_dropped_ps()) / (TEST_COUNT_US * 1000000ULL));
+
+#ifdef TIMER_TICKLESS
+	return counts * 128 / 625;
+#else
+	return counts / (TEST_TICK_US / TEST_COUNT_US);
+#endif
+}
+
+/* Start of a tick */
+static test_us_t test_tick_us(u32 tick)
+{
+	return (m_boot_ps + host_tim4_dropped_ps()) / 1000000ULL + (test_us_t)tick * TEST_TICK_US;
+}
+
+/* Time the read hook moved since since_us, it is not the firmware's lateness */
+static u32 test_hook_us(test_us_t since_us)
+{
+	u32 us = 0;
+	u8  index;
+
+	for (index = 0; index < TEST_HOOK_LOG; index ++)
+	{
+		if (m_hook_end_us[index] > since_us)
+		{
+			us += (u32)(m_hook_end_us[index] - ((m_hook_start_us[index] > since_us) ? m_hook_start_us[index] : since_us));
+		}
+	}
+	return us;
+}
+
+/* How late a timer due at due_us is now */
+static u32 test_late_us(test_us_t due_us)
+{
+	return (u32)(test_now_us() - due_us - test_hook_us(due_us));
+}
+
+/* Moves the time while the firmware reads TIM4, so the counter may wrap
+   between the counter read and the flag read */
+static void test_tim4_read_hook(void)
+{
+	if (m_hook_busy == TRUE)
+	{
+		return;
+	}
+	m_hook_busy = TRUE;
+	// A wrap at most, as between two reads on the target.
+	if ((m_hook_wraps == TRUE) && (TIM4->CNTR == TIM4->ARR) && (test_random(0, 1) == 0))
+	{
+		m_hook_start_us[m_hook_count % TEST_HOOK_LOG] = test_now_us();
+		host_advance_us(test_random(1, TEST_COUNT_US));
+		m_hook_end_us[m_hook_count % TEST_HOOK_LOG] = test_now_us();
+		m_hook_count ++;
+	}
+	if (m_start_read == TRUE)
+	{
+		m_start_read = FALSE;
+		m_start_ps = host_now_ps();
+	}
+	m_hook_busy = FALSE;
+}
+
+static void test_boot(void)
+{
+	host_reset();
+	host_vector[HOST_VECTOR_TIM4] = test_tim4_isr;
+#ifdef EVENT_ISR_PROFILE
+	host_vector[HOST_VECTOR_TIM1] = test_tim1_isr;
+#endif
+	host_tim4_read_hook = test_tim4_read_hook;
+	clock_init();
+	event_init();
+	timer_init();
+	m_boot_us = test_now_us();
+	m_boot_ps = host_now_ps();
+}
+
+void test_timeout_handler(u8 timer_index)
+{
+	test_reference_t *p_reference = &m_reference[timer_index];
+	test_us_t due_us = test_tick_us(p_reference->deadline);
+	u32 handler_us;
+
+	m_fire_count ++;
+	p_reference->fire_count ++;
+	TEST_CHECK(p_reference->is_started == TRUE);
+	TEST_CHECK(test_now_us() >= due_us);
+	TEST_CHECK(test_late_us(due_us) <= TEST_LATE_US);
+	if (test_late_us(due_us) > m_late_max_us)
+	{
+		m_late_max_us = test_late_us(due_us);
+	}
+	if (p_reference->interval != 0)
+	{
+		p_reference->deadline += p_reference->interval;
+	}
+	else
+	{
+		p_reference->is_started = FALSE;
+	}
+	if (p_reference->handler_us != 0)
+	{
+		// A slow handler, the interrupts still come.
+		handler_us = test_random(0, p_reference->handler_us);
+		host_advance_us(handler_us);
+		if (handler_us > m_handler_max_us)
+		{
+			m_handler_max_us = handler_us;
+		}
+	}
+}
+
+static void test_start(u8 timer_index, u32 duration)
+{
+	// The tickless build counts from its first TIM4 read.
+	m_start_ps = host_now_ps();
+	m_start_read = TRUE;
+	timer_start(timer_index, duration);
+	m_start_read = FALSE;
+	m_reference[timer_index].is_started = TRUE;
+	m_reference[timer_index].deadline = test_tick_at(m_start_ps) + ((duration == 0) ? 1 : duration);
+	m_reference[timer_index].interval = 0;
+}
+
+static void test_start_periodic(u8 timer_index, u32 phase, u32 interval)
+{
+	m_start_ps = host_now_ps();
+	m_start_read = TRUE;
+	timer_start_periodic(timer_index, phase, interval);
+	m_start_read = FALSE;
+	m_reference[timer_index].is_started = TRUE;
+	m_reference[timer_index].deadline = test_tick_at(m_start_ps) + ((phase == 0) ? 1 : phase);
+	m_reference[timer_index].interval = interval;
+}
+
+static void test_stop(u8 timer_index)
+{
+	m_reference[timer_index].is_started = FALSE;
+	timer_stop(timer_index);
+}
+
+/* No started timer is past its deadline */
+static void test_check_overdue(void)
+{
+	u8 index;
+
+	for (index = 0; index < TIMER_NUMBER; index ++)
+	{
+		if (m_reference[index].is_started == TRUE)
+		{
+			TEST_CHECK((test_now_us() <= test_tick_us(m_reference[index].deadline)) ||
+			           (test_late_us(test_tick_us(m_reference[index].deadline)) <= TEST_LATE_US));
+		}
+	}
+}
+
+static void test_one_shot(void)
+{
+	test_boot();
+	host_run_us(3000);
+	test_start(TIMER_ID_TEST0, 1);
+	test_start(TIMER_ID_TEST1, 2);
+	test_start(TIMER_ID_TEST2, 100);
+	test_start(TIMER_ID_TEST3, 0);
+	host_run_ms(2000);
+	TEST_CHECK_EQUAL(m_fire_count, 4);
+	TEST_CHECK_EQUAL(timer_next_expiry(), TIMER_NO_EXPIRY);
+}
+
+static void test_stop_before_expiry(void)
+{
+	test_boot();
+	test_start(TIMER_ID_TEST0, 10);
+	test_start(TIMER_ID_TEST1, 10);
+	host_run_ms(50);
+	test_stop(TIMER_ID_TEST0);
+	host_run_ms(200);
+	TEST_CHECK_EQUAL(m_fire_count, 1);
+}
+
+/* Random starts, restarts and stops, with equal deadlines and long waits */
+static void test_reference(void)
+{
+	u32 step;
+	u8  index;
+	u32 duration;
+
+	test_boot();
+	for (step = 0; step < TEST_STEPS; step ++)
+	{
+		index = (u8)test_random(0, TIMER_NUMBER - 1);
+		switch (test_random(0, 9))
+		{
+			case 0: case 1: case 2:
+			{
+				test_start(index, test_random(0, 5));
+				break;
+			}
+			case 3: case 4:
+			{
+				test_start(index, test_random(1, 100));
+				break;
+			}
+			case 5:
+			{
+				test_start(index, test_random(100, 3000));
+				break;
+			}
+			case 6: case 7:
+			{
+				test_stop(index);
+				break;
+			}
+			default:
+			{
+				// The same deadline as another timer.
+				duration = m_reference[(index + 1) % TIMER_NUMBER].deadline - test_tick_at(host_now_ps());
+				test_start(index, (duration < 3000) ? duration : 1);
+				break;
+			}
+		}
+		host_run_us((test_random(0, 99) == 0) ? test_random(0, 2000000) : test_random(0, 30000));
+		test_check_overdue();
+	}
+	for (index = 0; index < TIMER_NUMBER; index ++)
+	{
+		test_stop(index);
+	}
+	TEST_CHECK_EQUAL(timer_next_expiry(), TIMER_NO_EXPIRY);
+	printf("  %lu expiries\n", (unsigned long)m_fire_count);
+}
+
+/* Both engines expire on the 10 ms grid, also after a minute */
+static void test_accuracy(void)
+{
+	test_boot();
+	host_run_us(4321);
+	test_start(TIMER_ID_TEST0, 1);
+	test_start(TIMER_ID_TEST1, 7);
+	test_start(TIMER_ID_TEST2, 333);
+	test_start(TIMER_ID_TEST3, 6000);
+	host_run_ms(61000);
+	TEST_CHECK_EQUAL(m_fire_count, 4);
+	printf("  latest expiry %lu us after its tick\n", (unsigned long)m_late_max_us);
+}
+
+/* Short timers keep the tickless period a few counts long, so the reads
+   often straddle an update. The system time never goes back or drifts, and
+   no timer expires early */
+static void test_wrap_between_reads(void)
+{
+	u32 step;
+	u32 time_us;
+	u32 last_us = 0;
+	u8  index;
+
+	test_boot();
+	m_hook_wraps = TRUE;
+	for (step = 0; step < TEST_STEPS; step ++)
+	{
+		index = (u8)test_random(0, TIMER_NUMBER - 1);
+		if (test_random(0, 3) == 0)
+		{
+			test_stop(index);
+		}
+		else
+		{
+			test_start(index, test_random(0, 3));
+		}
+		host_run_us(test_random(0, 20000));
+
+		m_hook_busy = TRUE;
+		time_us = sys_time_now_us();
+		TEST_CHECK(time_us >= last_us);
+		TEST_CHECK(test_now_us() - m_boot_us >= time_us);
+		TEST_CHECK(test_now_us() - m_boot_us - time_us < TEST_COUNT_US);
+		last_us = time_us;
+		test_check_overdue();
+		m_hook_busy = FALSE;
+	}
+	printf("  %lu expiries, latest %lu us after its tick\n", (unsigned long)m_fire_count,
+	       (unsigned long)m_late_max_us);
+}
+
+/* Every expiry of a million periods lands on its own tick, with one shot
+   timers going on around them */
+static void test_periodic(void)
+{
+	u32 second;
+	u32 first;
+
+	test_boot();
+	host_run_us(1234);
+	test_start_periodic(TIMER_ID_TEST0, 3, 1);
+	first = m_reference[TIMER_ID_TEST0].deadline;
+	test_start_periodic(TIMER_ID_TEST1, 0, 7);
+	test_start_periodic(TIMER_ID_TEST2, 5, 100);
+	for (second = 0; second <= TEST_PERIODS / 100; second ++)
+	{
+		test_start(TIMER_ID_TEST3, test_random(0, 150));
+		host_run_ms(1000);
+		test_check_overdue();
+	}
+	// Every period ran, up to the tick now.
+	TEST_CHECK(m_reference[TIMER_ID_TEST0].fire_count >= TEST_PERIODS);
+	TEST_CHECK_EQUAL(m_reference[TIMER_ID_TEST0].deadline, test_tick_at(host_now_ps()) + 1);
+	TEST_CHECK_EQUAL(m_reference[TIMER_ID_TEST0].deadline, first + m_reference[TIMER_ID_TEST0].fire_count);
+	printf("  %lu periods, latest %lu us after its tick\n",
+	       (unsigned long)m_reference[TIMER_ID_TEST0].fire_count, (unsigned long)m_late_max_us);
+}
+
+/* A handler that takes most of its interval does not move the next expiry */
+static void test_periodic_slow_handler(void)
+{
+	test_boot();
+	m_reference[TIMER_ID_TEST0].handler_us = 8 * TEST_TICK_US;
+	test_start_periodic(TIMER_ID_TEST0, 10, 10);
+	host_run_ms(600000 + 5);
+	test_check_overdue();
+	TEST_CHECK_EQUAL(m_reference[TIMER_ID_TEST0].fire_count, 6000);
+	printf("  latest expiry %lu us after its tick\n", (unsigned long)m_late_max_us);
+}
+
+/* TIM4 ran the time since boot but for what the switches dropped, sys_time
+   within a count behind it */
+static void test_check_sys_time(void)
+{
+	unsigned long long elapsed_ps = host_now_ps() - m_boot_ps - host_tim4_dropped_ps();
+	unsigned long long time_ps = (unsigned long long)sys_time_now_us() * 1000000ULL;
+
+	TEST_CHECK(elapsed_ps >= time_ps);
+	TEST_CHECK(elapsed_ps - time_ps < TEST_COUNT_US * 1000000ULL);
+}
+
+/* A random start, periodic start or stop */
+static void test_random_step(void)
+{
+	u8 index = (u8)test_random(0, TIMER_NUMBER - 1);
+
+	switch (test_random(0, 3))
+	{
+		case 0:
+		{
+			test_stop(index);
+			break;
+		}
+		case 1:
+		{
+			test_start(index, test_random(0, 5));
+			break;
+		}
+		case 2:
+		{
+			test_start(index, test_random(1, 300));
+			break;
+		}
+		default:
+		{
+			test_start_periodic(index, test_random(0, 10), test_random(1, 50));
+			break;
+		}
+	}
+}
+
+/* The switch of clock_apply(), at any divider */
+static void test_set_sysclk_div(CLK_SYSCLKDiv_TypeDef div)
+{
+	disableInterrupts();
+	CLK_SYSCLKDivConfig(div);
+	timer_set_sysclk_div(div);
+	enableInterrupts();
+}
+
+/* main() releases CLOCK_USER_INIT and the users come and go while timers
+   run, so SYSCLK switches between 16 MHz and CLOCK_IDLE_DIV at any point
+   of a TIM4 count. A switch loses less than a count, the timers expire on
+   the ticks of the time TIM4 kept and sys_time follows it */
+static void test_clock_users(void)
+{
+	unsigned long long dropped_ps;
+	u32 step;
+	u32 switches = 0;
+	u8  users = 0;
+	u8  user;
+
+	test_boot();
+	clock_release(CLOCK_USER_INIT);
+	TEST_CHECK_EQUAL(CLK->CKDIVR, CLOCK_IDLE_DIV);
+	for (step = 0; step < TEST_STEPS; step ++)
+	{
+		test_random_step();
+		host_run_us(test_random(0, 30000));
+
+		user = (test_random(0, 1) == 0) ? CLOCK_USER_PULSE : CLOCK_USER_ADC;
+		dropped_ps = host_tim4_dropped_ps();
+		if ((users & user) != 0)
+		{
+			users &= (u8)~user;
+			clock_release((clock_user_t)user);
+		}
+		else
+		{
+			switches += (users == 0) ? 1 : 0;
+			users |= user;
+			clock_request((clock_user_t)user);
+		}
+		switches += (users == 0) ? 1 : 0;
+		TEST_CHECK_EQUAL(CLK->CKDIVR, (users != 0) ? CLK_SYSCLKDiv_1 : CLOCK_IDLE_DIV);
+		TEST_CHECK(host_tim4_dropped_ps() - dropped_ps < TEST_COUNT_US * 1000000ULL);
+		test_check_sys_time();
+		test_check_overdue();
+	}
+	printf("  %lu switches, %lu us dropped, %lu expiries, latest %lu us after its tick\n",
+	       (unsigned long)switches, (unsigned long)(host_tim4_dropped_ps() / 1000000ULL),
+	       (unsigned long)m_fire_count, (unsigned long)m_late_max_us);
+}
+
+/* The same through every divider, as timer_set_sysclk_div() allows */
+static void test_sysclk_div(void)
+{
+	unsigned long long dropped_ps;
+	u32 step;
+	CLK_SYSCLKDiv_TypeDef div;
+
+	test_boot();
+	clock_release(CLOCK_USER_INIT);
+	for (step = 0; step < TEST_STEPS; step ++)
+	{
+		test_random_step();
+		host_run_us(test_random(0, 30000));
+
+		div = (CLK_SYSCLKDiv_TypeDef)test_random(CLK_SYSCLKDiv_1, CLK_SYSCLKDiv_128);
+		dropped_ps = host_tim4_dropped_ps();
+		test_set_sysclk_div(div);
+		TEST_CHECK(host_tim4_dropped_ps() - dropped_ps < TEST_COUNT_US * 1000000ULL);
+		test_check_sys_time();
+		test_check_overdue();
+	}
+	printf("  %lu us dropped, %lu expiries, latest %lu us after its tick\n",
+	       (unsigned long)(host_tim4_dropped_ps() / 1000000ULL), (unsigned long)m_fire_count,
+	       (unsigned long)m_late_max_us);
+}
+
+#ifdef TIMER_STATS
+/* The counters, and a handler longer than a wrap of the 16 bit TIM1 */
+static void test_stats(void)
+{
+	timer_stats_t stats;
+	u32 isr_count;
+	u32 isr_cycles;
+	u8  start;
+
+	test_boot();
+	test_start_periodic(TIMER_ID_TEST0, 1, 1);
+	m_reference[TIMER_ID_TEST1].handler_us = TEST_TICK_US;
+	for (start = 0; start < 20; start ++)
+	{
+		test_start(TIMER_ID_TEST1, 3);
+		host_run_ms(100);
+	}
+	test_stop(TIMER_ID_TEST0);
+
+	timer_get_stats(TIMER_ID_TEST0, &stats);
+	TEST_CHECK_EQUAL(stats.start_count, 1);
+	TEST_CHECK_EQUAL(stats.fire_count, m_reference[TIMER_ID_TEST0].fire_count);
+	// Dispatched in the tick of the deadline, but after a slow handler.
+	TEST_CHECK(stats.late_histogram[0] + stats.late_histogram[1] == stats.fire_count);
+
+	timer_get_stats(TIMER_ID_TEST1, &stats);
+	TEST_CHECK_EQUAL(stats.start_count, 20);
+	TEST_CHECK_EQUAL(stats.fire_count, 20);
+	TEST_CHECK(m_handler_max_us * TEST_SYSCLK_MHZ > 0xFFFF);
+	TEST_CHECK(stats.handler_max_cycles >= m_handler_max_us * TEST_SYSCLK_MHZ);
+	// The host only spends cycles on the counter reads, also those of the
+	// interrupts taken meanwhile.
+	TEST_CHECK(stats.handler_max_cycles <= m_handler_max_us * TEST_SYSCLK_MHZ + 64);
+
+	// Every TIM4 update, not only the ones that end a tick.
+	timer_get_isr_stats(&isr_count, &isr_cycles);
+	TEST_CHECK_EQUAL(isr_count, m_tim4_isr_count);
+	TEST_CHECK(isr_cycles >= isr_count);
+	TEST_CHECK(event_isr_max_cycles() > 0);
+	printf("  %lu TIM4 interrupts, %lu cycles, handler up to %lu cycles\n", (unsigned long)isr_count,
+	       (unsigned long)isr_cycles, (unsigned long)stats.handler_max_cycles);
+}
+#endif
+
+int main(int argc, char **argv)
+{
+	TEST_RUN(test_one_shot);
+	TEST_RUN(test_stop_before_expiry);
+	TEST_RUN(test_reference);
+	TEST_RUN(test_accuracy);
+	TEST_RUN(test_wrap_between_reads);
+	TEST_RUN(test_periodic);
+	TEST_RUN(test_periodic_slow_handler);
+	TEST_RUN(test_clock_users);
+	TEST_RUN(test_sysclk_div);
+#ifdef TIMER_STATS
+	TEST_RUN(test_stats);
+#endif
+	return TEST_RESULT(argv[0]);
+}
@@ -0,0 +1,335 @@
+#include <time.h>
+
+#include "stm8l15x.h"
+
+#include "event.h"
+#include "timer.h"
+
+#include "host/host.h"
+#include "test.h"
+
+/*
+	The cost of the expiry queue against the scan it replaced, on a pool of
+	TEST_BENCH_TIMERS timers of test_timer_bench_config.h. timer.c is built
+	into the test, so the queue can be read after every start. The scan is
+	the engine timer.c had before the queue, kept here on the host only: a
+	start rescans every slot for the next deadline, and so does the tick
+	that reaches it. Unlike the old one it keeps the elapsed ticks of the
+	others on a start and calls the handlers after the scan, so both fire
+	the same timers at the same ticks, which is checked.
+
+	The load is that of the application grown to the pool: every timer is
+	restarted from its handler, mostly with debounce and click window
+	lengths and now and then with a long timeout, and each tick may restart
+	or stop a timer as a new edge would. The ticks are driven straight into
+	tick_timeout_handler(), so the host time is that of the engine alone.
+
+	The cost is counted in entries: a queue start walks in from the nearer
+	end past some of them and a scan start looks at every slot, a queue
+	tick touches the head and takes off every expired one, a scan tick
+	counts down and looks at every slot when it reaches the deadline. Host
+	ns are shown as well, the host has no STM8 cycles.
+*/
+#include "../src/timer.c"
+
+TEST_DEFINE
+
+#define TEST_BENCH_TICKS    100000   // 1000 s of 10 ms ticks.
+#define TEST_BENCH_SEED     5
+
+typedef struct test_engine_s
+{
+	const char *p_name;
+	void (*start)(u8 timer_index, u32 duration);
+	void (*stop)(u8 timer_index);
+	void (*tick)(void);   // Also runs the handlers.
+} test_engine_t;
+
+typedef struct test_scan_s
+{
+	bool is_started;
+	bool is_expired;
+	u32  left;           // Ticks from the last scan.
+} test_scan_t;
+
+static const test_engine_t *m_p_engine;
+static u32  m_random = 1;
+static u32  m_tick = 0;
+static u32  m_deadline[TIMER_NUMBER];
+static u32  m_fire_count = 0;
+static u32  m_fire_hash = 0;       // Of the ticks and timers of the expiries.
+static u32  m_start_count = 0;
+static u32  m_start_entries = 0;   // Entries the starts walked past or looked at.
+static u32  m_tick_entries = 0;    // Entries the ticks touched.
+static bool m_is_counted = FALSE;  // The queue walks are read, the timed run leaves them.
+
+static test_scan_t m_scan[TIMER_NUMBER];
+static u32  m_scan_elapsed = 0;    // Ticks since the last scan.
+static u32  m_scan_wait = 0;       // Ticks from the last scan to the next deadline, 0 for none.
+
+
+static u32 test_random(u32 low, u32 high)
+{
+	m_random = m_random * 1103515245UL + 12345UL;
+	return low + ((m_random >> 8) % (high - low + 1));
+}
+
+static double test_elapsed_ns(const struct timespec *p_start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (double)(end.tv_sec - p_start->tv_sec) * 1e9 + (double)(end.tv_nsec - p_start->tv_nsec);
+}
+
+static void test_boot(void)
+{
+	host_reset();
+	event_init();
+	timer_init();
+}
+
+// Debounce, click and hold lengths, and a long timeout one time in ten.
+static u32 test_duration(void)
+{
+	u32 kind = test_random(0, 9);
+
+	if (kind < 5)
+	{
+		return test_random(2, 5);
+	}
+	if (kind < 9)
+	{
+		return test_random(10, 100);
+	}
+	return test_random(500, 6000);
+}
+
+// The entries timer_queue_insert() walked past to put timer_index in.
+static u32 test_walk(u8 timer_index, bool is_from_head)
+{
+	u8  index = m_timer_queue_head;
+	u32 position = 0;
+	u32 length = 0;
+
+	while (index != TIMER_INDEX_NONE)
+	{
+		if (index == timer_index)
+		{
+			position = length;
+		}
+		length ++;
+		index = m_timer_manager[index].next;
+	}
+	return (is_from_head == TRUE) ? position : length - 1 - position;
+}
+
+static void test_queue_start(u8 timer_index, u32 duration)
+{
+	u32 span = m_timer_queue_span;
+
+	if (m_is_counted == FALSE)
+	{
+		timer_start(timer_index, duration);
+		return;
+	}
+	// The walk starts once the timer is out of the queue.
+	if ((m_timer_manager[timer_index].timer_started == TRUE) && (m_timer_queue_tail == timer_index))
+	{
+		span -= m_timer_manager[timer_index].timer_delta;
+	}
+	timer_start(timer_index, duration);
+	m_start_entries += test_walk(timer_index, (duration <= span / 2) ? TRUE : FALSE);
+}
+
+static void test_queue_tick(void)
+{
+	u32 fire_count = m_fire_count;
+
+	tick_timeout_handler();
+	event_dispatch();
+	m_tick_entries += 1 + m_fire_count - fire_count;
+}
+
+static const test_engine_t m_queue_engine = {"queue", test_queue_start, timer_stop, test_queue_tick};
+
+// Counts the elapsed ticks off every started slot and finds the next deadline.
+static void test_scan_update(void)
+{
+	u8 index;
+
+	m_scan_wait = 0;
+	for (index = 0; index < TIMER_NUMBER; index ++)
+	{
+		if (m_scan[index].is_started == FALSE)
+		{
+			continue;
+		}
+		m_scan[index].left -= m_scan_elapsed;
+		if (m_scan[index].left == 0)
+		{
+			m_scan[index].is_started = FALSE;
+			m_scan[index].is_expired = TRUE;
+		}
+		else if ((m_scan_wait == 0) || (m_scan[index].left < m_scan_wait))
+		{
+			m_scan_wait = m_scan[index].left;
+		}
+	}
+	m_scan_elapsed = 0;
+}
+
+static void test_scan_start(u8 timer_index, u32 duration)
+{
+	// Before the next deadline, so nothing expires in this scan.
+	test_scan_update();
+	m_start_entries += TIMER_NUMBER;
+	m_scan[timer_index].is_started = TRUE;
+	m_scan[timer_index].left = duration;
+	if ((m_scan_wait == 0) || (duration < m_scan_wait))
+	{
+		m_scan_wait = duration;
+	}
+}
+
+// As the old engine, the next deadline is left as it was.
+static void test_scan_stop(u8 timer_index)
+{
+	m_scan[timer_index].is_started = FALSE;
+}
+
+static void test_scan_tick(void)
+{
+	u8 index;
+
+	m_tick_entries ++;
+	if (m_scan_wait == 0)
+	{
+		return;
+	}
+	m_scan_elapsed ++;
+	if (m_scan_elapsed < m_scan_wait)
+	{
+		return;
+	}
+	test_scan_update();
+	m_tick_entries += TIMER_NUMBER;
+	for (index = 0; index < TIMER_NUMBER; index ++)
+	{
+		if (m_scan[index].is_expired == TRUE)
+		{
+			m_scan[index].is_expired = FALSE;
+			test_timeout_handler(index);
+		}
+	}
+}
+
+static const test_engine_t m_scan_engine = {"scan", test_scan_start, test_scan_stop, test_scan_tick};
+
+static void test_start(u8 timer_index, u32 duration)
+{
+	m_deadline[timer_index] = m_tick + duration;
+	m_start_count ++;
+	m_p_engine->start(timer_index, duration);
+}
+
+void test_timeout_handler(u8 timer_index)
+{
+	TEST_CHECK_EQUAL(m_tick, m_deadline[timer_index]);
+	m_fire_count ++;
+	m_fire_hash = m_fire_hash * 31 + (m_tick << 8) + timer_index;
+	if (test_random(0, 7) != 0)
+	{
+		test_start(timer_index, test_duration());
+	}
+}
+
+static void test_run_ticks(const test_engine_t *p_engine)
+{
+	u8  index;
+
+	m_p_engine = p_engine;
+	m_random = TEST_BENCH_SEED;
+	m_tick = 0;
+	m_fire_count = 0;
+	m_fire_hash = 0;
+	m_start_count = 0;
+	m_start_entries = 0;
+	m_tick_entries = 0;
+	for (index = 0; index < TIMER_NUMBER; index ++)
+	{
+		test_start(index, test_duration());
+	}
+	for (m_tick = 1; m_tick <= TEST_BENCH_TICKS; m_tick ++)
+	{
+		p_engine->tick();
+
+		// An edge restarts a timer early, or a state ends and stops one.
+		if (test_random(0, 3) == 0)
+		{
+			index = (u8)test_random(0, TIMER_NUMBER - 1);
+			if (test_random(0, 3) != 0)
+			{
+				test_start(index, test_duration());
+			}
+			else
+			{
+				p_engine->stop(index);
+			}
+		}
+	}
+}
+
+static void test_print_entries(const test_engine_t *p_engine)
+{
+	printf("  %u timers, %s: %.2f entries per start, %.2f per tick, %lu expiries\n",
+	       (unsigned)TIMER_NUMBER, p_engine->p_name, (double)m_start_entries / m_start_count,
+	       (double)m_tick_entries / TEST_BENCH_TICKS, (unsigned long)m_fire_count);
+}
+
+static void test_entries(void)
+{
+	u32 fire_count;
+	u32 fire_hash;
+	u32 entries;
+
+	test_boot();
+	m_is_counted = TRUE;
+	test_run_ticks(&m_queue_engine);
+	TEST_CHECK(m_fire_count > TEST_BENCH_TICKS / 1000 * TIMER_NUMBER);
+	// Far from a walk past every started timer, the worst case.
+	TEST_CHECK(m_start_entries < m_start_count * (TIMER_NUMBER / 8 + 1));
+	test_print_entries(&m_queue_engine);
+	fire_count = m_fire_count;
+	fire_hash = m_fire_hash;
+	entries = m_start_entries + m_tick_entries;
+
+	test_run_ticks(&m_scan_engine);
+	TEST_CHECK_EQUAL(m_fire_count, fire_count);
+	TEST_CHECK_EQUAL(m_fire_hash, fire_hash);
+	TEST_CHECK(entries < m_start_entries + m_tick_entries);
+	test_print_entries(&m_scan_engine);
+}
+
+static void test_cost(void)
+{
+	const test_engine_t *p_engine[] = {&m_queue_engine, &m_scan_engine};
+	struct timespec start;
+	u8 index;
+
+	test_boot();
+	for (index = 0; index < sizeof(p_engine) / sizeof(p_engine[0]); index ++)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		test_run_ticks(p_engine[index]);
+		printf("  %u timers, %s: %.1f ns per tick on the host, with its starts and stops\n",
+		       (unsigned)TIMER_NUMBER, p_engine[index]->p_name, test_elapsed_ns(&start) / TEST_BENCH_TICKS);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	TEST_RUN(test_entries);
+	TEST_RUN(test_cost);
+	return TEST_RESULT(argv[0]);
+}
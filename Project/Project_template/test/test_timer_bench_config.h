@@ -0,0 +1,34 @@
+#ifndef TIMER_CONFIG_H_
+#define TIMER_CONFIG_H_
+
+/*
+	Included ahead of test_timer_bench.c in place of inc/timer_config.h,
+	with a pool of TEST_BENCH_TIMERS timers. The ids are spelled out in
+	binary blocks, TIMER_ID_BENCH_a0110 and so on.
+*/
+#define TEST_TIMERS_1(TIMER_DEF, p)      TIMER_DEF(TIMER_ID_BENCH_##p, test_timeout_handler)
+#define TEST_TIMERS_2(TIMER_DEF, p)      TEST_TIMERS_1(TIMER_DEF, p##0) TEST_TIMERS_1(TIMER_DEF, p##1)
+#define TEST_TIMERS_4(TIMER_DEF, p)      TEST_TIMERS_2(TIMER_DEF, p##0) TEST_TIMERS_2(TIMER_DEF, p##1)
+#define TEST_TIMERS_8(TIMER_DEF, p)      TEST_TIMERS_4(TIMER_DEF, p##0) TEST_TIMERS_4(TIMER_DEF, p##1)
+#define TEST_TIMERS_16(TIMER_DEF, p)     TEST_TIMERS_8(TIMER_DEF, p##0) TEST_TIMERS_8(TIMER_DEF, p##1)
+#define TEST_TIMERS_32(TIMER_DEF, p)     TEST_TIMERS_16(TIMER_DEF, p##0) TEST_TIMERS_16(TIMER_DEF, p##1)
+#define TEST_TIMERS_64(TIMER_DEF, p)     TEST_TIMERS_32(TIMER_DEF, p##0) TEST_TIMERS_32(TIMER_DEF, p##1)
+#define TEST_TIMERS_128(TIMER_DEF, p)    TEST_TIMERS_64(TIMER_DEF, p##0) TEST_TIMERS_64(TIMER_DEF, p##1)
+
+#if TEST_BENCH_TIMERS == 6
+#define TIMER_LIST(TIMER_DEF)    TEST_TIMERS_4(TIMER_DEF, a) TEST_TIMERS_2(TIMER_DEF, b)
+#elif TEST_BENCH_TIMERS == 32
+#define TIMER_LIST(TIMER_DEF)    TEST_TIMERS_32(TIMER_DEF, a)
+#elif TEST_BENCH_TIMERS == 128
+#define TIMER_LIST(TIMER_DEF)    TEST_TIMERS_128(TIMER_DEF, a)
+#elif TEST_BENCH_TIMERS == 254
+// The most the u8 queue links of timer.c allow.
+#define TIMER_LIST(TIMER_DEF) \
+	TEST_TIMERS_128(TIMER_DEF, a) TEST_TIMERS_64(TIMER_DEF, b) TEST_TIMERS_32(TIMER_DEF, c) \
+	TEST_TIMERS_16(TIMER_DEF, d) TEST_TIMERS_8(TIMER_DEF, e) TEST_TIMERS_4(TIMER_DEF, f) \
+	TEST_TIMERS_2(TIMER_DEF, g)
+#else
+#error "No timer list for this TEST_BENCH_TIMERS"
+#endif
+
+#endif // TIMER_CONFIG_H_
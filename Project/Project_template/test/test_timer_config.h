@@ -0,0 +1,18 @@
+#ifndef TIMER_CONFIG_H_
+#define TIMER_CONFIG_H_
+
+/*
+	Included ahead of every source of test_timer in place of
+	inc/timer_config.h, so timer.c is tested on timers of its own.
+*/
+#define TIMER_LIST(TIMER_DEF) \
+	TIMER_DEF(TIMER_ID_TEST0, test_timeout_handler) \
+	TIMER_DEF(TIMER_ID_TEST1, test_timeout_handler) \
+	TIMER_DEF(TIMER_ID_TEST2, test_timeout_handler) \
+	TIMER_DEF(TIMER_ID_TEST3, test_timeout_handler) \
+	TIMER_DEF(TIMER_ID_TEST4, test_timeout_handler) \
+	TIMER_DEF(TIMER_ID_TEST5, test_timeout_handler) \
+	TIMER_DEF(TIMER_ID_TEST6, test_timeout_handler) \
+	TIMER_DEF(TIMER_ID_TEST7, test_timeout_handler)
+
+#endif // TIMER_CONFIG_H_